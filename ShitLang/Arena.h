@@ -0,0 +1,122 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#include "MemoryStats.h"
+
+/*
+    Bump allocator that owns every node built during one parse.
+    Objects are carved out of large blocks next to each other and all die together on reset(),
+    which also keeps the blocks around so the next line can reuse them without touching malloc.
+*/
+class Arena {
+public:
+    explicit Arena(size_t block_size = 16 * 1024) : block_size(block_size) {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() {
+        run_finalizers();
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        void* memory = allocate(sizeof(T), alignof(T));
+        T* object = new (memory) T(std::forward<Args>(args)...);
+        objects++;
+
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            // The finalizer record lives in the arena too, so destruction never allocates
+            Finalizer* finalizer = static_cast<Finalizer*>(allocate(sizeof(Finalizer), alignof(Finalizer)));
+            finalizer->destroy = [](void* p) { static_cast<T*>(p)->~T(); };
+            finalizer->object = object;
+            finalizer->next = finalizers;
+            finalizers = finalizer;
+        }
+        return object;
+    }
+
+    void* allocate(size_t size, size_t alignment) {
+        while (current < blocks.size()) {
+            Block& block = blocks[current];
+            uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+            uintptr_t aligned = (base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1);
+            size_t end = static_cast<size_t>(aligned - base) + size;
+            if (end <= block.size) {
+                offset = end;
+                used += size;
+                return reinterpret_cast<void*>(aligned);
+            }
+            // Doesn't fit, move on to the next block we already own (if any)
+            current++;
+            offset = 0;
+        }
+
+        size_t new_size = size + alignment > block_size ? size + alignment : block_size;
+        MemoryStats::CategoryScope memory(MemoryStats::AST);
+        blocks.push_back(Block{ std::unique_ptr<char[]>(new char[new_size]), new_size });
+        current = blocks.size() - 1;
+        offset = 0;
+        return allocate(size, alignment);
+    }
+
+    /* Destroys everything allocated so far but keeps the memory for reuse */
+    void reset() {
+        run_finalizers();
+        current = 0;
+        offset = 0;
+        used = 0;
+        objects = 0;
+    }
+
+    /* Number of objects made since the last reset, i.e. nodes for a parse */
+    size_t object_count() const {
+        return objects;
+    }
+
+    size_t bytes_used() const {
+        return used;
+    }
+
+    size_t bytes_reserved() const {
+        size_t total = 0;
+        for (const Block& block : blocks) {
+            total += block.size;
+        }
+        return total;
+    }
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    struct Finalizer {
+        void (*destroy)(void*);
+        void* object;
+        Finalizer* next;
+    };
+
+    void run_finalizers() {
+        while (finalizers) {
+            finalizers->destroy(finalizers->object);
+            finalizers = finalizers->next;
+        }
+    }
+
+    std::vector<Block> blocks;
+    Finalizer* finalizers = nullptr;
+    size_t block_size;
+    size_t current = 0;
+    size_t offset = 0;
+    size_t used = 0;
+    size_t objects = 0;
+};
@@ -0,0 +1,275 @@
+#include "Batch.h"
+
+#include <charconv>
+#include <algorithm>
+#include <stdexcept>
+
+#include "Tokenizer.h"
+#include "Parser.h"
+#include "Optimizer.h"
+#include "Arena.h"
+
+BinaryColumns::BinaryColumns(const std::string& path, std::vector<std::string> column_names) : file(path) {
+    names = std::move(column_names);
+    if (names.empty()) {
+        throw std::invalid_argument("Binary input needs --columns");
+    }
+
+    std::string_view bytes = file.text();
+    size_t row_bytes = names.size() * sizeof(double);
+    if (bytes.size() % row_bytes != 0) {
+        throw std::runtime_error("Binary input size isn't a whole number of rows: " + path);
+    }
+    // Mappings start on a page boundary, so the doubles are aligned
+    data = reinterpret_cast<const double*>(bytes.data());
+    rows = bytes.size() / row_bytes;
+}
+
+size_t BinaryColumns::next(size_t max_rows, std::vector<const double*>& columns) {
+    size_t count = std::min(max_rows, rows - position);
+    columns.resize(names.size());
+    for (size_t column = 0; column < names.size(); column++) {
+        columns[column] = data + column * rows + position;
+    }
+    position += count;
+    return count;
+}
+
+static std::string_view trim(std::string_view text) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r')) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+CsvColumns::CsvColumns(const std::string& path) : file(path), text(file.text()) {
+    size_t end = text.find('\n');
+    std::string_view header = text.substr(0, end);
+    position = end == std::string_view::npos ? text.size() : end + 1;
+
+    while (true) {
+        size_t comma = header.find(',');
+        std::string_view name = trim(header.substr(0, comma));
+        if (name.empty()) {
+            throw std::runtime_error("CSV header has an empty column name: " + path);
+        }
+        names.emplace_back(name);
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        header.remove_prefix(comma + 1);
+    }
+    buffers.resize(names.size());
+}
+
+size_t CsvColumns::next(size_t max_rows, std::vector<const double*>& columns) {
+    for (std::vector<double>& buffer : buffers) {
+        buffer.resize(max_rows);
+    }
+
+    size_t rows = 0;
+    while (rows < max_rows && position < text.size()) {
+        size_t end = text.find('\n', position);
+        if (end == std::string_view::npos) {
+            end = text.size();
+        }
+        std::string_view row = text.substr(position, end - position);
+        position = end + 1;
+        line++;
+
+        if (trim(row).empty()) {
+            continue;
+        }
+
+        size_t column = 0;
+        while (true) {
+            size_t comma = row.find(',');
+            std::string_view field = trim(row.substr(0, comma));
+            if (!field.empty() && field.front() == '+') {
+                field.remove_prefix(1); // from_chars doesn't take a leading +
+            }
+
+            double value = 0;
+            std::from_chars_result parsed = std::from_chars(field.data(), field.data() + field.size(), value);
+            if (parsed.ec != std::errc() || parsed.ptr != field.data() + field.size()) {
+                throw std::runtime_error("CSV line " + std::to_string(line) + ": not a number: " + std::string(field));
+            }
+            if (column == names.size()) {
+                throw std::runtime_error("CSV line " + std::to_string(line) + " has more than " + std::to_string(names.size()) + " values");
+            }
+            buffers[column++][rows] = value;
+
+            if (comma == std::string_view::npos) {
+                break;
+            }
+            row.remove_prefix(comma + 1);
+        }
+        if (column != names.size()) {
+            throw std::runtime_error("CSV line " + std::to_string(line) + " has " + std::to_string(column) + " values, expected " + std::to_string(names.size()));
+        }
+        rows++;
+    }
+
+    columns.resize(names.size());
+    for (size_t column = 0; column < names.size(); column++) {
+        columns[column] = buffers[column].data();
+    }
+    return rows;
+}
+
+BatchExpression::BatchExpression(std::string_view source, const std::vector<std::string>& columns, bool optimize) {
+    // Declaring the columns first gives column i slot i
+    Environment variables;
+    for (const std::string& column : columns) {
+        variables.declare(column);
+    }
+
+    Tokenizer toker(source, &variables);
+    std::vector<Token> tokens = toker.tokenize();
+
+    Arena arena;
+    Parser parser(tokens, &variables, arena);
+    Node* root = parser.parse();
+    if (root == nullptr) {
+        throw std::invalid_argument("Batch mode needs an expression");
+    }
+    if (optimize) {
+        root = Optimizer(arena).optimize(root);
+    }
+
+    result = lower(root);
+}
+
+// Reuses an operand's temp for the result when there is one, everything else is a fresh block
+uint32_t BatchExpression::output_temp(Ref a, Ref b) {
+    if (a.kind == Ref::TEMP) {
+        return a.index;
+    }
+    if (b.kind == Ref::TEMP) {
+        return b.index;
+    }
+    temps.emplace_back(block_rows);
+    return static_cast<uint32_t>(temps.size() - 1);
+}
+
+BatchExpression::Ref BatchExpression::lower(const Node* node) {
+    if (auto* number = dynamic_cast<const NumberNode*>(node)) {
+        constants.push_back(number->get_value().to_double()); // Columns are doubles, so everything here is done in doubles
+        return { Ref::CONSTANT, static_cast<uint32_t>(constants.size() - 1) };
+    }
+    if (auto* variable = dynamic_cast<const VariableNode*>(node)) {
+        return { Ref::COLUMN, variable->get_slot() };
+    }
+    if (auto* unary = dynamic_cast<const UnaryOperationNode*>(node)) {
+        if (unary->get_operation() != '-') {
+            throw std::invalid_argument("Unsupported unary operation");
+        }
+        Ref operand = lower(unary->get_operand());
+        Step step{ Step::NEGATE, kernels::Op::ADD, 0, operand, operand, output_temp(operand, operand) };
+        steps.push_back(step);
+        return { Ref::TEMP, step.out };
+    }
+    if (auto* power = dynamic_cast<const IntegerPowerNode*>(node)) {
+        Ref base = lower(power->get_base());
+        Step step{ Step::POWI, kernels::Op::POWER, power->get_exponent(), base, base, output_temp(base, base) };
+        steps.push_back(step);
+        return { Ref::TEMP, step.out };
+    }
+
+    kernels::Op op;
+    const Node* left;
+    const Node* right;
+    if (auto* binary = dynamic_cast<const BinaryOperationNode*>(node)) {
+        switch (binary->get_operation()) {
+        case '+': op = kernels::Op::ADD; break;
+        case '-': op = kernels::Op::SUBTRACT; break;
+        case '*': op = kernels::Op::MULTIPLY; break;
+        case '/': op = kernels::Op::DIVIDE; break;
+        case '^': op = kernels::Op::POWER; break;
+        default: throw std::invalid_argument("Unsupported operation");
+        }
+        left = binary->get_left();
+        right = binary->get_right();
+    }
+    else if (auto* relational = dynamic_cast<const RelationalOperationNode*>(node)) {
+        switch (relational->get_operation()) {
+        case '<': op = kernels::Op::LESS; break;
+        case '>': op = kernels::Op::GREATER; break;
+        case ',': op = kernels::Op::LESS_EQ; break;
+        case '.': op = kernels::Op::GREATER_EQ; break;
+        case '=': op = kernels::Op::EQUAL; break;
+        case '&': op = kernels::Op::AND; break;
+        case '|': op = kernels::Op::OR; break;
+        default: throw std::invalid_argument("Unsupported relational operation");
+        }
+        left = relational->get_left();
+        right = relational->get_right();
+    }
+    else {
+        throw std::invalid_argument("Batch mode only takes a single expression, no let, print, if or while");
+    }
+
+    Ref a = lower(left);
+    Ref b = lower(right);
+    Step step{ Step::BINARY, op, 0, a, b, output_temp(a, b) };
+    steps.push_back(step);
+    return { Ref::TEMP, step.out };
+}
+
+kernels::Operand BatchExpression::operand(Ref ref, const std::vector<const double*>& columns) const {
+    switch (ref.kind) {
+    case Ref::COLUMN:   return { columns[ref.index], false };
+    case Ref::CONSTANT: return { &constants[ref.index], true };
+    default:            return { temps[ref.index].data(), false };
+    }
+}
+
+void BatchExpression::evaluate(const std::vector<const double*>& columns, size_t rows, double* out) {
+    for (size_t start = 0; start < rows; start += block_rows) {
+        size_t count = std::min(block_rows, rows - start);
+
+        // Columns move forward a block at a time, temps always start at 0
+        std::vector<const double*> block(columns.size());
+        for (size_t column = 0; column < columns.size(); column++) {
+            block[column] = columns[column] + start;
+        }
+
+        for (const Step& step : steps) {
+            double* target = temps[step.out].data();
+            switch (step.kind) {
+            case Step::BINARY:
+                kernels::binary(step.op, operand(step.a, block), operand(step.b, block), target, count);
+                break;
+            case Step::NEGATE:
+                kernels::negate(operand(step.a, block), target, count);
+                break;
+            case Step::POWI:
+                kernels::integer_power(operand(step.a, block), step.exponent, target, count);
+                break;
+            }
+        }
+
+        kernels::Operand value = operand(result, block);
+        for (size_t row = 0; row < count; row++) {
+            out[start + row] = value.data[value.broadcast ? 0 : row];
+        }
+    }
+}
+
+size_t BatchExpression::run(ColumnReader& reader, OutputSink& output) {
+    std::vector<const double*> columns;
+    std::vector<double> results(block_rows);
+    size_t total = 0;
+
+    while (size_t rows = reader.next(block_rows, columns)) {
+        evaluate(columns, rows, results.data());
+        for (size_t row = 0; row < rows; row++) {
+            output.write_number(results[row]);
+        }
+        total += rows;
+    }
+    return total;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "Kernels.h"
+#include "MappedFile.h"
+#include "OutputSink.h"
+
+class Node;
+
+/*
+    Columnar batch mode: one expression evaluated over every row of a table.
+    Variables in the expression name columns. Instead of running the expression once per row, the tree is
+    lowered to a short list of kernel calls that each go over a block of rows at a time, so a million rows
+    cost a thousand trips through the list instead of a million trips through the interpreter.
+*/
+
+/* Where batch mode gets its rows from, a block of every column at a time */
+class ColumnReader {
+public:
+    virtual ~ColumnReader() = default;
+
+    const std::vector<std::string>& get_names() const {
+        return names;
+    }
+
+    /* Points `columns` at the next rows of every column, returns how many rows that is (0 at the end) */
+    virtual size_t next(size_t max_rows, std::vector<const double*>& columns) = 0;
+
+protected:
+    std::vector<std::string> names;
+};
+
+/* Raw little-endian float64 columns stored one after the other, read straight out of the mapping */
+class BinaryColumns : public ColumnReader {
+public:
+    BinaryColumns(const std::string& path, std::vector<std::string> column_names);
+
+    size_t next(size_t max_rows, std::vector<const double*>& columns) override;
+
+private:
+    MappedFile file;
+    const double* data = nullptr;
+    size_t rows = 0;
+    size_t position = 0;
+};
+
+/* A CSV file with a header row of column names, parsed a block at a time */
+class CsvColumns : public ColumnReader {
+public:
+    explicit CsvColumns(const std::string& path);
+
+    size_t next(size_t max_rows, std::vector<const double*>& columns) override;
+
+private:
+    MappedFile file;
+    std::string_view text;
+    size_t position = 0;
+    size_t line = 1;
+    std::vector<std::vector<double>> buffers;
+};
+
+class BatchExpression {
+public:
+    static constexpr size_t block_rows = 1024;
+
+    /* Parses `source` with one variable per column, in column order */
+    BatchExpression(std::string_view source, const std::vector<std::string>& columns, bool optimize = true);
+
+    /* out[row] = the expression for the first `rows` rows, `columns` as handed out by ColumnReader::next */
+    void evaluate(const std::vector<const double*>& columns, size_t rows, double* out);
+
+    /* Evaluates every row `reader` has and prints each result, returns the number of rows */
+    size_t run(ColumnReader& reader, OutputSink& output);
+
+    size_t step_count() const {
+        return steps.size();
+    }
+
+private:
+    struct Ref {
+        enum Kind : uint8_t { COLUMN, CONSTANT, TEMP } kind;
+        uint32_t index;
+    };
+
+    struct Step {
+        enum Kind : uint8_t { BINARY, NEGATE, POWI } kind;
+        kernels::Op op;
+        int32_t exponent;
+        Ref a;
+        Ref b;
+        uint32_t out; // Always a temp
+    };
+
+    Ref lower(const Node* node);
+    uint32_t output_temp(Ref a, Ref b);
+    kernels::Operand operand(Ref ref, const std::vector<const double*>& columns) const;
+
+    std::vector<Step> steps;
+    std::vector<double> constants;
+    std::vector<std::vector<double>> temps;
+    Ref result{ Ref::CONSTANT, 0 };
+};
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "Value.h"
+
+// Every instruction is a single opcode byte, optionally followed by a 32-bit operand.
+// The list is an X-macro so the enum and the VM's dispatch table can never drift apart.
+#define SHITLANG_OPCODES(X) \
+    X(OP_CONSTANT)      /* u32 constant index, pushes constants[index] */ \
+    X(OP_LOAD)          /* u32 variable slot, pushes its value */ \
+    X(OP_STORE)         /* u32 variable slot, stores the top of the stack and leaves it there */ \
+    X(OP_LOAD_LOCAL)    /* u32 frame slot, pushes an argument or local of the function running */ \
+    X(OP_STORE_LOCAL)   /* u32 frame slot, like OP_STORE */ \
+    X(OP_LOAD_REACTIVE) /* u32 variable slot of a `let :=`, recomputes it first if it's out of date */ \
+    X(OP_NEGATE)        \
+    X(OP_ADD)           \
+    X(OP_SUBTRACT)      \
+    X(OP_MULTIPLY)      \
+    X(OP_DIVIDE)        \
+    X(OP_ADD_DOUBLE)    /* typed versions for when the compiler knows one side is a double, so no int path */ \
+    X(OP_SUBTRACT_DOUBLE) \
+    X(OP_MULTIPLY_DOUBLE) \
+    X(OP_DIVIDE_DOUBLE) \
+    X(OP_POWER)         \
+    X(OP_POWI)          /* i32 exponent, raises the top of the stack to it without std::pow (see integer_power()) */ \
+    X(OP_LESS)          \
+    X(OP_GREATER)       \
+    X(OP_LESS_EQ)       \
+    X(OP_GREATER_EQ)    \
+    X(OP_EQUAL)         \
+    X(OP_AND)           \
+    X(OP_OR)            \
+    X(OP_VECTOR)        /* u32 count, pops that many numbers and pushes a vector of them */ \
+    X(OP_SUM)           /* reductions, a vector becomes one number and a number stays as it is */ \
+    X(OP_MIN)           \
+    X(OP_MAX)           \
+    X(OP_PRINT)         /* prints the top of the stack and leaves it there */ \
+    X(OP_POP)           \
+    X(OP_JUMP)          /* u32 absolute code offset */ \
+    X(OP_JUMP_IF_FALSE) /* u32 absolute code offset, pops the condition and jumps if it is 0 */ \
+    X(OP_LINE)          /* u32 source line, only emitted for --profile */ \
+    X(OP_CALL_NATIVE)   /* u32 index into natives, pushes the result and goes on to the OP_JUMP after it, */ \
+                        /* or skips that jump into the interpreted copy when a variable isn't a double */ \
+    X(OP_CALL_NATIVE_CHECKED) /* same, but also runs the tree and throws if the two differ (--jit-verify) */ \
+    X(OP_CALL)          /* u32 index into calls, the arguments are the top values and become the new frame */ \
+    X(OP_RETURN)        /* returns the top of the stack (or 0 if empty), to the caller when in a function */
+
+enum OpCode : uint8_t
+{
+#define SHITLANG_OPCODE_ENUM(name) name,
+    SHITLANG_OPCODES(SHITLANG_OPCODE_ENUM)
+#undef SHITLANG_OPCODE_ENUM
+    OP_COUNT
+};
+
+class Node;
+struct Function;
+
+/*
+    Machine code the JIT made for one expression, it reads variables straight out of the slot array.
+    Returns false without touching `result` when one of the variables it reads isn't a double.
+*/
+using NativeFunction = bool (*)(const Value* slots, double* result);
+
+struct NativeCall {
+    NativeFunction function;
+    std::shared_ptr<const void> code; // Keeps the executable memory alive for as long as a chunk uses it
+    const Node* expression;           // The tree it was compiled from, for --jit-verify
+    ValueType type;                   // What the expression gives, relational ones give ints
+};
+
+/* What the VM actually reads while running, borrowed from a Chunk or pointing into a mapped .slc file */
+struct ChunkView {
+    const uint8_t* code = nullptr;
+    size_t code_size = 0;
+    const Value* constants = nullptr;
+    const NativeCall* natives = nullptr;
+    size_t max_stack = 0;
+    const Function* const* calls = nullptr;
+};
+
+/* Flat bytecode produced by Node::compile and executed by the VM in Interpreter.h */
+class Chunk {
+public:
+    std::vector<uint8_t> code;
+    std::vector<Value> constants;
+    std::vector<NativeCall> natives;
+    std::vector<const Function*> calls;                   // What OP_CALL operands index
+    std::vector<std::shared_ptr<const Function>> callees; // Keeps those alive, all but a function's calls to itself
+    uint32_t slot_count = 0; // Variable slots the code expects, only filled in where values and names live apart (--stream)
+
+    void emit(OpCode op) {
+        code.push_back(op);
+        track_stack(op);
+    }
+
+    void emit(OpCode op, uint32_t operand) {
+        emit(op);
+        uint8_t bytes[sizeof(operand)];
+        std::memcpy(bytes, &operand, sizeof(operand));
+        code.insert(code.end(), bytes, bytes + sizeof(operand));
+    }
+
+    void emit_constant(Value value) {
+        emit(OP_CONSTANT, add_constant(value));
+    }
+
+    uint32_t add_constant(Value value) {
+        // Scripts repeat the same literals a lot, so reuse existing slots (keyed on the bits, so -0.0 and NaNs survive)
+        auto& slots = constant_slots[value.is_int() ? 0 : 1];
+        auto found = slots.find(value.bits());
+        if (found != slots.end()) {
+            return found->second;
+        }
+        constants.push_back(value);
+        slots.emplace(value.bits(), static_cast<uint32_t>(constants.size() - 1));
+        return static_cast<uint32_t>(constants.size() - 1);
+    }
+
+    uint32_t add_native(NativeCall call) {
+        natives.push_back(std::move(call));
+        return static_cast<uint32_t>(natives.size() - 1);
+    }
+
+    /* Index of `function` in calls, `owner` is its shared_ptr or null when this is the function's own chunk */
+    uint32_t add_call(const Function* function, std::shared_ptr<const Function> owner) {
+        for (size_t i = 0; i < calls.size(); i++) {
+            if (calls[i] == function) {
+                return static_cast<uint32_t>(i);
+            }
+        }
+        calls.push_back(function);
+        if (owner) {
+            callees.push_back(std::move(owner));
+        }
+        return static_cast<uint32_t>(calls.size() - 1);
+    }
+
+    /* Emits a jump with a placeholder target, returns where to patch it */
+    size_t emit_jump(OpCode op) {
+        emit(op, 0);
+        return code.size() - sizeof(uint32_t);
+    }
+
+    /* Points a jump emitted by emit_jump at the next instruction */
+    void patch_jump(size_t operand_offset) {
+        uint32_t target = static_cast<uint32_t>(code.size());
+        std::memcpy(&code[operand_offset], &target, sizeof(target));
+    }
+
+    /* Current end of the code, the target for backward jumps */
+    uint32_t position() const {
+        return static_cast<uint32_t>(code.size());
+    }
+
+    /*
+        Stack tracking only sees a straight line of code. When two branches each leave a value,
+        the compiler takes one back before emitting the second branch.
+    */
+    void adjust_depth(int delta) {
+        depth += delta;
+    }
+
+    static uint32_t read_operand(const uint8_t* ip) {
+        uint32_t operand;
+        std::memcpy(&operand, ip, sizeof(operand));
+        return operand;
+    }
+
+    /* Deepest the value stack can get while running this chunk, so the VM can size it once */
+    size_t max_stack() const {
+        return max_depth;
+    }
+
+    /* For code compiled somewhere else (a .slc file), which comes with its depth already worked out */
+    void set_max_stack(size_t depth) {
+        max_depth = depth;
+    }
+
+    ChunkView view() const {
+        return ChunkView{ code.data(), code.size(), constants.data(), natives.data(), max_depth, calls.data() };
+    }
+
+private:
+    void track_stack(OpCode op) {
+        switch (op) {
+        case OP_CONSTANT:
+        case OP_LOAD:
+        case OP_LOAD_LOCAL:
+        case OP_LOAD_REACTIVE:
+        case OP_VECTOR: // Pops its elements too, the compiler takes those back with adjust_depth
+        case OP_CALL:   // Same with its arguments
+        case OP_CALL_NATIVE:
+        case OP_CALL_NATIVE_CHECKED:
+            depth++;
+            break;
+        case OP_NEGATE:
+        case OP_POWI:
+        case OP_SUM:
+        case OP_MIN:
+        case OP_MAX:
+        case OP_STORE:
+        case OP_STORE_LOCAL:
+        case OP_PRINT:
+        case OP_RETURN:
+            break;
+        case OP_JUMP:
+        case OP_LINE:
+            break;
+        case OP_POP:
+        case OP_JUMP_IF_FALSE:
+            depth--;
+            break;
+        default: // binary operators pop two and push one
+            depth--;
+            break;
+        }
+        if (depth > max_depth) {
+            max_depth = depth;
+        }
+    }
+
+    std::unordered_map<uint64_t, uint32_t> constant_slots[2]; // Ints, doubles
+    size_t depth = 0;
+    size_t max_depth = 0;
+};
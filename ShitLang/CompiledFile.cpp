@@ -0,0 +1,578 @@
+#include "CompiledFile.h"
+
+#include <filesystem>
+#include <fstream>
+#include <unordered_set>
+#include <unordered_map>
+#include <algorithm>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+
+namespace {
+
+struct Header {
+    char magic[4];          // "SLC\0"
+    uint32_t version;
+    uint32_t byte_order;    // 0x01020304 as the writer saw it, a file from a machine with the other byte order won't match
+    uint32_t flags;
+    uint64_t source_hash;
+    uint64_t source_size;
+    uint64_t payload_hash;  // Everything after the header, catches truncated or damaged files
+    uint32_t symbol_count;
+    uint32_t constant_count;
+    uint32_t code_size;
+    uint32_t symbols_size;
+    uint32_t max_stack;
+    uint32_t functions_size;
+};
+
+static_assert(sizeof(Header) == 64, "The constants right after the header have to stay 16-aligned");
+static_assert(sizeof(Value) == 16 && offsetof(Value, type) == 8, "Constants are stored exactly as they are in memory");
+
+constexpr char magic[4] = { 'S', 'L', 'C', '\0' };
+constexpr uint32_t byte_order = 0x01020304;
+constexpr uint32_t flag_optimized = 1;
+
+// FNV-1a, plenty to notice an edited script and a lot cheaper than tokenizing it
+uint64_t hash_bytes(const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+bool has_operand(uint8_t op) {
+    switch (op) {
+    case OP_CONSTANT:
+    case OP_LOAD:
+    case OP_STORE:
+    case OP_LOAD_LOCAL:
+    case OP_STORE_LOCAL:
+    case OP_LOAD_REACTIVE:
+    case OP_CALL:
+    case OP_POWI:
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LINE:
+    case OP_CALL_NATIVE:
+    case OP_CALL_NATIVE_CHECKED:
+    case OP_VECTOR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+    Follows every path through code valid_code() already checked and works out how deep the stack gets.
+    The VM pushes without bounds checks and sizes its stack from the stored max_stack, which a file can
+    claim anything for, so a path that goes deeper than that, pops what isn't there or reaches the same
+    instruction at two different depths makes the file bad. Jumps are the only branches, the compiler
+    always leaves them at the same depth on both sides.
+*/
+bool valid_stack(const uint8_t* code, uint32_t size, const std::vector<uint32_t>& call_arities, uint32_t max_stack, bool function) {
+    std::vector<int64_t> depths(size, -1);
+    std::vector<uint32_t> pending{ 0 };
+    depths[0] = 0;
+
+    // Reaching `at` at `depth`, false if it was reached at another depth before
+    auto reach = [&](uint32_t at, int64_t depth) {
+        if (depths[at] < 0) {
+            depths[at] = depth;
+            pending.push_back(at);
+            return true;
+        }
+        return depths[at] == depth;
+    };
+
+    while (!pending.empty()) {
+        uint32_t at = pending.back();
+        pending.pop_back();
+        int64_t depth = depths[at];
+        uint8_t op = code[at];
+        uint32_t operand = has_operand(op) ? Chunk::read_operand(code + at + 1) : 0;
+        uint32_t next = at + 1 + (has_operand(op) ? sizeof(uint32_t) : 0);
+
+        int64_t pops = 0;
+        int64_t pushes = 0;
+        switch (op) {
+        case OP_CONSTANT:
+        case OP_LOAD:
+        case OP_LOAD_LOCAL:
+            pushes = 1;
+            break;
+        case OP_STORE:
+        case OP_STORE_LOCAL:
+        case OP_NEGATE:
+        case OP_POWI:
+        case OP_SUM:
+        case OP_MIN:
+        case OP_MAX:
+        case OP_PRINT:
+            pops = 1; // They work on the top value in place, it has to be there
+            pushes = 1;
+            break;
+        case OP_VECTOR:
+            pops = operand;
+            pushes = 1;
+            break;
+        case OP_CALL:
+            pops = call_arities[operand];
+            pushes = 1;
+            break;
+        case OP_POP:
+        case OP_JUMP_IF_FALSE:
+            pops = 1;
+            break;
+        case OP_JUMP:
+            break;
+        case OP_RETURN:
+            // A function's result goes into its frame, the main program can end on an empty stack
+            if (depth < (function ? 1 : 0)) {
+                return false;
+            }
+            continue;
+        default: // binary operators
+            pops = 2;
+            pushes = 1;
+            break;
+        }
+        if (depth < pops) {
+            return false;
+        }
+        depth += pushes - pops;
+        if (depth > max_stack) {
+            return false;
+        }
+
+        if (op == OP_JUMP || op == OP_JUMP_IF_FALSE) {
+            if (!reach(operand, depth)) {
+                return false;
+            }
+        }
+        if (op != OP_JUMP && (next >= size || !reach(next, depth))) {
+            return false; // Only OP_RETURN can be last, running off the end is as bad as a bad jump
+        }
+    }
+    return true;
+}
+
+/*
+    Everything the VM takes on trust: known opcodes, operands in range, jumps landing on an instruction and
+    a stack no deeper than `max_stack` (see valid_stack). Only the arity of what OP_CALL calls is needed.
+*/
+bool valid_code(const uint8_t* code, uint32_t size, uint32_t constant_count, uint32_t slot_count, uint32_t local_count,
+    const std::vector<uint32_t>& call_arities, uint32_t max_stack, bool function) {
+    uint32_t call_count = static_cast<uint32_t>(call_arities.size());
+    if (size == 0) {
+        return true;
+    }
+    if (code[size - 1] != OP_RETURN) {
+        return false;
+    }
+
+    std::vector<bool> starts(size, false);
+    std::vector<uint32_t> jumps;
+    uint32_t at = 0;
+    while (at < size) {
+        starts[at] = true;
+        uint8_t op = code[at++];
+        if (op >= OP_COUNT || op == OP_LINE || op == OP_CALL_NATIVE || op == OP_CALL_NATIVE_CHECKED || op == OP_LOAD_REACTIVE) {
+            return false; // Profiling, native code and reactive variables never get written, so these can't be in a good file
+        }
+        if (!has_operand(op)) {
+            continue;
+        }
+        if (size - at < sizeof(uint32_t)) {
+            return false;
+        }
+        uint32_t operand = Chunk::read_operand(code + at);
+        at += sizeof(uint32_t);
+        if ((op == OP_CONSTANT && operand >= constant_count) || ((op == OP_LOAD || op == OP_STORE) && operand >= slot_count)
+            || ((op == OP_LOAD_LOCAL || op == OP_STORE_LOCAL) && operand >= local_count) || (op == OP_CALL && operand >= call_count)) {
+            return false;
+        }
+        if (op == OP_JUMP || op == OP_JUMP_IF_FALSE) {
+            jumps.push_back(operand);
+        }
+    }
+    for (uint32_t target : jumps) {
+        if (target >= size || !starts[target]) {
+            return false;
+        }
+    }
+    return valid_stack(code, size, call_arities, max_stack, function);
+}
+
+void append(std::string& out, const void* data, size_t size) {
+    out.append(static_cast<const char*>(data), size);
+}
+
+void append_u32(std::string& out, uint32_t value) {
+    append(out, &value, sizeof(value));
+}
+
+// Constants are stored field by field so the padding is written as zeros
+void append_constants(std::string& out, const std::vector<Value>& constants) {
+    for (const Value& constant : constants) {
+        char stored[sizeof(Value)] = {};
+        uint64_t bits = constant.bits();
+        std::memcpy(stored, &bits, sizeof(bits));
+        stored[offsetof(Value, type)] = static_cast<char>(constant.type);
+        append(out, stored, sizeof(stored));
+    }
+}
+
+bool valid_constant(const uint8_t* stored) {
+    uint8_t type = stored[offsetof(Value, type)];
+    return type == static_cast<uint8_t>(ValueType::INT) || type == static_cast<uint8_t>(ValueType::DOUBLE);
+}
+
+// Bounds checked reads through the functions section
+struct Reader {
+    const uint8_t* at;
+    const uint8_t* end;
+
+    bool read(uint32_t& value) {
+        const uint8_t* bytes;
+        if (!read(sizeof(value), bytes)) {
+            return false;
+        }
+        std::memcpy(&value, bytes, sizeof(value));
+        return true;
+    }
+
+    bool read(uint64_t size, const uint8_t*& bytes) {
+        if (static_cast<uint64_t>(end - at) < size) {
+            return false;
+        }
+        bytes = at;
+        at += size;
+        return true;
+    }
+};
+
+bool read_calls(Reader& reader, std::vector<uint32_t>& calls) {
+    uint32_t count;
+    if (!reader.read(count) || static_cast<uint64_t>(reader.end - reader.at) < static_cast<uint64_t>(count) * sizeof(uint32_t)) {
+        return false;
+    }
+    calls.resize(count);
+    for (uint32_t& call : calls) {
+        reader.read(call);
+    }
+    return true;
+}
+
+/*
+    The functions section: the main chunk's call table, then every function with its own call table,
+    constants and code. Functions are small, so they're copied out of the mapping into ordinary chunks.
+*/
+bool read_functions(Reader reader, uint32_t slot_count, std::vector<std::shared_ptr<Function>>& functions, std::vector<const Function*>& main_calls) {
+    std::vector<uint32_t> main_ids;
+    uint32_t function_count;
+    if (!read_calls(reader, main_ids) || !reader.read(function_count)) {
+        return false;
+    }
+
+    std::vector<std::vector<uint32_t>> call_ids(function_count);
+    std::unordered_set<std::string_view> names;
+    for (uint32_t i = 0; i < function_count; i++) {
+        uint32_t name_length, arity, locals, max_stack, constant_count, code_size;
+        const uint8_t* name;
+        const uint8_t* constants;
+        const uint8_t* code;
+        if (!reader.read(name_length) || !reader.read(name_length, name) || !reader.read(arity) || !reader.read(locals)
+            || !reader.read(max_stack) || !reader.read(constant_count) || !reader.read(code_size) || !read_calls(reader, call_ids[i])
+            || !reader.read(static_cast<uint64_t>(constant_count) * sizeof(Value), constants) || !reader.read(code_size, code)) {
+            return false;
+        }
+        // Like the parser, a function can only call itself or the ones defined before it
+        std::vector<uint32_t> call_arities;
+        for (uint32_t id : call_ids[i]) {
+            if (id > i) {
+                return false;
+            }
+            call_arities.push_back(id == i ? arity : functions[id]->arity);
+        }
+        std::string_view function_name(reinterpret_cast<const char*>(name), name_length);
+        if (function_name.empty() || !names.insert(function_name).second || arity > locals || code_size == 0
+            || !valid_code(code, code_size, constant_count, slot_count, locals, call_arities, max_stack, true)) {
+            return false;
+        }
+
+        std::shared_ptr<Function> function = std::make_shared<Function>(function_name, arity);
+        function->locals = locals;
+        function->chunk.code.assign(code, code + code_size);
+        for (uint32_t c = 0; c < constant_count; c++) {
+            const uint8_t* stored = constants + c * sizeof(Value);
+            if (!valid_constant(stored)) {
+                return false;
+            }
+            Value constant;
+            std::memcpy(static_cast<void*>(&constant), stored, sizeof(Value));
+            function->chunk.constants.push_back(constant);
+        }
+        function->chunk.set_max_stack(max_stack);
+        functions.push_back(std::move(function));
+    }
+    if (reader.at != reader.end) {
+        return false;
+    }
+
+    // Calls to itself only get resolved once the function exists
+    for (uint32_t i = 0; i < function_count; i++) {
+        for (uint32_t id : call_ids[i]) {
+            functions[i]->chunk.add_call(functions[id].get(), id == i ? nullptr : functions[id]);
+        }
+    }
+    for (uint32_t id : main_ids) {
+        if (id >= function_count) {
+            return false;
+        }
+        main_calls.push_back(functions[id].get());
+    }
+    return true;
+}
+
+}
+
+std::string CompiledFile::path_for(const std::string& source_path, const std::string& directory) {
+    std::filesystem::path source(source_path);
+    if (directory.empty()) {
+        return source.replace_extension(".slc").string();
+    }
+
+    // Scripts with the same name in different directories mustn't share a file, so the full path goes into the name
+    std::error_code error;
+    std::filesystem::path absolute = std::filesystem::absolute(source, error);
+    std::string full = (error ? source : absolute).lexically_normal().string();
+    char hash[17];
+    std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(hash_bytes(full.data(), full.size())));
+    return (std::filesystem::path(directory) / (source.stem().string() + "-" + hash + ".slc")).string();
+}
+
+std::unique_ptr<CompiledFile> CompiledFile::open(const std::string& path, std::string_view source, bool optimize) {
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(path, error)) {
+        return nullptr;
+    }
+
+    std::unique_ptr<CompiledFile> compiled;
+    try {
+        compiled.reset(new CompiledFile(path));
+    }
+    catch (const std::exception&) {
+        return nullptr;
+    }
+
+    std::string_view bytes = compiled->file.text();
+    if (bytes.size() < sizeof(Header)) {
+        return nullptr;
+    }
+    Header header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version || header.byte_order != byte_order
+        || header.flags != (optimize ? flag_optimized : 0) || header.source_size != source.size()) {
+        return nullptr;
+    }
+
+    uint64_t constants_size = static_cast<uint64_t>(header.constant_count) * sizeof(Value);
+    if (sizeof(Header) + constants_size + header.code_size + header.symbols_size + header.functions_size != bytes.size()) {
+        return nullptr;
+    }
+    if (header.source_hash != hash_bytes(source.data(), source.size())
+        || header.payload_hash != hash_bytes(bytes.data() + sizeof(Header), bytes.size() - sizeof(Header))) {
+        return nullptr;
+    }
+
+    const uint8_t* base = reinterpret_cast<const uint8_t*>(bytes.data());
+    const uint8_t* constants = base + sizeof(Header);
+    const uint8_t* code = constants + constants_size;
+    const uint8_t* symbols = code + header.code_size;
+    if (reinterpret_cast<uintptr_t>(constants) % alignof(Value) != 0) {
+        return nullptr;
+    }
+    for (uint32_t i = 0; i < header.constant_count; i++) {
+        if (!valid_constant(constants + i * sizeof(Value))) {
+            return nullptr;
+        }
+    }
+
+    // Names have to be unique and fill the symbol table exactly, or declare() would hand out different slots
+    std::unordered_set<std::string_view> names;
+    const uint8_t* at = symbols;
+    const uint8_t* end = symbols + header.symbols_size;
+    for (uint32_t slot = 0; slot < header.symbol_count; slot++) {
+        uint32_t length;
+        if (end - at < static_cast<ptrdiff_t>(sizeof(length) + 1)) {
+            return nullptr;
+        }
+        std::memcpy(&length, at, sizeof(length));
+        at += sizeof(length) + 1;
+        if (static_cast<uint64_t>(end - at) < length || !names.emplace(reinterpret_cast<const char*>(at), length).second) {
+            return nullptr;
+        }
+        at += length;
+    }
+    if (at != end || !read_functions(Reader{ end, end + header.functions_size }, header.symbol_count, compiled->functions, compiled->calls)) {
+        return nullptr;
+    }
+    std::vector<uint32_t> call_arities;
+    for (const Function* function : compiled->calls) {
+        call_arities.push_back(function->arity);
+    }
+    if (!valid_code(code, header.code_size, header.constant_count, header.symbol_count, 0, call_arities, header.max_stack, false)) {
+        return nullptr;
+    }
+
+    compiled->chunk.code = code;
+    compiled->chunk.code_size = header.code_size;
+    compiled->chunk.constants = reinterpret_cast<const Value*>(constants);
+    compiled->chunk.max_stack = header.max_stack;
+    compiled->chunk.calls = compiled->calls.data();
+    compiled->symbols = symbols;
+    compiled->symbol_count = header.symbol_count;
+    return compiled;
+}
+
+bool CompiledFile::save(const std::string& path, std::string_view source, bool optimize, const Chunk& chunk, const Environment& variables) {
+    // Machine code addresses mean nothing to the next process, and vectors are pointers too
+    auto storable = [](const Chunk& stored) {
+        return stored.natives.empty() && std::none_of(stored.constants.begin(), stored.constants.end(), [](const Value& constant) { return constant.is_vector(); });
+    };
+    if (!storable(chunk)) {
+        return false;
+    }
+    if (!variables.get_reactives().empty()) {
+        return false; // The dependency graph would have to be written too, a program using one just compiles every run
+    }
+
+    // Calls are stored as positions in the environment's function list
+    const std::vector<std::shared_ptr<Function>>& defined = variables.get_functions();
+    std::unordered_map<const Function*, uint32_t> ids;
+    for (uint32_t id = 0; id < defined.size(); id++) {
+        ids.emplace(defined[id].get(), id);
+    }
+    auto append_calls = [&](std::string& out, const std::vector<const Function*>& calls) {
+        append_u32(out, static_cast<uint32_t>(calls.size()));
+        for (const Function* function : calls) {
+            auto found = ids.find(function);
+            if (found == ids.end()) {
+                return false;
+            }
+            append_u32(out, found->second);
+        }
+        return true;
+    };
+
+    std::string functions;
+    if (!append_calls(functions, chunk.calls)) {
+        return false;
+    }
+    append_u32(functions, static_cast<uint32_t>(defined.size()));
+    for (const std::shared_ptr<Function>& function : defined) {
+        const Chunk& body = function->chunk;
+        if (body.code.empty() || !storable(body)) {
+            return false;
+        }
+        append_u32(functions, static_cast<uint32_t>(function->name.size()));
+        functions += function->name;
+        append_u32(functions, function->arity);
+        append_u32(functions, function->locals);
+        append_u32(functions, static_cast<uint32_t>(body.max_stack()));
+        append_u32(functions, static_cast<uint32_t>(body.constants.size()));
+        append_u32(functions, static_cast<uint32_t>(body.code.size()));
+        if (!append_calls(functions, body.calls)) {
+            return false;
+        }
+        append_constants(functions, body.constants);
+        append(functions, body.code.data(), body.code.size());
+    }
+
+    std::string symbols;
+    for (uint32_t slot = 0; slot < variables.size(); slot++) {
+        const std::string& name = variables.name_of(slot);
+        uint32_t length = static_cast<uint32_t>(name.size());
+        uint8_t declared = variables.find(name) != nullptr;
+        append(symbols, &length, sizeof(length));
+        append(symbols, &declared, sizeof(declared));
+        symbols += name;
+    }
+
+    Header header = {};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.byte_order = byte_order;
+    header.flags = optimize ? flag_optimized : 0;
+    header.source_hash = hash_bytes(source.data(), source.size());
+    header.source_size = source.size();
+    header.symbol_count = static_cast<uint32_t>(variables.size());
+    header.constant_count = static_cast<uint32_t>(chunk.constants.size());
+    header.code_size = static_cast<uint32_t>(chunk.code.size());
+    header.symbols_size = static_cast<uint32_t>(symbols.size());
+    header.max_stack = static_cast<uint32_t>(chunk.max_stack());
+    header.functions_size = static_cast<uint32_t>(functions.size());
+
+    std::string bytes(sizeof(Header), '\0');
+    append_constants(bytes, chunk.constants);
+    append(bytes, chunk.code.data(), chunk.code.size());
+    bytes += symbols;
+    bytes += functions;
+    header.payload_hash = hash_bytes(bytes.data() + sizeof(Header), bytes.size() - sizeof(Header));
+    std::memcpy(&bytes[0], &header, sizeof(header));
+
+    std::error_code error;
+    std::filesystem::path target(path);
+    if (target.has_parent_path()) {
+        std::filesystem::create_directories(target.parent_path(), error);
+    }
+
+    // Unique per writer, two processes compiling the same script at once each rename a whole file into place
+    uint64_t unique = std::hash<std::thread::id>()(std::this_thread::get_id())
+        ^ static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    std::string temporary = path + ".tmp" + std::to_string(unique);
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        if (!out.flush()) {
+            out.close();
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+    }
+    std::filesystem::rename(temporary, target, error);
+    if (error) {
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
+
+void CompiledFile::declare(Environment& variables) const {
+    const uint8_t* at = symbols;
+    for (uint32_t slot = 0; slot < symbol_count; slot++) {
+        uint32_t length;
+        std::memcpy(&length, at, sizeof(length));
+        bool declared = at[sizeof(length)] != 0;
+        at += sizeof(length) + 1;
+        std::string_view name(reinterpret_cast<const char*>(at), length);
+        at += length;
+        if ((declared ? variables.declare(name) : variables.intern(name)) != slot) {
+            throw std::logic_error("Compiled programs have to be declared into an empty environment");
+        }
+    }
+    if (!variables.get_functions().empty()) {
+        throw std::logic_error("Compiled programs have to be declared into an empty environment");
+    }
+    for (const std::shared_ptr<Function>& function : functions) {
+        variables.define(function);
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#include "Chunk.h"
+#include "Environment.h"
+#include "MappedFile.h"
+
+/*
+    A compiled program on disk (.slc), so a script that hasn't changed since its last run skips the
+    tokenizer, parser, optimizer and compiler and goes straight to the VM.
+
+    Layout, all in the byte order of the machine that wrote it:
+        Header      64 bytes, see CompiledFile.cpp
+        constants   Value[constant_count], 16 bytes each and 16-aligned, used in place from the mapping
+        code        the bytecode, also used in place
+        symbols     per variable slot: u32 name length, u8 declared, the name
+        functions   the program's call table, then per function: u32 name length, the name, u32 arity,
+                    locals, max stack, constant count, code size, its call table, constants and code.
+                    A call table is a u32 count and then u32 positions in the function list.
+
+    The header holds a hash of the source the file was compiled from, so any edit to the script (or the
+    file being written by a different version, byte order or optimizer setting) just means compiling it
+    again. Only plain bytecode is stored: JIT and --profile runs never read or write these.
+*/
+class CompiledFile {
+public:
+    static constexpr uint32_t version = 3;
+
+    /* Where the compiled copy of `source_path` lives: next to it as .slc, or in `directory` if one is given */
+    static std::string path_for(const std::string& source_path, const std::string& directory);
+
+    /* Maps `path` if it holds `source` compiled with the same settings, nullptr if it's missing, stale or damaged */
+    static std::unique_ptr<CompiledFile> open(const std::string& path, std::string_view source, bool optimize);
+
+    /*
+        Writes `chunk`, compiled from `source` into an environment that started out empty, to `path`.
+        Goes through a temporary file and a rename, so readers never see half a file. Returns false if it
+        couldn't be written or can't be (native code, vector constants, reactive variables), which only costs
+        the next run a compile.
+    */
+    static bool save(const std::string& path, std::string_view source, bool optimize, const Chunk& chunk, const Environment& variables);
+
+    /* Interns the program's variables and defines its functions in `variables`, which has to be empty so the slots line up */
+    void declare(Environment& variables) const;
+
+    /* The bytecode, straight out of the mapping */
+    ChunkView view() const {
+        return chunk;
+    }
+
+private:
+    explicit CompiledFile(const std::string& path) : file(path) {}
+
+    MappedFile file;
+    ChunkView chunk;
+    const uint8_t* symbols = nullptr;
+    uint32_t symbol_count = 0;
+    std::vector<std::shared_ptr<Function>> functions;
+    std::vector<const Function*> calls; // The program's, what chunk.calls points at
+};
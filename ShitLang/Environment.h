@@ -0,0 +1,212 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <deque>
+#include <vector>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <cstdint>
+
+#include "Value.h"
+#include "MemoryStats.h"
+#include "Function.h"
+#include "Reactive.h"
+
+/*
+    Variable storage for a running program.
+    Every name is interned once into an integer slot when the parser first sees it, and from then on
+    compiled code only ever touches `values[slot]`, a flat array, instead of walking a map of strings.
+    Functions have names of their own, a call is always `name(...)` so they never clash with variables.
+    Reactive variables (`let y := ...`) are variables too, the graph keeps them up to date with `values`.
+*/
+class Environment {
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    /* Slot for `name`, or npos if the name was never interned */
+    uint32_t lookup(std::string_view name) const {
+        auto found = slots.find(name);
+        return found == slots.end() ? npos : found->second;
+    }
+
+    uint32_t intern(std::string_view name) {
+        uint32_t slot = lookup(name);
+        if (slot != npos) {
+            return slot;
+        }
+
+        // The deque never moves its strings, so the views used as keys stay valid
+        MemoryStats::CategoryScope memory(MemoryStats::VARIABLES);
+        names.emplace_back(name);
+        slot = static_cast<uint32_t>(values.size());
+        slots.emplace(names.back(), slot);
+        values.push_back(Value());
+        declared.push_back(false);
+        return slot;
+    }
+
+    /* Used by `let`: a name can only be declared once */
+    uint32_t declare(std::string_view name) {
+        uint32_t slot = intern(name);
+        if (declared[slot]) {
+            throw std::runtime_error("Variable redeclaration: " + std::string(name));
+        }
+        declared[slot] = true;
+        MemoryStats::CategoryScope memory(MemoryStats::VARIABLES);
+        declarations.push_back(slot);
+        return slot;
+    }
+
+    /* Used by variable reads: the name has to be declared already */
+    uint32_t resolve(std::string_view name) const {
+        uint32_t slot = lookup(name);
+        if (slot == npos || !declared[slot]) {
+            throw std::runtime_error("Undefined variable: " + std::string(name));
+        }
+        return slot;
+    }
+
+    struct Mark {
+        size_t declarations;
+        size_t functions;
+        size_t reactives;
+    };
+
+    /* Lets a failed parse take back the declarations and definitions it made */
+    Mark checkpoint() const {
+        return Mark{ declarations.size(), functions.size(), graph.get_reactives().size() };
+    }
+
+    /* Slots declared since `mark`, in the order they were declared */
+    std::vector<uint32_t> declared_since(const Mark& mark) const {
+        return std::vector<uint32_t>(declarations.begin() + mark.declarations, declarations.end());
+    }
+
+    /* Whether any functions or reactive variables were defined since `mark` */
+    bool defined_since(const Mark& mark) const {
+        return functions.size() > mark.functions || graph.get_reactives().size() > mark.reactives;
+    }
+
+    void rollback(const Mark& mark) {
+        while (declarations.size() > mark.declarations) {
+            declared[declarations.back()] = false;
+            declarations.pop_back();
+        }
+        while (functions.size() > mark.functions) {
+            function_names.erase(functions.back()->name);
+            functions.pop_back();
+        }
+        graph.truncate(mark.reactives);
+    }
+
+    /* Used by `fn`: like variables, a function can only be defined once */
+    void define(std::shared_ptr<Function> function) {
+        MemoryStats::CategoryScope memory(MemoryStats::VARIABLES);
+        if (!function_names.emplace(function->name, function.get()).second) {
+            throw std::runtime_error("Function redefinition: " + function->name);
+        }
+        functions.push_back(std::move(function));
+    }
+
+    /* The function called `name`, nullptr if there isn't one */
+    Function* find_function(std::string_view name) const {
+        auto found = function_names.find(name);
+        return found == function_names.end() ? nullptr : found->second;
+    }
+
+    /* Every function in the order they were defined */
+    const std::vector<std::shared_ptr<Function>>& get_functions() const {
+        return functions;
+    }
+
+    /* Used by `let y := ...`, after declare() gave the variable its slot */
+    void bind(std::shared_ptr<Reactive> reactive) {
+        MemoryStats::CategoryScope memory(MemoryStats::VARIABLES);
+        graph.add(std::move(reactive));
+    }
+
+    bool is_reactive(uint32_t slot) const {
+        return graph.is_reactive(slot);
+    }
+
+    /* Every reactive variable in the order they were defined */
+    const std::vector<std::shared_ptr<Reactive>>& get_reactives() const {
+        return graph.get_reactives();
+    }
+
+    /* What the VM gets to keep reactive variables up to date, nullptr while there are none so stores skip the check */
+    ReactiveGraph* reactives() {
+        return graph.empty() ? nullptr : &graph;
+    }
+
+    /* The tree evaluator's side of what OP_STORE and OP_LOAD_REACTIVE do */
+    void changed(uint32_t slot) {
+        graph.changed(slot);
+    }
+
+    void refresh(uint32_t slot) {
+        graph.refresh(slot, values.data());
+    }
+
+    Value& value(uint32_t slot) {
+        return values[slot];
+    }
+
+    Value value(uint32_t slot) const {
+        return values[slot];
+    }
+
+    /* Base of the slot array handed to the VM. Only declaring new names can move it. */
+    Value* data() {
+        return values.data();
+    }
+
+    const std::string& name_of(uint32_t slot) const {
+        return names[slot];
+    }
+
+    size_t size() const {
+        return values.size();
+    }
+
+    /* Host-side access by name, declaring the variable if it doesn't exist yet. Counts as a store. */
+    Value& operator[](std::string_view name) {
+        uint32_t slot = intern(name);
+        if (!declared[slot]) {
+            declared[slot] = true;
+            declarations.push_back(slot);
+        }
+        graph.changed(slot); // Nothing gets recomputed before the next read, by then the caller has written it
+        return values[slot];
+    }
+
+    /* Host-side read by name, nullptr if the variable isn't declared. A reactive one is as of its last read. */
+    const Value* find(std::string_view name) const {
+        uint32_t slot = lookup(name);
+        return slot == npos || !declared[slot] ? nullptr : &values[slot];
+    }
+
+    /* Snapshot of every declared variable, ordered by name */
+    std::map<std::string, Value> to_map() const {
+        std::map<std::string, Value> result;
+        for (size_t slot = 0; slot < values.size(); slot++) {
+            if (declared[slot]) {
+                result.emplace(names[slot], values[slot]);
+            }
+        }
+        return result;
+    }
+
+private:
+    std::unordered_map<std::string_view, uint32_t> slots;
+    std::deque<std::string> names;
+    std::vector<Value> values;
+    std::vector<bool> declared;
+    std::vector<uint32_t> declarations;
+    std::unordered_map<std::string_view, Function*> function_names; // Keys point into the functions' own names
+    std::vector<std::shared_ptr<Function>> functions;
+    ReactiveGraph graph;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <cstdint>
+
+#include "Chunk.h"
+#include "Arena.h"
+
+class Node;
+
+/*
+    A function from `fn name(a, b) = expression` or `fn name(a, b) { statements }`, the value of a block
+    body is its last statement's like everywhere else. Parameters and `let`s in the body live in a frame
+    of their own, everything else the body names is a global.
+
+    Functions belong to the Environment they were defined in, but the chunks calling one keep it alive
+    too, so a --stream batch can still run after the parser that defined it is gone. Compiled bodies are
+    chunks of their own that the VM switches to on OP_CALL.
+*/
+struct Function : std::enable_shared_from_this<Function> {
+    // Deep enough for any sane recursion, and shallow enough that the tree evaluator, which recurses
+    // on the C++ stack, doesn't run out of it first
+    static constexpr size_t max_call_depth = 10000;
+
+    Function(std::string_view name, uint32_t arity) : name(name), arity(arity) {}
+
+    Function(const Function&) = delete;
+    Function& operator=(const Function&) = delete;
+
+    std::string name;
+    uint32_t arity;
+    uint32_t locals = 0;    // Frame slots: the arguments first, then the body's own `let`s
+    bool recursive = false; // Calls itself, which the parser notices
+    bool pure = false;      // No prints or global stores, directly or through its calls. Set by the optimizer.
+    bool inlinable = false; // Pure, not recursive and a small expression, so calls get the body pasted in. Set by the optimizer.
+    Node* body = nullptr;   // In `nodes`, nullptr for a function loaded from a .slc file
+    Chunk chunk;            // The compiled body ending in OP_RETURN, empty until the definition is compiled
+    Arena nodes{ 1024 };    // The body outlives the REPL line or --stream batch it was parsed with
+};
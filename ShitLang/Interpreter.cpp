@@ -0,0 +1,199 @@
+#include "Interpreter.h"
+
+#include <iostream>
+#include <algorithm>
+
+#include "Tokenizer.h"
+#include "Parser.h"
+#include "Optimizer.h"
+#include "Jit.h"
+#include "CompiledFile.h"
+#include "MappedFile.h"
+
+#define disp(msg) // std::cout << msg << std::endl;
+
+Node* prepare(Node* root, const InterpreterOptions& options, Arena& arena) {
+    if (root != nullptr && options.optimize) {
+        PhaseTimer timer(options.profiler, Profiler::OPTIMIZE);
+        Optimizer optimizer(arena);
+        root = optimizer.optimize(root);
+        timer.stop(optimizer.get_rewrites());
+    }
+    return root;
+}
+
+// Parsing and everything after it, shared by the REPL and file mode. `chunk` is left holding the compiled program.
+// `parsed` is set once the parser is done, so a caller can tell a syntax error from one that happened later.
+static void parse_and_run(std::string_view source, Parser& parser, Chunk& chunk, Environment& variables, Arena& arena, const InterpreterOptions& options,
+    bool* parsed = nullptr) {
+    Profiler* profiler = options.profiler;
+    if (profiler) {
+        parser.track_lines(source, profiler->add_source(source));
+    }
+
+    PhaseTimer parse_timer(profiler, Profiler::PARSE);
+    Node* root = parser.parse();
+    parse_timer.stop(arena.object_count());
+    if (parsed) {
+        *parsed = true;
+    }
+
+    root = prepare(root, options, arena);
+    if (root == nullptr) {
+        return;
+    }
+
+    PhaseTimer compile_timer(profiler, Profiler::COMPILE);
+    if (options.jit || options.jit_verify) {
+        root = Jit(arena, variables, options.jit_verify).compile(root);
+    }
+    chunk = compile_program(root);
+    compile_timer.stop(chunk.code.size());
+
+    PhaseTimer execute_timer(profiler, Profiler::EXECUTE);
+    uint64_t statements = profiler ? profiler->statements_executed() : 0;
+    VM vm;
+    vm.set_profiler(profiler);
+    vm.run(chunk, variables.data(), variables.reactives());
+    if (profiler) {
+        profiler->leave_line();
+        execute_timer.stop(profiler->statements_executed() - statements);
+    }
+}
+
+static void report_error(const std::exception& e, const InterpreterOptions& options) {
+    OutputSink::current().flush(); // Keep anything printed before the error in front of it
+    (options.errors ? *options.errors : std::cerr) << "Error: " << e.what() << std::endl;
+}
+
+// A line compiled before, only its declarations have to be redone before running it again
+static void run_cached(const StatementCache::Entry& entry, Environment& variables) {
+    Environment::Mark declared = variables.checkpoint();
+    try {
+        for (uint32_t slot : entry.declares) {
+            variables.declare(variables.name_of(slot));
+        }
+    }
+    catch (...) {
+        variables.rollback(declared);
+        throw;
+    }
+    MemoryStats::PhaseScope execute(MemoryStats::EXECUTE);
+    VM vm;
+    vm.run(entry.chunk, variables.data(), variables.reactives());
+}
+
+void interpret(const std::string& input, Environment& variables, Arena& arena, const InterpreterOptions& options) {
+    // Line numbers in the profile would be wrong for cached chunks, and --jit-verify chunks point into the
+    // tree they were built from, so both of those always compile
+    StatementCache* cache = options.profiler || options.jit_verify ? nullptr : options.cache;
+    std::string key;
+    if (cache) {
+        MemoryStats::CategoryScope memory(MemoryStats::CACHE);
+        key = StatementCache::normalize(input);
+        if (const StatementCache::Entry* entry = cache->find(key)) {
+            try {
+                run_cached(*entry, variables);
+            }
+            catch (const std::exception& e) {
+                report_error(e, options);
+            }
+            return;
+        }
+    }
+
+    PhaseTimer tokenize_timer(options.profiler, Profiler::TOKENIZE);
+    Tokenizer toker(input, &variables);
+    std::vector<Token> tokens = toker.tokenize();
+    tokenize_timer.stop(tokens.size());
+
+    if (tokens.empty()) {
+        // std::cout << "No expression to evaluate or syntax error." << std::endl;
+        return;
+    }
+
+    Environment::Mark declared = variables.checkpoint();
+    try {
+        Parser parser(tokens, &variables, arena);
+        Chunk chunk;
+        parse_and_run(input, parser, chunk, variables, arena, options);
+        // Only `let`s get replayed on a hit, so a line defining a function or a `let :=` has to go through the parser every time
+        if (cache && !chunk.code.empty() && !variables.defined_since(declared)) {
+            MemoryStats::CategoryScope memory(MemoryStats::CACHE);
+            cache->insert(std::move(key), StatementCache::Entry{ std::move(chunk), variables.declared_since(declared) });
+        }
+    }
+    catch (const std::exception& e) {
+        variables.rollback(declared); // A line that failed doesn't get to keep its `let`s
+        report_error(e, options);
+    }
+
+    arena.reset(); // Frees the whole tree at once, the blocks get reused by the next line
+}
+
+// Tokenizes, parses and compiles the whole script as one program, then runs it. `chunk` is left holding the program.
+static int compile_and_run(std::string_view source, Chunk& chunk, Environment& variables, Arena& arena, const InterpreterOptions& options) {
+    PhaseTimer tokenize_timer(options.profiler, Profiler::TOKENIZE);
+    Tokenizer toker(source, &variables);
+    std::vector<Token> tokens = toker.tokenize();
+    tokenize_timer.stop(tokens.size());
+
+    Parser parser(tokens, &variables, arena);
+    bool parsed = false;
+    try {
+        parse_and_run(source, parser, chunk, variables, arena, options, &parsed);
+    }
+    catch (const std::exception& e) {
+        if (parsed) {
+            report_error(e, options); // The statement the parser stopped at is the last one, not the one that failed
+            return 1;
+        }
+        OutputSink::current().flush();
+        size_t offset = tokens[parser.get_statement_position()].get_offset(source);
+        size_t line = 1 + std::count(source.begin(), source.begin() + offset, '\n');
+        (options.errors ? *options.errors : std::cerr) << "Error on line " << line << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    arena.reset();
+    return 0;
+}
+
+int run_program(std::string_view source, Environment& variables, Arena& arena, const InterpreterOptions& options) {
+    Chunk chunk;
+    return compile_and_run(source, chunk, variables, arena, options);
+}
+
+int run_file(const std::string& path, Environment& variables, Arena& arena, const InterpreterOptions& options) {
+    MappedFile file(path);
+
+    // Compiled files hold plain bytecode for a program starting from nothing: no native code, no line markers,
+    // no variables from before it
+    bool cached = (options.bytecode_cache || !options.bytecode_cache_dir.empty()) && variables.size() == 0
+        && !options.profiler && !options.jit && !options.jit_verify;
+    if (!cached) {
+        return run_program(file.text(), variables, arena, options);
+    }
+
+    std::string compiled_path = CompiledFile::path_for(path, options.bytecode_cache_dir);
+    if (std::unique_ptr<CompiledFile> compiled = CompiledFile::open(compiled_path, file.text(), options.optimize)) {
+        compiled->declare(variables);
+        MemoryStats::PhaseScope execute(MemoryStats::EXECUTE);
+        VM vm;
+        try {
+            vm.run(compiled->view(), variables.data(), variables.reactives());
+        }
+        catch (const std::exception& e) {
+            report_error(e, options); // Same as a runtime error on a cold run
+            return 1;
+        }
+        return 0;
+    }
+
+    Chunk chunk;
+    int status = compile_and_run(file.text(), chunk, variables, arena, options);
+    if (status == 0) {
+        CompiledFile::save(compiled_path, file.text(), options.optimize, chunk, variables);
+    }
+    return status;
+}
@@ -1 +1,358 @@
 #pragma once
+
+#include <vector>
+#include <cmath>
+#include <string>
+#include <string_view>
+#include <ostream>
+#include <cstring>
+#include <charconv>
+#include <stdexcept>
+#include <algorithm>
+
+#include "Chunk.h"
+#include "Node.h"
+#include "Environment.h"
+#include "OutputSink.h"
+#include "Arena.h"
+#include "Profiler.h"
+#include "StatementCache.h"
+#include "MemoryStats.h"
+
+// GCC and Clang support "labels as values", which lets every handler jump straight to the next one
+// instead of going back through a single switch. MSVC doesn't, so it gets the switch loop.
+#if defined(__GNUC__) || defined(__clang__)
+#define SHITLANG_THREADED_DISPATCH 1
+#else
+#define SHITLANG_THREADED_DISPATCH 0
+#endif
+
+class VM {
+public:
+    // `slots` is the variable array the chunk's OP_LOAD/OP_STORE operands index into, `reactives` the graph
+    // that goes with it when it has any reactive variables
+    Value run(const Chunk& chunk, Value* slots, ReactiveGraph* reactives = nullptr) {
+        return run(chunk.view(), slots, reactives);
+    }
+
+    Value run(const ChunkView& chunk, Value* slots, ReactiveGraph* reactives = nullptr) {
+        if (chunk.code_size == 0) {
+            return Value();
+        }
+
+        // Nothing above sp ever holds a vector: pops clear them, so pushes construct over plain numbers without
+        // checking what was there. Starting from a fresh stack covers a run that threw halfway through.
+        stack.clear();
+        stack.resize(chunk.max_stack + 1);
+        frames.clear();
+        Value* base = stack.data();
+        Value* sp = base; // points one past the top value
+        Value* locals = base; // the running function's frame, its arguments and then its `let`s
+        const uint8_t* code = chunk.code;
+        const uint8_t* ip = code;
+        const Value* constants = chunk.constants;
+        const NativeCall* natives = chunk.natives;
+        const Function* const* calls = chunk.calls;
+        OutputSink& output = OutputSink::current();
+
+#if SHITLANG_THREADED_DISPATCH
+#define SHITLANG_LABEL_ADDRESS(name) &&do_##name,
+        static void* const dispatch_table[] = { SHITLANG_OPCODES(SHITLANG_LABEL_ADDRESS) };
+#undef SHITLANG_LABEL_ADDRESS
+#define VM_CASE(name) do_##name
+#define VM_DISPATCH() goto *dispatch_table[*ip++]
+        VM_DISPATCH();
+#else
+#define VM_CASE(name) case name
+#define VM_DISPATCH() continue
+        for (;;) {
+            switch (*ip++) {
+#endif
+
+// Same split as arith::, spelled out so the number path has no vector call its result could escape into.
+// Operands by reference, so a vector only the stack holds can take the result in place.
+#define VM_BINARY(name) { const Value& b = sp[-1]; const Value& a = sp[-2]; \
+    if (Value::either_vector(a, b)) { sp[-2] = vectors::name(a, b); sp[-1] = Value(); } else { sp[-2] = arith::numbers::name(a, b); } --sp; } VM_DISPATCH()
+#define VM_BINARY_DOUBLE(op) { double b = (--sp)->to_double(); double a = sp[-1].to_double(); sp[-1] = a op b; } VM_DISPATCH()
+
+        VM_CASE(OP_CONSTANT):
+            new (sp++) Value(constants[Chunk::read_operand(ip)]);
+            ip += sizeof(uint32_t);
+            VM_DISPATCH();
+        VM_CASE(OP_LOAD):
+            new (sp++) Value(slots[Chunk::read_operand(ip)]);
+            ip += sizeof(uint32_t);
+            VM_DISPATCH();
+        VM_CASE(OP_STORE): {
+            uint32_t slot = Chunk::read_operand(ip);
+            ip += sizeof(uint32_t);
+            slots[slot] = sp[-1];
+            // Checked here rather than compiled in, code from before a `let :=` can still store to its inputs
+            if (reactives) {
+                reactives->changed(slot);
+            }
+            VM_DISPATCH();
+        }
+        VM_CASE(OP_LOAD_LOCAL):
+            new (sp++) Value(locals[Chunk::read_operand(ip)]);
+            ip += sizeof(uint32_t);
+            VM_DISPATCH();
+        VM_CASE(OP_STORE_LOCAL):
+            locals[Chunk::read_operand(ip)] = sp[-1];
+            ip += sizeof(uint32_t);
+            VM_DISPATCH();
+        VM_CASE(OP_LOAD_REACTIVE): {
+            uint32_t slot = Chunk::read_operand(ip);
+            ip += sizeof(uint32_t);
+            reactives->refresh(slot, slots);
+            new (sp++) Value(slots[slot]);
+            VM_DISPATCH();
+        }
+        VM_CASE(OP_NEGATE):
+            sp[-1] = arith::negate(sp[-1]);
+            VM_DISPATCH();
+        VM_CASE(OP_ADD):        VM_BINARY(add);
+        VM_CASE(OP_SUBTRACT):   VM_BINARY(subtract);
+        VM_CASE(OP_MULTIPLY):   VM_BINARY(multiply);
+        VM_CASE(OP_DIVIDE):     VM_BINARY(divide);
+        VM_CASE(OP_ADD_DOUBLE):      VM_BINARY_DOUBLE(+);
+        VM_CASE(OP_SUBTRACT_DOUBLE): VM_BINARY_DOUBLE(-);
+        VM_CASE(OP_MULTIPLY_DOUBLE): VM_BINARY_DOUBLE(*);
+        VM_CASE(OP_DIVIDE_DOUBLE):   VM_BINARY_DOUBLE(/);
+        VM_CASE(OP_POWER):      VM_BINARY(power);
+        VM_CASE(OP_POWI):
+            sp[-1] = arith::power(sp[-1], static_cast<int32_t>(Chunk::read_operand(ip)));
+            ip += sizeof(uint32_t);
+            VM_DISPATCH();
+        VM_CASE(OP_LESS):       VM_BINARY(less);
+        VM_CASE(OP_GREATER):    VM_BINARY(greater);
+        VM_CASE(OP_LESS_EQ):    VM_BINARY(less_equal);
+        VM_CASE(OP_GREATER_EQ): VM_BINARY(greater_equal);
+        VM_CASE(OP_EQUAL):      VM_BINARY(equal);
+        VM_CASE(OP_AND):        VM_BINARY(logical_and);
+        VM_CASE(OP_OR):         VM_BINARY(logical_or);
+        VM_CASE(OP_VECTOR): {
+            uint32_t count = Chunk::read_operand(ip);
+            ip += sizeof(uint32_t);
+            sp -= count;
+            *sp = vectors::make(sp, count);
+            sp++;
+            VM_DISPATCH();
+        }
+        VM_CASE(OP_SUM):
+            sp[-1] = vectors::sum(sp[-1]);
+            VM_DISPATCH();
+        VM_CASE(OP_MIN):
+            sp[-1] = vectors::min(sp[-1]);
+            VM_DISPATCH();
+        VM_CASE(OP_MAX):
+            sp[-1] = vectors::max(sp[-1]);
+            VM_DISPATCH();
+        VM_CASE(OP_PRINT):
+            output.write_value(sp[-1]);
+            VM_DISPATCH();
+        VM_CASE(OP_POP):
+            if ((--sp)->is_vector()) {
+                *sp = Value();
+            }
+            VM_DISPATCH();
+        VM_CASE(OP_JUMP):
+            ip = code + Chunk::read_operand(ip);
+            VM_DISPATCH();
+        VM_CASE(OP_LINE):
+            if (profiler) {
+                profiler->enter_line(Chunk::read_operand(ip));
+            }
+            ip += sizeof(uint32_t);
+            VM_DISPATCH();
+        VM_CASE(OP_CALL_NATIVE): {
+            const NativeCall& call = natives[Chunk::read_operand(ip)];
+            ip += sizeof(uint32_t);
+            double result;
+            if (call.function(slots, &result)) {
+                new (sp++) Value(native_value(call, result));
+            }
+            else {
+                ip += 1 + sizeof(uint32_t); // Past the OP_JUMP, into the bytecode for the same expression
+            }
+            VM_DISPATCH();
+        }
+        VM_CASE(OP_CALL_NATIVE_CHECKED): {
+            const NativeCall& call = natives[Chunk::read_operand(ip)];
+            ip += sizeof(uint32_t);
+            double result;
+            if (call.function(slots, &result)) {
+                new (sp++) Value(verify_native(call, native_value(call, result)));
+            }
+            else {
+                ip += 1 + sizeof(uint32_t);
+            }
+            VM_DISPATCH();
+        }
+        VM_CASE(OP_JUMP_IF_FALSE):
+            if (!(--sp)->is_true()) {
+                ip = code + Chunk::read_operand(ip);
+            }
+            else {
+                ip += sizeof(uint32_t);
+            }
+            VM_DISPATCH();
+        VM_CASE(OP_CALL): {
+            const Function* function = calls[Chunk::read_operand(ip)];
+            ip += sizeof(uint32_t);
+            if (frames.size() >= Function::max_call_depth) {
+                throw std::runtime_error("Call stack overflow in " + function->name);
+            }
+            frames.push_back(Frame{ code, ip, constants, natives, calls, static_cast<size_t>(locals - base) });
+
+            // Recursion can go deeper than any one chunk's max_stack, so the stack grows here when it has to
+            size_t frame = static_cast<size_t>(sp - base) - function->arity;
+            size_t needed = frame + function->locals + function->chunk.max_stack() + 1;
+            if (needed > stack.size()) {
+                size_t top = static_cast<size_t>(sp - base);
+                stack.resize(std::max(needed, stack.size() * 2));
+                base = stack.data();
+                sp = base + top;
+            }
+            locals = base + frame;
+            for (uint32_t i = function->arity; i < function->locals; i++) {
+                new (sp++) Value();
+            }
+
+            const Chunk& callee = function->chunk;
+            code = callee.code.data();
+            ip = code;
+            constants = callee.constants.data();
+            natives = callee.natives.data();
+            calls = callee.calls.data();
+            VM_DISPATCH();
+        }
+        VM_CASE(OP_RETURN): {
+            if (frames.empty()) {
+                return sp == base ? Value() : sp[-1];
+            }
+
+            // The result takes the first slot of the frame and everything above it goes, vectors released
+            if (sp - 1 != locals) {
+                *locals = std::move(sp[-1]);
+            }
+            while (sp > locals + 1) {
+                if ((--sp)->is_vector()) {
+                    *sp = Value();
+                }
+            }
+
+            const Frame& caller = frames.back();
+            code = caller.code;
+            ip = caller.ip;
+            constants = caller.constants;
+            natives = caller.natives;
+            calls = caller.calls;
+            locals = base + caller.locals;
+            frames.pop_back();
+            VM_DISPATCH();
+        }
+
+#if !SHITLANG_THREADED_DISPATCH
+            default:
+                throw std::invalid_argument("Unknown opcode");
+            }
+        }
+#endif
+
+#undef VM_BINARY
+#undef VM_BINARY_DOUBLE
+#undef VM_DISPATCH
+#undef VM_CASE
+    }
+
+    /* Native code always works in doubles, the relational expressions it runs really give the ints 1 and 0 */
+    static Value native_value(const NativeCall& call, double result) {
+        return call.type == ValueType::INT ? Value(static_cast<int64_t>(result)) : Value(result);
+    }
+
+    /* --jit-verify: the tree evaluator has to agree with the native code to the last bit */
+    static Value verify_native(const NativeCall& call, Value native) {
+        Value tree = call.expression->evaluate();
+        if (!native.identical(tree)) {
+            throw std::runtime_error("JIT mismatch: native code gave " + describe(native) + ", the interpreter gave " + describe(tree));
+        }
+        native_checks()++;
+        return native;
+    }
+
+    /* How many native results --jit-verify has checked so far, on this thread */
+    static uint64_t& native_checks() {
+        thread_local uint64_t checks = 0;
+        return checks;
+    }
+
+    /* Receives OP_LINE markers, only set for --profile */
+    void set_profiler(Profiler* new_profiler) {
+        profiler = new_profiler;
+    }
+
+private:
+    static std::string describe(Value value) {
+        char text[32];
+        std::to_chars_result result = value.is_int()
+            ? std::to_chars(text, text + sizeof(text), value.integer)
+            : std::to_chars(text, text + sizeof(text), value.number);
+        return std::string(text, result.ptr) + (value.is_int() ? " (int)" : " (double)");
+    }
+
+    // Where an OP_CALL came from, so OP_RETURN can go back there
+    struct Frame {
+        const uint8_t* code;
+        const uint8_t* ip;
+        const Value* constants;
+        const NativeCall* natives;
+        const Function* const* calls;
+        size_t locals; // Offset into the stack, which can move when a call grows it
+    };
+
+    std::vector<Value> stack;
+    std::vector<Frame> frames;
+    Profiler* profiler = nullptr;
+};
+
+/* Lowers a parsed tree to a finished chunk */
+inline Chunk compile_program(const Node* root) {
+    MemoryStats::CategoryScope memory(MemoryStats::BYTECODE);
+    Chunk chunk;
+    root->compile(chunk);
+    chunk.emit(OP_RETURN);
+    return chunk;
+}
+
+/* Lowers a parsed tree to bytecode and runs it */
+inline Value execute(const Node* root, Environment& variables) {
+    Chunk chunk = compile_program(root);
+    VM vm;
+    return vm.run(chunk, variables.data(), variables.reactives());
+}
+
+struct InterpreterOptions {
+    bool optimize = true; // --no-optimize runs the tree exactly as parsed, handy for checking the optimizer
+    bool line_buffered = false;
+    size_t output_buffer = OutputSink::default_capacity;
+    Profiler* profiler = nullptr; // Set by --profile, collects phase timings and per-line counts
+    std::ostream* errors = nullptr; // Where error messages go, std::cerr when unset
+    StatementCache* cache = nullptr; // interpret() reuses compiled lines from here, skipped while profiling
+    bool jit = false;        // Compile expressions to native code where the platform allows
+    bool jit_verify = false; // --jit-verify, check every native result against the tree evaluator
+    bool bytecode_cache = false;    // run_file() keeps compiled scripts in .slc files and reuses them while the source is unchanged
+    std::string bytecode_cache_dir; // Where those go, next to the script when empty
+};
+
+/* Runs the optimizer over a freshly parsed tree if the options ask for it */
+Node* prepare(Node* root, const InterpreterOptions& options, Arena& arena);
+
+/* Runs one REPL entry, reporting errors on stderr and rolling back the entry's declarations */
+void interpret(const std::string& input, Environment& variables, Arena& arena, const InterpreterOptions& options);
+
+/* Tokenizes, parses and compiles a whole script as one program, then runs it. Returns the exit code. */
+int run_program(std::string_view source, Environment& variables, Arena& arena, const InterpreterOptions& options);
+
+/* run_program() on a script file, going through the .slc bytecode cache when the options turn it on */
+int run_file(const std::string& path, Environment& variables, Arena& arena, const InterpreterOptions& options);
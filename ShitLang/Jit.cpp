@@ -0,0 +1,481 @@
+#include "Jit.h"
+
+#include <cstring>
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Mapped writable, filled in, then flipped to read + execute, so the pages are never writable and executable at once
+JitModule::JitModule(const std::vector<uint8_t>& bytes) : size(bytes.size()) {
+#ifdef _WIN32
+    memory = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (memory == nullptr) {
+        throw std::runtime_error("Failed to allocate executable memory");
+    }
+    std::memcpy(memory, bytes.data(), size);
+    DWORD old_protection;
+    if (!VirtualProtect(memory, size, PAGE_EXECUTE_READ, &old_protection)) {
+        VirtualFree(memory, 0, MEM_RELEASE);
+        throw std::runtime_error("Failed to make JIT code executable");
+    }
+    FlushInstructionCache(GetCurrentProcess(), memory, size);
+#else
+    void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("Failed to allocate executable memory");
+    }
+    std::memcpy(mapped, bytes.data(), size);
+    if (mprotect(mapped, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mapped, size);
+        throw std::runtime_error("Failed to make JIT code executable");
+    }
+    memory = mapped;
+#endif
+}
+
+JitModule::~JitModule() {
+#ifdef _WIN32
+    VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    munmap(memory, size);
+#endif
+}
+
+namespace {
+
+// The slot array comes in as the first argument and where to put the result as the second, eax says if it worked.
+// Values being computed live in xmm0, xmm1, ... like a stack, with one register kept free for constants.
+#ifdef _WIN32
+constexpr uint8_t slots_register = 1;   // rcx
+constexpr uint8_t result_register = 2;  // rdx
+constexpr uint8_t stack_registers = 5;  // xmm0-4, xmm6 and up are callee saved on Win64
+#else
+constexpr uint8_t slots_register = 7;   // rdi
+constexpr uint8_t result_register = 6;  // rsi
+constexpr uint8_t stack_registers = 15; // xmm0-14, every xmm register is caller saved on SysV
+#endif
+constexpr uint8_t scratch = stack_registers;
+
+static_assert(sizeof(Value) == 16 && offsetof(Value, number) == 0, "the JIT reads slots as 16 byte values with the double first");
+
+// Past this an int literal isn't the same number as a double, so the JIT leaves it alone
+constexpr int64_t max_exact_integer = int64_t(1) << 53;
+
+// Opcodes after the 0F escape
+enum : uint8_t {
+    MOVSD_LOAD = 0x10,
+    MOVSD_STORE = 0x11,
+    MOVAPD = 0x28,
+    ANDPD = 0x54,
+    ORPD = 0x56,
+    XORPD = 0x57,
+    ADDSD = 0x58,
+    MULSD = 0x59,
+    SUBSD = 0x5C,
+    DIVSD = 0x5E,
+    CMPSD = 0xC2,
+};
+
+// cmpsd predicates
+enum : uint8_t {
+    CMP_EQ = 0,
+    CMP_LT = 1,
+    CMP_LE = 2,
+    CMP_NEQ = 4, // true for NaN, the same as `x != 0` in C++
+};
+
+/* Just enough of an x86-64 encoder for scalar SSE2 math, one function at a time */
+class Assembler {
+public:
+    std::vector<uint8_t> code;
+
+    // reg, reg forms; `prefix` is F2 for the scalar double ops and 66 for the packed bitwise ones
+    void op(uint8_t prefix, uint8_t opcode, uint8_t destination, uint8_t source) {
+        code.push_back(prefix);
+        rex(destination, source);
+        code.push_back(0x0F);
+        code.push_back(opcode);
+        code.push_back(static_cast<uint8_t>(0xC0 | ((destination & 7) << 3) | (source & 7)));
+    }
+
+    void scalar(uint8_t opcode, uint8_t destination, uint8_t source) {
+        op(0xF2, opcode, destination, source);
+    }
+
+    void packed(uint8_t opcode, uint8_t destination, uint8_t source) {
+        op(0x66, opcode, destination, source);
+    }
+
+    void compare(uint8_t predicate, uint8_t destination, uint8_t source) {
+        scalar(CMPSD, destination, source);
+        code.push_back(predicate);
+    }
+
+    // movsd xmm, [slots + slot * 16], after checking the slot holds a double the first time it's read
+    void load_slot(uint8_t xmm, uint32_t slot) {
+        if (std::find(guarded.begin(), guarded.end(), slot) == guarded.end()) {
+            guarded.push_back(slot);
+            // cmp byte [slots + slot * 16 + 8], DOUBLE
+            code.push_back(0x80);
+            code.push_back(static_cast<uint8_t>(0x80 | (7 << 3) | slots_register));
+            put32(static_cast<uint32_t>(slot * sizeof(Value) + offsetof(Value, type)));
+            code.push_back(static_cast<uint8_t>(ValueType::DOUBLE));
+            // jne bail
+            code.push_back(0x0F);
+            code.push_back(0x85);
+            bails.push_back(code.size());
+            put32(0);
+        }
+        code.push_back(0xF2);
+        rex(xmm, slots_register);
+        code.push_back(0x0F);
+        code.push_back(MOVSD_LOAD);
+        code.push_back(static_cast<uint8_t>(0x80 | ((xmm & 7) << 3) | slots_register));
+        put32(static_cast<uint32_t>(slot * sizeof(Value) + offsetof(Value, number)));
+    }
+
+    // movsd xmm, [rip + constant], the constants go right after the function's code
+    void load_constant(uint8_t xmm, double value) {
+        code.push_back(0xF2);
+        rex(xmm, 0);
+        code.push_back(0x0F);
+        code.push_back(MOVSD_LOAD);
+        code.push_back(static_cast<uint8_t>(0x05 | ((xmm & 7) << 3)));
+        fixups.push_back({ code.size(), constant_index(value) });
+        put32(0);
+    }
+
+    /* Stores the result and returns true, then the bail out that returns false, then the constant pool */
+    void finish() {
+        // movsd [result], xmm0
+        code.push_back(0xF2);
+        code.push_back(0x0F);
+        code.push_back(MOVSD_STORE);
+        code.push_back(result_register);
+        // mov eax, 1; ret
+        code.push_back(0xB8);
+        put32(1);
+        code.push_back(0xC3);
+
+        size_t bail = code.size();
+        for (size_t position : bails) {
+            int32_t displacement = static_cast<int32_t>(bail - (position + 4));
+            std::memcpy(&code[position], &displacement, sizeof(displacement));
+        }
+        // xor eax, eax; ret
+        code.push_back(0x31);
+        code.push_back(0xC0);
+        code.push_back(0xC3);
+        while (code.size() % sizeof(double) != 0) {
+            code.push_back(0xCC);
+        }
+        size_t pool = code.size();
+        for (double value : constants) {
+            uint8_t bytes[sizeof(double)];
+            std::memcpy(bytes, &value, sizeof(value));
+            code.insert(code.end(), bytes, bytes + sizeof(bytes));
+        }
+        for (const Fixup& fixup : fixups) {
+            // rip points at the next instruction, which starts right after the displacement
+            int32_t displacement = static_cast<int32_t>(pool + fixup.constant * sizeof(double) - (fixup.position + 4));
+            std::memcpy(&code[fixup.position], &displacement, sizeof(displacement));
+        }
+    }
+
+private:
+    struct Fixup {
+        size_t position;
+        size_t constant;
+    };
+
+    void rex(uint8_t reg, uint8_t rm) {
+        uint8_t prefix = static_cast<uint8_t>(0x40 | ((reg >> 3) & 1) << 2 | ((rm >> 3) & 1));
+        if (prefix != 0x40) {
+            code.push_back(prefix);
+        }
+    }
+
+    void put32(uint32_t value) {
+        uint8_t bytes[sizeof(value)];
+        std::memcpy(bytes, &value, sizeof(value));
+        code.insert(code.end(), bytes, bytes + sizeof(bytes));
+    }
+
+    size_t constant_index(double value) {
+        for (size_t i = 0; i < constants.size(); i++) {
+            if (std::memcmp(&constants[i], &value, sizeof(value)) == 0) {
+                return i;
+            }
+        }
+        constants.push_back(value);
+        return constants.size() - 1;
+    }
+
+    std::vector<double> constants;
+    std::vector<Fixup> fixups;
+    std::vector<uint32_t> guarded; // Slots already checked to hold doubles
+    std::vector<size_t> bails;     // jne displacements to point at the bail out
+};
+
+// Expressions worth a native call, a lone number or variable is cheaper to just push
+bool is_operation(const Node* node) {
+    return dynamic_cast<const BinaryOperationNode*>(node) || dynamic_cast<const RelationalOperationNode*>(node)
+        || dynamic_cast<const UnaryOperationNode*>(node) || dynamic_cast<const IntegerPowerNode*>(node);
+}
+
+// Leaves the value of `node` in xmm`target` and what type the VM would have given it in `type`.
+// False when the node, or how deep it nests, is more than the JIT handles, or when the VM would use ints for it.
+bool emit(Assembler& out, const Node* node, uint8_t target, ValueType& type) {
+    if (target >= stack_registers) {
+        return false;
+    }
+    if (auto* number = dynamic_cast<const NumberNode*>(node)) {
+        Value value = number->get_value();
+        if (value.is_int() && (value.integer > max_exact_integer || value.integer < -max_exact_integer)) {
+            return false;
+        }
+        out.load_constant(target, value.to_double());
+        type = value.type;
+        return true;
+    }
+    if (auto* variable = dynamic_cast<const VariableNode*>(node)) {
+        out.load_slot(target, variable->get_slot());
+        type = ValueType::DOUBLE;
+        return true;
+    }
+    if (auto* unary = dynamic_cast<const UnaryOperationNode*>(node)) {
+        if (unary->get_operation() != '-' || !emit(out, unary->get_operand(), target, type) || type != ValueType::DOUBLE) {
+            return false;
+        }
+        out.load_constant(scratch, -0.0); // Flipping the sign bit, same as the VM's negate
+        out.packed(XORPD, target, scratch);
+        return true;
+    }
+    if (auto* power = dynamic_cast<const IntegerPowerNode*>(node)) {
+        // The same operation integer_power() does, anything else it hands to std::pow so the interpreter keeps it
+        int32_t exponent = power->get_exponent();
+        if (exponent < -1 || exponent > 2 || !emit(out, power->get_base(), target, type) || type != ValueType::DOUBLE) {
+            return false;
+        }
+        switch (exponent) {
+        case 0:
+            out.load_constant(target, 1.0);
+            break;
+        case 2:
+            out.scalar(MULSD, target, target);
+            break;
+        case -1:
+            out.load_constant(scratch, 1.0);
+            out.scalar(DIVSD, scratch, target);
+            out.packed(MOVAPD, target, scratch);
+            break;
+        }
+        return true;
+    }
+
+    uint8_t right = target + 1;
+    if (auto* binary = dynamic_cast<const BinaryOperationNode*>(node)) {
+        uint8_t opcode;
+        switch (binary->get_operation()) {
+        case '+': opcode = ADDSD; break;
+        case '-': opcode = SUBSD; break;
+        case '*': opcode = MULSD; break;
+        case '/': opcode = DIVSD; break;
+        default: return false; // ^ is a std::pow call, the interpreter keeps it
+        }
+        ValueType left_type;
+        ValueType right_type;
+        if (!emit(out, binary->get_left(), target, left_type) || !emit(out, binary->get_right(), right, right_type)) {
+            return false;
+        }
+        type = arith::arithmetic_type(left_type, right_type);
+        if (type != ValueType::DOUBLE) {
+            return false; // int op int, the VM keeps those exact
+        }
+        out.scalar(opcode, target, right);
+        return true;
+    }
+    if (auto* relational = dynamic_cast<const RelationalOperationNode*>(node)) {
+        // Any ints in here are small literals or other comparisons' 1s and 0s, which compare the same as doubles
+        ValueType left_type;
+        ValueType right_type;
+        if (!emit(out, relational->get_left(), target, left_type) || !emit(out, relational->get_right(), right, right_type)) {
+            return false;
+        }
+        type = ValueType::INT;
+        // Each compare leaves an all ones / all zeros mask, masking 1.0 with it gives 1 or 0
+        switch (relational->get_operation()) {
+        case '<': out.compare(CMP_LT, target, right); break;
+        case ',': out.compare(CMP_LE, target, right); break;
+        case '=': out.compare(CMP_EQ, target, right); break;
+        case '>': // a > b is b < a, there's no ordered greater-than predicate
+            out.compare(CMP_LT, right, target);
+            out.packed(MOVAPD, target, right);
+            break;
+        case '.':
+            out.compare(CMP_LE, right, target);
+            out.packed(MOVAPD, target, right);
+            break;
+        case '&':
+        case '|':
+            out.packed(XORPD, scratch, scratch);
+            out.compare(CMP_NEQ, target, scratch);
+            out.compare(CMP_NEQ, right, scratch);
+            out.packed(relational->get_operation() == '&' ? ANDPD : ORPD, target, right);
+            break;
+        default:
+            return false;
+        }
+        out.load_constant(scratch, 1.0);
+        out.packed(ANDPD, target, scratch);
+        return true;
+    }
+    return false;
+}
+
+}
+
+// Finds the biggest expressions the JIT can take and assembles each one into `code`
+void Jit::scan(const Node* node) {
+    if (is_operation(node)) {
+        Assembler out;
+        ValueType type;
+        if (emit(out, node, 0, type)) {
+            out.finish();
+            while (code.size() % 16 != 0) {
+                code.push_back(0xCC);
+            }
+            compiled[node] = Compiled{ code.size(), type };
+            code.insert(code.end(), out.code.begin(), out.code.end());
+            return;
+        }
+    }
+
+    // Not compilable as a whole, maybe its parts are
+    if (auto* block = dynamic_cast<const BlockNode*>(node)) {
+        for (const Node* statement : block->get_statements()) {
+            scan(statement);
+        }
+    }
+    else if (auto* let = dynamic_cast<const LetNode*>(node)) {
+        scan(let->get_value());
+    }
+    else if (auto* branch = dynamic_cast<const IfNode*>(node)) {
+        scan(branch->get_condition());
+        scan(branch->get_then());
+        if (branch->get_else()) {
+            scan(branch->get_else());
+        }
+    }
+    else if (auto* loop = dynamic_cast<const WhileNode*>(node)) {
+        scan(loop->get_condition());
+        scan(loop->get_body());
+    }
+    else if (auto* marker = dynamic_cast<const LineNode*>(node)) {
+        scan(marker->get_statement());
+    }
+    else if (auto* print = dynamic_cast<const PrintNode*>(node)) {
+        scan(print->get_expression());
+    }
+    else if (auto* unary = dynamic_cast<const UnaryOperationNode*>(node)) {
+        scan(unary->get_operand());
+    }
+    else if (auto* power = dynamic_cast<const IntegerPowerNode*>(node)) {
+        scan(power->get_base());
+    }
+    else if (auto* binary = dynamic_cast<const BinaryOperationNode*>(node)) {
+        scan(binary->get_left());
+        scan(binary->get_right());
+    }
+    else if (auto* relational = dynamic_cast<const RelationalOperationNode*>(node)) {
+        scan(relational->get_left());
+        scan(relational->get_right());
+    }
+    else if (auto* call = dynamic_cast<const CallNode*>(node)) {
+        for (const Node* argument : call->get_arguments()) {
+            scan(argument);
+        }
+    }
+}
+
+// Same tree with every compiled expression swapped for a NativeNode
+Node* Jit::rebuild(Node* node) {
+    auto found = compiled.find(node);
+    if (found != compiled.end()) {
+        return arena.make<NativeNode>(module, found->second.offset, node, found->second.type, &variables, verify);
+    }
+
+    if (auto* block = dynamic_cast<BlockNode*>(node)) {
+        std::vector<Node*> statements;
+        statements.reserve(block->get_statements().size());
+        for (Node* statement : block->get_statements()) {
+            statements.push_back(rebuild(statement));
+        }
+        return arena.make<BlockNode>(std::move(statements));
+    }
+    if (auto* let = dynamic_cast<LetNode*>(node)) {
+        return arena.make<LetNode>(let->get_env(), let->get_slot(), rebuild(let->get_value()));
+    }
+    if (auto* branch = dynamic_cast<IfNode*>(node)) {
+        Node* else_branch = branch->get_else() ? rebuild(branch->get_else()) : nullptr;
+        return arena.make<IfNode>(rebuild(branch->get_condition()), rebuild(branch->get_then()), else_branch);
+    }
+    if (auto* loop = dynamic_cast<WhileNode*>(node)) {
+        return arena.make<WhileNode>(rebuild(loop->get_condition()), rebuild(loop->get_body()));
+    }
+    if (auto* marker = dynamic_cast<LineNode*>(node)) {
+        return arena.make<LineNode>(marker->get_line(), rebuild(marker->get_statement()));
+    }
+    if (auto* print = dynamic_cast<PrintNode*>(node)) {
+        return arena.make<PrintNode>(rebuild(print->get_expression()));
+    }
+    if (auto* unary = dynamic_cast<UnaryOperationNode*>(node)) {
+        return arena.make<UnaryOperationNode>(rebuild(unary->get_operand()), unary->get_operation());
+    }
+    if (auto* power = dynamic_cast<IntegerPowerNode*>(node)) {
+        return arena.make<IntegerPowerNode>(rebuild(power->get_base()), power->get_exponent());
+    }
+    if (auto* binary = dynamic_cast<BinaryOperationNode*>(node)) {
+        return arena.make<BinaryOperationNode>(rebuild(binary->get_left()), rebuild(binary->get_right()), binary->get_operation());
+    }
+    if (auto* relational = dynamic_cast<RelationalOperationNode*>(node)) {
+        return arena.make<RelationalOperationNode>(rebuild(relational->get_left()), rebuild(relational->get_right()), relational->get_operation());
+    }
+    if (auto* call = dynamic_cast<CallNode*>(node)) {
+        std::vector<Node*> arguments;
+        arguments.reserve(call->get_arguments().size());
+        for (Node* argument : call->get_arguments()) {
+            arguments.push_back(rebuild(argument));
+        }
+        return arena.make<CallNode>(call->get_function(), std::move(arguments));
+    }
+    return node;
+}
+
+Node* Jit::compile(Node* root) {
+    if (!available() || root == nullptr) {
+        return root;
+    }
+
+    scan(root);
+    if (compiled.empty()) {
+        return root;
+    }
+
+    try {
+        module = std::make_shared<const JitModule>(code);
+    }
+    catch (const std::exception&) {
+        compiled.clear(); // No executable memory to be had, the interpreter still works
+        return root;
+    }
+    return rebuild(root);
+}
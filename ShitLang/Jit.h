@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+#include "Node.h"
+#include "Arena.h"
+#include "Environment.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SHITLANG_JIT 1
+#else
+#define SHITLANG_JIT 0
+#endif
+
+/* Executable memory holding every function one Jit pass produced, freed when the last chunk using it goes */
+class JitModule {
+public:
+    explicit JitModule(const std::vector<uint8_t>& bytes);
+    ~JitModule();
+
+    JitModule(const JitModule&) = delete;
+    JitModule& operator=(const JitModule&) = delete;
+
+    NativeFunction function(size_t offset) const {
+        return reinterpret_cast<NativeFunction>(static_cast<uint8_t*>(memory) + offset);
+    }
+
+private:
+    void* memory = nullptr;
+    size_t size = 0;
+};
+
+/*
+    An expression the JIT turned into machine code, runs that instead of walking the tree.
+    The machine code only knows doubles, so when a variable it reads holds an int it bails out and the
+    expression runs the normal way. Both versions go into the chunk: the native call, a jump over the
+    bytecode for when it worked, then the bytecode.
+*/
+class NativeNode : public Node {
+    std::shared_ptr<const JitModule> module;
+    size_t offset;
+    const Node* expression;
+    ValueType type;
+    Environment* env;
+    bool verify;
+
+public:
+    NativeNode(std::shared_ptr<const JitModule> module, size_t offset, const Node* expression, ValueType type, Environment* env, bool verify)
+        : module(std::move(module)), offset(offset), expression(expression), type(type), env(env), verify(verify) {}
+
+    const Node* get_expression() const { return expression; }
+
+    Value evaluate() const override {
+        double result;
+        if (!module->function(offset)(env->data(), &result)) {
+            return expression->evaluate();
+        }
+        return type == ValueType::INT ? Value(static_cast<int64_t>(result)) : Value(result);
+    }
+
+    void compile(Chunk& chunk) const override {
+        uint32_t index = chunk.add_native(NativeCall{ module->function(offset), module, expression, type });
+        chunk.emit(verify ? OP_CALL_NATIVE_CHECKED : OP_CALL_NATIVE, index);
+        size_t to_end = chunk.emit_jump(OP_JUMP);
+        chunk.adjust_depth(-1); // Only one of the two ever pushes its value
+        expression->compile(chunk);
+        chunk.patch_jump(to_end);
+    }
+
+    // Not `type`, that's only what the native code gives, the bytecode it falls back to may not agree
+    ValueType static_type() const override { return expression->static_type(); }
+};
+
+/*
+    Turns arithmetic and relational expressions into x86-64 SSE2 code.
+    Runs after the optimizer and replaces the biggest expressions it can handle with NativeNodes:
+    numbers, variables, + - * /, integer powers, negation, comparisons, && and ||. Anything else
+    (general ^, statements) stays with the interpreter, with its operands still compiled when possible.
+    Function bodies and reactive expressions stay bytecode too, they outlive the parse arena the native
+    nodes would be made in, but arguments at the call are fair game. A read of a reactive variable is
+    never native either, it may have to be recomputed first.
+    Every operation is the same SSE2 instruction the C++ evaluator compiles to, so results match bit for bit.
+    Variables are assumed to be doubles (and checked on the way in), so only expressions whose every
+    operation has a double in it are taken: int arithmetic like `2 * 3` or `-(a < b)` stays in the VM.
+*/
+class Jit {
+public:
+    Jit(Arena& arena, Environment& variables, bool verify = false) : arena(arena), variables(variables), verify(verify) {}
+
+    /* Whether this build can JIT at all, it falls back to the interpreter everywhere when it can't */
+    static bool available() {
+        return SHITLANG_JIT != 0;
+    }
+
+    /* Returns the rewritten tree, or `root` untouched when nothing could be compiled */
+    Node* compile(Node* root);
+
+    /* How many expressions became native code */
+    size_t get_compiled() const {
+        return compiled.size();
+    }
+
+private:
+    void scan(const Node* node);
+    Node* rebuild(Node* node);
+
+    Arena& arena;
+    Environment& variables;
+    bool verify;
+    std::vector<uint8_t> code;
+    struct Compiled {
+        size_t offset; // Of its function in `code`
+        ValueType type;
+    };
+    std::unordered_map<const Node*, Compiled> compiled;
+    std::shared_ptr<const JitModule> module;
+};
+
@@ -0,0 +1,311 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <limits>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SHITLANG_KERNELS_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SHITLANG_KERNELS_SSE2 1
+#endif
+
+/*
+    Element-wise math over arrays of doubles, 4 lanes at a time with AVX, 2 with SSE2, 1 without either.
+    Every operand is either a whole array or a single value broadcast to every element, which is how
+    columns meet constants in batch mode and vectors meet numbers in the language. The results match the VM bit for bit: relational operators give
+    1 or 0, && and || treat anything that isn't 0 as true, and ^ goes through std::pow.
+*/
+namespace kernels {
+
+#if SHITLANG_KERNELS_AVX
+struct Vec {
+    using Raw = __m256d;
+    static constexpr size_t width = 4;
+
+    static Raw load(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, Raw v) { _mm256_storeu_pd(p, v); }
+    static Raw splat(double value) { return _mm256_set1_pd(value); }
+
+    static Raw add(Raw a, Raw b) { return _mm256_add_pd(a, b); }
+    static Raw sub(Raw a, Raw b) { return _mm256_sub_pd(a, b); }
+    static Raw mul(Raw a, Raw b) { return _mm256_mul_pd(a, b); }
+    static Raw div(Raw a, Raw b) { return _mm256_div_pd(a, b); }
+    static Raw bit_and(Raw a, Raw b) { return _mm256_and_pd(a, b); }
+    static Raw bit_or(Raw a, Raw b) { return _mm256_or_pd(a, b); }
+    static Raw bit_xor(Raw a, Raw b) { return _mm256_xor_pd(a, b); }
+    static Raw less(Raw a, Raw b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    static Raw greater(Raw a, Raw b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+    static Raw less_eq(Raw a, Raw b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+    static Raw greater_eq(Raw a, Raw b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+    static Raw equal(Raw a, Raw b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+    static Raw not_equal(Raw a, Raw b) { return _mm256_cmp_pd(a, b, _CMP_NEQ_UQ); } // NaN counts as true, like C++
+    static Raw unordered(Raw a, Raw b) { return _mm256_cmp_pd(a, b, _CMP_UNORD_Q); }
+    static Raw min(Raw a, Raw b) { return _mm256_min_pd(a, b); }
+    static Raw max(Raw a, Raw b) { return _mm256_max_pd(a, b); }
+    static bool any(Raw mask) { return _mm256_movemask_pd(mask) != 0; }
+};
+#elif SHITLANG_KERNELS_SSE2
+struct Vec {
+    using Raw = __m128d;
+    static constexpr size_t width = 2;
+
+    static Raw load(const double* p) { return _mm_loadu_pd(p); }
+    static void store(double* p, Raw v) { _mm_storeu_pd(p, v); }
+    static Raw splat(double value) { return _mm_set1_pd(value); }
+
+    static Raw add(Raw a, Raw b) { return _mm_add_pd(a, b); }
+    static Raw sub(Raw a, Raw b) { return _mm_sub_pd(a, b); }
+    static Raw mul(Raw a, Raw b) { return _mm_mul_pd(a, b); }
+    static Raw div(Raw a, Raw b) { return _mm_div_pd(a, b); }
+    static Raw bit_and(Raw a, Raw b) { return _mm_and_pd(a, b); }
+    static Raw bit_or(Raw a, Raw b) { return _mm_or_pd(a, b); }
+    static Raw bit_xor(Raw a, Raw b) { return _mm_xor_pd(a, b); }
+    static Raw less(Raw a, Raw b) { return _mm_cmplt_pd(a, b); }
+    static Raw greater(Raw a, Raw b) { return _mm_cmpgt_pd(a, b); }
+    static Raw less_eq(Raw a, Raw b) { return _mm_cmple_pd(a, b); }
+    static Raw greater_eq(Raw a, Raw b) { return _mm_cmpge_pd(a, b); }
+    static Raw equal(Raw a, Raw b) { return _mm_cmpeq_pd(a, b); }
+    static Raw not_equal(Raw a, Raw b) { return _mm_cmpneq_pd(a, b); }
+    static Raw unordered(Raw a, Raw b) { return _mm_cmpunord_pd(a, b); }
+    static Raw min(Raw a, Raw b) { return _mm_min_pd(a, b); }
+    static Raw max(Raw a, Raw b) { return _mm_max_pd(a, b); }
+    static bool any(Raw mask) { return _mm_movemask_pd(mask) != 0; }
+};
+#endif
+
+enum class Op : uint8_t {
+    ADD,
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    POWER,
+    LESS,
+    GREATER,
+    LESS_EQ,
+    GREATER_EQ,
+    EQUAL,
+    AND,
+    OR,
+};
+
+/* An input to a kernel, `data[i]` per element or `data[0]` for all of them */
+struct Operand {
+    const double* data;
+    bool broadcast;
+};
+
+namespace detail {
+
+inline double scalar(Op op, double a, double b) {
+    switch (op) {
+    case Op::ADD:        return a + b;
+    case Op::SUBTRACT:   return a - b;
+    case Op::MULTIPLY:   return a * b;
+    case Op::DIVIDE:     return a / b;
+    case Op::POWER:      return std::pow(a, b);
+    case Op::LESS:       return a < b;
+    case Op::GREATER:    return a > b;
+    case Op::LESS_EQ:    return a <= b;
+    case Op::GREATER_EQ: return a >= b;
+    case Op::EQUAL:      return a == b;
+    case Op::AND:        return a && b;
+    case Op::OR:         return a || b;
+    }
+    throw std::invalid_argument("Unsupported operation");
+}
+
+#if SHITLANG_KERNELS_AVX || SHITLANG_KERNELS_SSE2
+template <Op op>
+inline Vec::Raw vector(Vec::Raw a, Vec::Raw b) {
+    // Comparisons give all ones or all zeros per lane, masking 1.0 with that turns it into 1 or 0
+    const Vec::Raw one = Vec::splat(1.0);
+    const Vec::Raw zero = Vec::splat(0.0);
+    switch (op) {
+    case Op::ADD:        return Vec::add(a, b);
+    case Op::SUBTRACT:   return Vec::sub(a, b);
+    case Op::MULTIPLY:   return Vec::mul(a, b);
+    case Op::DIVIDE:     return Vec::div(a, b);
+    case Op::LESS:       return Vec::bit_and(Vec::less(a, b), one);
+    case Op::GREATER:    return Vec::bit_and(Vec::greater(a, b), one);
+    case Op::LESS_EQ:    return Vec::bit_and(Vec::less_eq(a, b), one);
+    case Op::GREATER_EQ: return Vec::bit_and(Vec::greater_eq(a, b), one);
+    case Op::EQUAL:      return Vec::bit_and(Vec::equal(a, b), one);
+    case Op::AND:        return Vec::bit_and(Vec::bit_and(Vec::not_equal(a, zero), Vec::not_equal(b, zero)), one);
+    case Op::OR:         return Vec::bit_and(Vec::bit_or(Vec::not_equal(a, zero), Vec::not_equal(b, zero)), one);
+    default:             return a; // POWER never gets here, there is no vector pow
+    }
+}
+
+template <Op op, bool broadcast_a, bool broadcast_b>
+void run(const double* a, const double* b, double* out, size_t n) {
+    size_t i = 0;
+    Vec::Raw fixed_a = Vec::splat(a[0]);
+    Vec::Raw fixed_b = Vec::splat(b[0]);
+    for (; i + Vec::width <= n; i += Vec::width) {
+        Vec::Raw x = broadcast_a ? fixed_a : Vec::load(a + i);
+        Vec::Raw y = broadcast_b ? fixed_b : Vec::load(b + i);
+        Vec::store(out + i, vector<op>(x, y));
+    }
+    for (; i < n; i++) {
+        out[i] = scalar(op, a[broadcast_a ? 0 : i], b[broadcast_b ? 0 : i]);
+    }
+}
+
+template <Op op>
+void run(Operand a, Operand b, double* out, size_t n) {
+    if (a.broadcast) {
+        b.broadcast ? run<op, true, true>(a.data, b.data, out, n) : run<op, true, false>(a.data, b.data, out, n);
+    }
+    else {
+        b.broadcast ? run<op, false, true>(a.data, b.data, out, n) : run<op, false, false>(a.data, b.data, out, n);
+    }
+}
+#endif
+
+} // namespace detail
+
+/* out[i] = a[i] op b[i] for the first n elements, `out` may be the same array as either input */
+inline void binary(Op op, Operand a, Operand b, double* out, size_t n) {
+#if SHITLANG_KERNELS_AVX || SHITLANG_KERNELS_SSE2
+    switch (op) {
+    case Op::ADD:        return detail::run<Op::ADD>(a, b, out, n);
+    case Op::SUBTRACT:   return detail::run<Op::SUBTRACT>(a, b, out, n);
+    case Op::MULTIPLY:   return detail::run<Op::MULTIPLY>(a, b, out, n);
+    case Op::DIVIDE:     return detail::run<Op::DIVIDE>(a, b, out, n);
+    case Op::LESS:       return detail::run<Op::LESS>(a, b, out, n);
+    case Op::GREATER:    return detail::run<Op::GREATER>(a, b, out, n);
+    case Op::LESS_EQ:    return detail::run<Op::LESS_EQ>(a, b, out, n);
+    case Op::GREATER_EQ: return detail::run<Op::GREATER_EQ>(a, b, out, n);
+    case Op::EQUAL:      return detail::run<Op::EQUAL>(a, b, out, n);
+    case Op::AND:        return detail::run<Op::AND>(a, b, out, n);
+    case Op::OR:         return detail::run<Op::OR>(a, b, out, n);
+    case Op::POWER:      break;
+    }
+#endif
+    for (size_t i = 0; i < n; i++) {
+        out[i] = detail::scalar(op, a.data[a.broadcast ? 0 : i], b.data[b.broadcast ? 0 : i]);
+    }
+}
+
+/* out[i] = -a[i], flipping the sign bit so 0 becomes -0 like the VM's negate */
+inline void negate(Operand a, double* out, size_t n) {
+    size_t i = 0;
+#if SHITLANG_KERNELS_AVX || SHITLANG_KERNELS_SSE2
+    const Vec::Raw sign = Vec::splat(-0.0);
+    for (; i + Vec::width <= n && !a.broadcast; i += Vec::width) {
+        Vec::store(out + i, Vec::bit_xor(Vec::load(a.data + i), sign));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = -a.data[a.broadcast ? 0 : i];
+    }
+}
+
+/* out[i] = a[i] ^ exponent, the same as integer_power(): -1, 0, 1 and 2 without std::pow, which they match */
+inline void integer_power(Operand a, int32_t exponent, double* out, size_t n) {
+    size_t i = 0;
+    if (exponent < -1 || exponent > 2) {
+        for (; i < n; i++) {
+            out[i] = std::pow(a.data[a.broadcast ? 0 : i], static_cast<double>(exponent));
+        }
+        return;
+    }
+#if SHITLANG_KERNELS_AVX || SHITLANG_KERNELS_SSE2
+    const Vec::Raw one = Vec::splat(1.0);
+    for (; i + Vec::width <= n && !a.broadcast; i += Vec::width) {
+        Vec::Raw base = Vec::load(a.data + i);
+        switch (exponent) {
+        case 0: Vec::store(out + i, one); break;
+        case 1: Vec::store(out + i, base); break;
+        case 2: Vec::store(out + i, Vec::mul(base, base)); break;
+        default: Vec::store(out + i, Vec::div(one, base)); break;
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        double base = a.data[a.broadcast ? 0 : i];
+        switch (exponent) {
+        case 0: out[i] = 1; break;
+        case 1: out[i] = base; break;
+        case 2: out[i] = base * base; break;
+        default: out[i] = 1 / base; break;
+        }
+    }
+}
+
+/* a[0] + ... + a[n - 1], one running sum per lane and the lanes added at the end, so the last bits depend on the lane count */
+inline double sum(const double* a, size_t n) {
+    double total = 0;
+    size_t i = 0;
+#if SHITLANG_KERNELS_AVX || SHITLANG_KERNELS_SSE2
+    Vec::Raw lanes = Vec::splat(0.0);
+    for (; i + Vec::width <= n; i += Vec::width) {
+        lanes = Vec::add(lanes, Vec::load(a + i));
+    }
+    double parts[Vec::width];
+    Vec::store(parts, lanes);
+    for (double part : parts) {
+        total += part;
+    }
+#endif
+    for (; i < n; i++) {
+        total += a[i];
+    }
+    return total;
+}
+
+namespace detail {
+
+// Smallest (or biggest) of n > 0 elements, NaN if any of them is
+template <bool smallest>
+double extreme(const double* a, size_t n) {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    double best = a[0];
+    size_t i = 0;
+#if SHITLANG_KERNELS_AVX || SHITLANG_KERNELS_SSE2
+    if (n >= Vec::width) {
+        Vec::Raw lanes = Vec::load(a);
+        Vec::Raw nans = Vec::unordered(lanes, lanes);
+        for (i = Vec::width; i + Vec::width <= n; i += Vec::width) {
+            Vec::Raw x = Vec::load(a + i);
+            lanes = smallest ? Vec::min(lanes, x) : Vec::max(lanes, x);
+            nans = Vec::bit_or(nans, Vec::unordered(x, x));
+        }
+        if (Vec::any(nans)) {
+            return nan;
+        }
+        double parts[Vec::width];
+        Vec::store(parts, lanes);
+        best = parts[0];
+        for (double part : parts) {
+            best = smallest ? (part < best ? part : best) : (part > best ? part : best);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (std::isnan(a[i])) {
+            return nan;
+        }
+        best = smallest ? (a[i] < best ? a[i] : best) : (a[i] > best ? a[i] : best);
+    }
+    return best;
+}
+
+} // namespace detail
+
+/* Smallest of the first n > 0 elements, NaN if any of them is NaN */
+inline double min(const double* a, size_t n) {
+    return detail::extreme<true>(a, n);
+}
+
+/* Biggest of the first n > 0 elements, NaN if any of them is NaN */
+inline double max(const double* a, size_t n) {
+    return detail::extreme<false>(a, n);
+}
+
+} // namespace kernels
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+    Read-only memory mapping of a whole script.
+    The tokenizer works on string_views, so the mapped pages are the source text and nothing
+    gets copied into a std::string. Throws std::runtime_error if the file can't be opened.
+*/
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Failed to open file: " + path);
+        }
+
+        LARGE_INTEGER file_size;
+        GetFileSizeEx(file, &file_size);
+        size = static_cast<size_t>(file_size.QuadPart);
+        if (size == 0) {
+            return; // Can't map an empty file, an empty view is fine
+        }
+
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping != nullptr) {
+            data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+        if (data == nullptr) {
+            close();
+            throw std::runtime_error("Failed to map file: " + path);
+        }
+#else
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open file: " + path);
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close();
+            throw std::runtime_error("Failed to open file: " + path);
+        }
+        size = static_cast<size_t>(info.st_size);
+        if (size == 0) {
+            return;
+        }
+
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close();
+            throw std::runtime_error("Failed to map file: " + path);
+        }
+        data = static_cast<const char*>(mapped);
+        madvise(mapped, size, MADV_SEQUENTIAL); // The tokenizer reads it front to back exactly once
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        close();
+    }
+
+    std::string_view text() const {
+        return data ? std::string_view(data, size) : std::string_view();
+    }
+
+private:
+    void close() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap(const_cast<char*>(data), size);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+    }
+
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
@@ -0,0 +1,127 @@
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+
+#include "MemoryStats.h"
+
+/*
+    The CLI's replacement operator new/delete, which feed --mem-stats (see MemoryStats.h). This file is
+    only in the executable, so the library and the benchmark keep the normal allocator.
+
+    Every allocation gets a small header in front of it with its size and where it was charged, so its
+    free is taken back off the same phase and structure. The header is there with or without
+    --mem-stats, because a pointer can't say whether it was made before counting was turned on. Without
+    --mem-stats an allocation only pays for the header and one test.
+*/
+
+namespace {
+
+struct Header {
+    size_t size;
+    MemoryStats::Tag tag;
+    bool counted;
+};
+
+// The header takes a whole alignment unit, so the pointer handed out stays as aligned as malloc's
+constexpr size_t header_space = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+static_assert(sizeof(Header) <= header_space, "The header has to fit in front of the allocation");
+
+void* raw_allocate(size_t size, size_t alignment) {
+    if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        return std::malloc(size);
+    }
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    return std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+#endif
+}
+
+void raw_free(void* raw, size_t alignment) {
+#ifdef _WIN32
+    if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        _aligned_free(raw);
+        return;
+    }
+#endif
+    (void)alignment;
+    std::free(raw);
+}
+
+void* allocate(size_t size, size_t alignment, bool nothrow) {
+    size_t offset = alignment > header_space ? alignment : header_space;
+    if (size > SIZE_MAX - offset - alignment) {
+        if (nothrow) {
+            return nullptr;
+        }
+        throw std::bad_alloc();
+    }
+
+    void* raw;
+    while ((raw = raw_allocate(size + offset, alignment)) == nullptr) {
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) {
+            if (nothrow) {
+                return nullptr;
+            }
+            throw std::bad_alloc();
+        }
+        if (nothrow) {
+            try {
+                handler();
+            }
+            catch (const std::bad_alloc&) {
+                return nullptr;
+            }
+        }
+        else {
+            handler();
+        }
+    }
+
+    char* memory = static_cast<char*>(raw) + offset;
+    Header* header = reinterpret_cast<Header*>(memory - sizeof(Header));
+    header->size = size;
+    header->counted = MemoryStats::enabled();
+    header->tag = header->counted ? MemoryStats::allocated(size) : 0;
+    return memory;
+}
+
+void deallocate(void* memory, size_t alignment) {
+    if (memory == nullptr) {
+        return;
+    }
+    size_t offset = alignment > header_space ? alignment : header_space;
+    const Header* header = reinterpret_cast<const Header*>(static_cast<char*>(memory) - sizeof(Header));
+    if (header->counted) {
+        MemoryStats::freed(header->tag, header->size);
+    }
+    raw_free(static_cast<char*>(memory) - offset, alignment);
+}
+
+constexpr size_t default_alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+}
+
+void* operator new(size_t size) { return allocate(size, default_alignment, false); }
+void* operator new[](size_t size) { return allocate(size, default_alignment, false); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return allocate(size, default_alignment, true); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return allocate(size, default_alignment, true); }
+void* operator new(size_t size, std::align_val_t alignment) { return allocate(size, static_cast<size_t>(alignment), false); }
+void* operator new[](size_t size, std::align_val_t alignment) { return allocate(size, static_cast<size_t>(alignment), false); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return allocate(size, static_cast<size_t>(alignment), true); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return allocate(size, static_cast<size_t>(alignment), true); }
+
+void operator delete(void* memory) noexcept { deallocate(memory, default_alignment); }
+void operator delete[](void* memory) noexcept { deallocate(memory, default_alignment); }
+void operator delete(void* memory, size_t) noexcept { deallocate(memory, default_alignment); }
+void operator delete[](void* memory, size_t) noexcept { deallocate(memory, default_alignment); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { deallocate(memory, default_alignment); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { deallocate(memory, default_alignment); }
+void operator delete(void* memory, std::align_val_t alignment) noexcept { deallocate(memory, static_cast<size_t>(alignment)); }
+void operator delete[](void* memory, std::align_val_t alignment) noexcept { deallocate(memory, static_cast<size_t>(alignment)); }
+void operator delete(void* memory, size_t, std::align_val_t alignment) noexcept { deallocate(memory, static_cast<size_t>(alignment)); }
+void operator delete[](void* memory, size_t, std::align_val_t alignment) noexcept { deallocate(memory, static_cast<size_t>(alignment)); }
+void operator delete(void* memory, std::align_val_t alignment, const std::nothrow_t&) noexcept { deallocate(memory, static_cast<size_t>(alignment)); }
+void operator delete[](void* memory, std::align_val_t alignment, const std::nothrow_t&) noexcept { deallocate(memory, static_cast<size_t>(alignment)); }
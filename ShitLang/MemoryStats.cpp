@@ -0,0 +1,141 @@
+#include "MemoryStats.h"
+
+#include <atomic>
+#include <cstdio>
+
+namespace {
+
+// All of these are constant initialized, so they work for allocations made during static initialization
+struct Counter {
+    std::atomic<uint64_t> allocations{ 0 };
+    std::atomic<uint64_t> bytes{ 0 };
+    std::atomic<int64_t> live{ 0 };
+    std::atomic<int64_t> peak{ 0 };
+};
+
+std::atomic<bool> counting{ false };
+Counter cells[MemoryStats::PHASE_COUNT][MemoryStats::CATEGORY_COUNT];
+std::atomic<int64_t> phase_peaks[MemoryStats::PHASE_COUNT]; // Highest total live bytes seen while the phase ran
+std::atomic<int64_t> category_live[MemoryStats::CATEGORY_COUNT];
+std::atomic<int64_t> category_peaks[MemoryStats::CATEGORY_COUNT];
+std::atomic<int64_t> total_live{ 0 };
+std::atomic<int64_t> total_peak{ 0 };
+
+void raise(std::atomic<int64_t>& peak, int64_t value) {
+    int64_t seen = peak.load(std::memory_order_relaxed);
+    while (value > seen && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+    }
+}
+
+struct Row {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+    int64_t live = 0;
+    int64_t peak = 0;
+
+    void add(const Counter& counter) {
+        allocations += counter.allocations.load(std::memory_order_relaxed);
+        bytes += counter.bytes.load(std::memory_order_relaxed);
+        live += counter.live.load(std::memory_order_relaxed);
+    }
+};
+
+void print_row(std::ostream& out, const char* name, const Row& row) {
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-10s %12llu %14llu %14lld %14lld\n", name, static_cast<unsigned long long>(row.allocations),
+        static_cast<unsigned long long>(row.bytes), static_cast<long long>(row.peak), static_cast<long long>(row.live));
+    out << line;
+}
+
+}
+
+void MemoryStats::enable() {
+    counting.store(true, std::memory_order_relaxed);
+}
+
+bool MemoryStats::enabled() {
+    return counting.load(std::memory_order_relaxed);
+}
+
+MemoryStats::Tag MemoryStats::allocated(size_t bytes) {
+    Phase phase = current_phase;
+    Category category = current_category;
+    int64_t size = static_cast<int64_t>(bytes);
+
+    Counter& cell = cells[phase][category];
+    cell.allocations.fetch_add(1, std::memory_order_relaxed);
+    cell.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    cell.live.fetch_add(size, std::memory_order_relaxed);
+
+    int64_t live = total_live.fetch_add(size, std::memory_order_relaxed) + size;
+    raise(total_peak, live);
+    raise(phase_peaks[phase], live);
+    raise(category_peaks[category], category_live[category].fetch_add(size, std::memory_order_relaxed) + size);
+    return static_cast<Tag>(phase * CATEGORY_COUNT + category);
+}
+
+void MemoryStats::freed(Tag tag, size_t bytes) {
+    int64_t size = static_cast<int64_t>(bytes);
+    cells[tag / CATEGORY_COUNT][tag % CATEGORY_COUNT].live.fetch_sub(size, std::memory_order_relaxed);
+    category_live[tag % CATEGORY_COUNT].fetch_sub(size, std::memory_order_relaxed);
+    total_live.fetch_sub(size, std::memory_order_relaxed);
+}
+
+const char* MemoryStats::phase_name(Phase phase) {
+    switch (phase) {
+    case TOKENIZE: return "tokenize";
+    case PARSE:    return "parse";
+    case OPTIMIZE: return "optimize";
+    case COMPILE:  return "compile";
+    case EXECUTE:  return "execute";
+    case OTHER:    return "other";
+    default:       return "unknown";
+    }
+}
+
+const char* MemoryStats::category_name(Category category) {
+    switch (category) {
+    case UNSORTED:  return "unsorted";
+    case TOKENS:    return "tokens";
+    case AST:       return "ast";
+    case VARIABLES: return "variables";
+    case BYTECODE:  return "bytecode";
+    case VECTORS:   return "vectors";
+    case OUTPUT:    return "output";
+    case CACHE:     return "cache";
+    default:        return "unknown";
+    }
+}
+
+void MemoryStats::report(std::ostream& out) {
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-10s %12s %14s %14s %14s\n", "", "allocations", "bytes", "peak live", "still live");
+
+    // A phase's peak is the whole program's live bytes at its highest while that phase ran
+    out << "\n=== memory ===\n" << line;
+    Row total;
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        Row row;
+        for (int category = 0; category < CATEGORY_COUNT; category++) {
+            row.add(cells[phase][category]);
+        }
+        row.peak = phase_peaks[phase].load(std::memory_order_relaxed);
+        print_row(out, phase_name(static_cast<Phase>(phase)), row);
+        total.allocations += row.allocations;
+        total.bytes += row.bytes;
+    }
+    total.live = total_live.load(std::memory_order_relaxed);
+    total.peak = total_peak.load(std::memory_order_relaxed);
+    print_row(out, "total", total);
+
+    // A structure's peak is its own live bytes at their highest
+    out << "\n" << line;
+    for (int category = 0; category < CATEGORY_COUNT; category++) {
+        Row row;
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            row.add(cells[phase][category]);
+        }
+        row.peak = category_peaks[category].load(std::memory_order_relaxed);
+        print_row(out, category_name(static_cast<Category>(category)), row);
+    }
+}
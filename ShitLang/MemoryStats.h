@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/*
+    Allocation accounting for --mem-stats: allocation count, bytes and peak live bytes per phase of the
+    interpreter and per data structure.
+
+    The library only marks what it's doing with the two scopes below, each of which sets a thread local.
+    The counting is done by the replacement operator new/delete in the CLI (MemoryHooks.cpp). They charge
+    an allocation to the phase and structure that were current when it was made, and its free to the same
+    place. The benchmark and anything else linking the library keep the normal allocator, so for them a
+    scope costs two thread local stores.
+*/
+class MemoryStats {
+public:
+    // Same order as Profiler::Phase, plus the time outside all of them
+    enum Phase : uint8_t {
+        TOKENIZE,
+        PARSE,
+        OPTIMIZE,
+        COMPILE,
+        EXECUTE,
+        OTHER,
+        PHASE_COUNT
+    };
+
+    enum Category : uint8_t {
+        UNSORTED,  // Anything not marked: parser and optimizer scratch, strings, the C++ runtime
+        TOKENS,    // Token arrays
+        AST,       // Arena blocks, which is where the nodes live
+        VARIABLES, // Environment: names, slots and values
+        BYTECODE,  // Chunks
+        VECTORS,   // Vector values
+        OUTPUT,    // OutputSink buffers and the strings they write into
+        CACHE,     // StatementCache keys and entries, the chunks in them stay charged to BYTECODE
+        CATEGORY_COUNT
+    };
+
+    /* Where an allocation was charged, the hooks keep it with the allocation until it's freed */
+    using Tag = uint16_t;
+
+    /* Turns counting on. Allocations made before this aren't counted and neither are their frees. */
+    static void enable();
+    static bool enabled();
+
+    /* Called by the hooks */
+    static Tag allocated(size_t bytes);
+    static void freed(Tag tag, size_t bytes);
+
+    static const char* phase_name(Phase phase);
+    static const char* category_name(Category category);
+
+    /* Per phase and per structure tables, with what's still live at the time of the call */
+    static void report(std::ostream& out);
+
+    /* Charges allocations on this thread to `phase` until end() or the end of the scope */
+    class PhaseScope {
+    public:
+        explicit PhaseScope(Phase next) : previous(current_phase) {
+            current_phase = next;
+        }
+
+        PhaseScope(const PhaseScope&) = delete;
+        PhaseScope& operator=(const PhaseScope&) = delete;
+
+        ~PhaseScope() {
+            end();
+        }
+
+        void end() {
+            if (active) {
+                current_phase = previous;
+                active = false;
+            }
+        }
+
+    private:
+        Phase previous;
+        bool active = true;
+    };
+
+    /* Charges allocations on this thread to `category` for the rest of the scope */
+    class CategoryScope {
+    public:
+        explicit CategoryScope(Category next) : previous(current_category) {
+            current_category = next;
+        }
+
+        CategoryScope(const CategoryScope&) = delete;
+        CategoryScope& operator=(const CategoryScope&) = delete;
+
+        ~CategoryScope() {
+            current_category = previous;
+        }
+
+    private:
+        Category previous;
+    };
+
+private:
+    static inline thread_local Phase current_phase = OTHER;
+    static inline thread_local Category current_category = UNSORTED;
+};
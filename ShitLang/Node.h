@@ -2,25 +2,262 @@
 
 #include <stdexcept>
 #include <iostream>
+#include <cmath>
+#include <vector>
+
+#include "Chunk.h"
+#include "Environment.h"
+#include "OutputSink.h"
+
 class Node {
 public:
     virtual ~Node() = default;
-    virtual double evaluate() const = 0; // Method to evaluate the node's value
+    virtual Value evaluate() const = 0; // Method to evaluate the node's value
+    virtual void compile(Chunk& chunk) const = 0; // Emits bytecode that leaves the node's value on the VM stack
+
+    /* The type evaluate() is sure to give whatever the variables hold, UNKNOWN when it depends on them */
+    virtual ValueType static_type() const { return ValueType::UNKNOWN; }
 };
 
 class NumberNode : public Node {
-    double value;
+    Value value;
+
+public:
+    explicit NumberNode(Value value) : value(value) {}
+    Value get_value() const { return value; }
+    Value evaluate() const override { return value; }
+    void compile(Chunk& chunk) const override { chunk.emit_constant(value); }
+    ValueType static_type() const override { return value.type; }
+};
+
+class VariableNode : public Node {
+    const Environment* env;
+    uint32_t slot;
+
+public:
+    VariableNode(const Environment* env, uint32_t slot) : env(env), slot(slot) {}
+    const Environment* get_env() const { return env; }
+    uint32_t get_slot() const { return slot; }
+    Value evaluate() const override { return env->value(slot); }
+    void compile(Chunk& chunk) const override { chunk.emit(OP_LOAD, slot); }
+};
+
+/* A read of a `let :=` variable, which gets recomputed first if anything it depends on has changed */
+class ReactiveVariableNode : public Node {
+    Environment* env;
+    uint32_t slot;
+
+public:
+    ReactiveVariableNode(Environment* env, uint32_t slot) : env(env), slot(slot) {}
+    Environment* get_env() const { return env; }
+    uint32_t get_slot() const { return slot; }
+
+    Value evaluate() const override {
+        env->refresh(slot);
+        return env->value(slot);
+    }
+
+    void compile(Chunk& chunk) const override { chunk.emit(OP_LOAD_REACTIVE, slot); }
+};
+
+/* The tree evaluator's frame for the innermost function call, what the local nodes below read and write */
+inline Value*& current_frame() {
+    thread_local Value* frame = nullptr;
+    return frame;
+}
+
+/* A parameter or `let` inside a function body, it lives in the call's frame instead of a global slot */
+class LocalVariableNode : public Node {
+    uint32_t index;
+
+public:
+    explicit LocalVariableNode(uint32_t index) : index(index) {}
+    uint32_t get_index() const { return index; }
+    Value evaluate() const override { return current_frame()[index]; }
+    void compile(Chunk& chunk) const override { chunk.emit(OP_LOAD_LOCAL, index); }
+};
+
+/* Both `let x = ...` and a plain `x = ...` end up as a store into the variable's slot */
+class LetNode : public Node {
+    Environment* env;
+    uint32_t slot;
+    Node* value;
+
+public:
+    LetNode(Environment* env, uint32_t slot, Node* value) : env(env), slot(slot), value(value) {}
+
+    Environment* get_env() const { return env; }
+    uint32_t get_slot() const { return slot; }
+    Node* get_value() const { return value; }
+
+    Value evaluate() const override {
+        Value result = env->value(slot) = value->evaluate();
+        env->changed(slot);
+        return result;
+    }
+
+    void compile(Chunk& chunk) const override {
+        value->compile(chunk);
+        chunk.emit(OP_STORE, slot);
+    }
+
+    ValueType static_type() const override { return value->static_type(); }
+};
+
+/* LetNode for a local, a store into the frame */
+class LocalLetNode : public Node {
+    uint32_t index;
+    Node* value;
+
+public:
+    LocalLetNode(uint32_t index, Node* value) : index(index), value(value) {}
+
+    uint32_t get_index() const { return index; }
+    Node* get_value() const { return value; }
+
+    Value evaluate() const override {
+        return current_frame()[index] = value->evaluate();
+    }
+
+    void compile(Chunk& chunk) const override {
+        value->compile(chunk);
+        chunk.emit(OP_STORE_LOCAL, index);
+    }
+
+    ValueType static_type() const override { return value->static_type(); }
+};
+
+/* Several statements in a row, the value of the last one is the value of the block */
+class BlockNode : public Node {
+    std::vector<Node*> statements;
+
+public:
+    explicit BlockNode(std::vector<Node*> statements) : statements(std::move(statements)) {}
+
+    const std::vector<Node*>& get_statements() const { return statements; }
+
+    Value evaluate() const override {
+        Value result;
+        for (const Node* statement : statements) {
+            result = statement->evaluate();
+        }
+        return result;
+    }
+
+    void compile(Chunk& chunk) const override {
+        for (size_t i = 0; i < statements.size(); i++) {
+            if (i > 0) {
+                chunk.emit(OP_POP);
+            }
+            statements[i]->compile(chunk);
+        }
+        if (statements.empty()) {
+            chunk.emit_constant(0);
+        }
+    }
+};
+
+/* `if cond { ... } else { ... }`, any non-zero condition is true like the relational operators produce */
+class IfNode : public Node {
+    Node* condition;
+    Node* then_branch;
+    Node* else_branch; // nullptr when there is no else
+
+public:
+    IfNode(Node* condition, Node* then_branch, Node* else_branch)
+        : condition(condition), then_branch(then_branch), else_branch(else_branch) {}
+
+    Node* get_condition() const { return condition; }
+    Node* get_then() const { return then_branch; }
+    Node* get_else() const { return else_branch; }
+
+    Value evaluate() const override {
+        if (condition->evaluate().is_true()) {
+            return then_branch->evaluate();
+        }
+        return else_branch ? else_branch->evaluate() : Value();
+    }
+
+    void compile(Chunk& chunk) const override {
+        condition->compile(chunk);
+        size_t to_else = chunk.emit_jump(OP_JUMP_IF_FALSE);
+        then_branch->compile(chunk);
+        size_t to_end = chunk.emit_jump(OP_JUMP);
+
+        chunk.adjust_depth(-1); // Only one of the branches' values is ever on the stack
+        chunk.patch_jump(to_else);
+        if (else_branch) {
+            else_branch->compile(chunk);
+        }
+        else {
+            chunk.emit_constant(0);
+        }
+        chunk.patch_jump(to_end);
+    }
+};
+
+/* `while cond { ... }`, the body is compiled once and jumped back to */
+class WhileNode : public Node {
+    Node* condition;
+    Node* body;
+
+public:
+    WhileNode(Node* condition, Node* body) : condition(condition), body(body) {}
+
+    Node* get_condition() const { return condition; }
+    Node* get_body() const { return body; }
+
+    Value evaluate() const override {
+        while (condition->evaluate().is_true()) {
+            body->evaluate();
+        }
+        return 0;
+    }
+
+    void compile(Chunk& chunk) const override {
+        uint32_t loop_start = chunk.position();
+        condition->compile(chunk);
+        size_t to_exit = chunk.emit_jump(OP_JUMP_IF_FALSE);
+        body->compile(chunk);
+        chunk.emit(OP_POP);
+        chunk.emit(OP_JUMP, loop_start);
+        chunk.patch_jump(to_exit);
+        chunk.emit_constant(0);
+    }
+};
+
+/* Marks the source line a statement came from, the parser only adds these when profiling */
+class LineNode : public Node {
+    uint32_t line;
+    Node* statement;
 
 public:
-    explicit NumberNode(double value) : value(value) {}
-    double evaluate() const override { return value; }
+    LineNode(uint32_t line, Node* statement) : line(line), statement(statement) {}
+
+    uint32_t get_line() const { return line; }
+    Node* get_statement() const { return statement; }
+
+    Value evaluate() const override {
+        return statement->evaluate();
+    }
+
+    void compile(Chunk& chunk) const override {
+        chunk.emit(OP_LINE, line);
+        statement->compile(chunk);
+    }
+
+    ValueType static_type() const override { return statement->static_type(); }
 };
 
 class NoOpNode : public Node {
 public:
-    double evaluate() const override {
+    Value evaluate() const override {
         return 0; // Or potentially throw an exception if this should never be evaluated
     }
+
+    void compile(Chunk& chunk) const override {
+        chunk.emit_constant(0);
+    }
 };
 
 class UnaryOperationNode : public Node {
@@ -31,16 +268,28 @@ public:
     UnaryOperationNode(Node* operand, char operation)
         : operand(operand), operation(operation) {}
 
-    double evaluate() const override {
+    Node* get_operand() const { return operand; }
+    char get_operation() const { return operation; }
+
+    Value evaluate() const override {
         switch (operation) {
-        case '-': return -operand->evaluate();
+        case '-': return arith::negate(operand->evaluate());
             // Add cases for other unary operations as necessary.
         default: throw std::invalid_argument("Unsupported unary operation");
         }
     }
 
-    ~UnaryOperationNode() {
-        delete operand;
+    void compile(Chunk& chunk) const override {
+        operand->compile(chunk);
+        switch (operation) {
+        case '-': chunk.emit(OP_NEGATE); break;
+        default: throw std::invalid_argument("Unsupported unary operation");
+        }
+    }
+
+    ValueType static_type() const override {
+        // -INT64_MIN doesn't fit, so only doubles (and vectors of them) are sure to stay what they are
+        return arith::unary_type(operand->static_type());
     }
 };
 
@@ -50,15 +299,20 @@ class PrintNode : public Node {
 public:
     explicit PrintNode(Node* expression) : expression(expression) {}
 
-    double evaluate() const override {
-        double value = expression->evaluate();
-        std::cout << value << std::endl; // Print the value to stdout
+    Node* get_expression() const { return expression; }
+
+    Value evaluate() const override {
+        Value value = expression->evaluate();
+        OutputSink::current().write_value(value); // Buffered, see OutputSink
         return value; // You might return the printed value or simply return 0 to indicate success.
     }
 
-    ~PrintNode() {
-        delete expression;
+    void compile(Chunk& chunk) const override {
+        expression->compile(chunk);
+        chunk.emit(OP_PRINT);
     }
+
+    ValueType static_type() const override { return expression->static_type(); }
 };
 
 // Logic
@@ -71,24 +325,42 @@ public:
     RelationalOperationNode(Node* left, Node* right, char operation)
         : left(left), right(right), operation(operation) {}
 
-    double evaluate() const override {
+    Node* get_left() const { return left; }
+    Node* get_right() const { return right; }
+    char get_operation() const { return operation; }
+
+    Value evaluate() const override {
         // Implement evaluation logic for relational operators
         // For example:
         switch (operation) {
-        case '<': return left->evaluate() < right->evaluate(); // True is 1, false is 0
-        case '>': return left->evaluate() > right->evaluate();
-        case ',': return left->evaluate() <= right->evaluate(); // Why tf does this work
-        case '.': return left->evaluate() >= right->evaluate();
-        case '=': return left->evaluate() == right->evaluate();
-        case '&': return left->evaluate() && right->evaluate();
-        case '|': return left->evaluate() || right->evaluate();
+        case '<': return arith::less(left->evaluate(), right->evaluate()); // True is 1, false is 0
+        case '>': return arith::greater(left->evaluate(), right->evaluate());
+        case ',': return arith::less_equal(left->evaluate(), right->evaluate()); // Why tf does this work
+        case '.': return arith::greater_equal(left->evaluate(), right->evaluate());
+        case '=': return arith::equal(left->evaluate(), right->evaluate());
+        case '&': return arith::logical_and(left->evaluate(), right->evaluate()); // Both sides, like the VM, vectors go element by element
+        case '|': return arith::logical_or(left->evaluate(), right->evaluate());
+        default: throw std::invalid_argument("Unsupported relational operation");
+        }
+    }
+
+    void compile(Chunk& chunk) const override {
+        left->compile(chunk);
+        right->compile(chunk);
+        switch (operation) {
+        case '<': chunk.emit(OP_LESS); break;
+        case '>': chunk.emit(OP_GREATER); break;
+        case ',': chunk.emit(OP_LESS_EQ); break;
+        case '.': chunk.emit(OP_GREATER_EQ); break;
+        case '=': chunk.emit(OP_EQUAL); break;
+        case '&': chunk.emit(OP_AND); break;
+        case '|': chunk.emit(OP_OR); break;
         default: throw std::invalid_argument("Unsupported relational operation");
         }
     }
 
-    ~RelationalOperationNode() {
-        delete left;
-        delete right;
+    ValueType static_type() const override {
+        return arith::relational_type(left->static_type(), right->static_type());
     }
 };
 
@@ -102,20 +374,232 @@ public:
     BinaryOperationNode(Node* left, Node* right, char operation)
         : left(left), right(right), operation(operation) {}
 
-    double evaluate() const override {
+    Node* get_left() const { return left; }
+    Node* get_right() const { return right; }
+    char get_operation() const { return operation; }
+
+    Value evaluate() const override {
         switch (operation) {
-        case '+': return left->evaluate() + right->evaluate();
-        case '-': return left->evaluate() - right->evaluate();
-        case '*': return left->evaluate() * right->evaluate();
-        case '/': return left->evaluate() / right->evaluate();
-        case '^': return std::pow(left->evaluate(), right->evaluate());
+        case '+': return arith::add(left->evaluate(), right->evaluate());
+        case '-': return arith::subtract(left->evaluate(), right->evaluate());
+        case '*': return arith::multiply(left->evaluate(), right->evaluate());
+        case '/': return arith::divide(left->evaluate(), right->evaluate());
+        case '^': return arith::power(left->evaluate(), right->evaluate());
         default: throw std::invalid_argument("Unsupported operation");
         }
     }
 
+    void compile(Chunk& chunk) const override {
+        left->compile(chunk);
+        right->compile(chunk);
+        // With a double on either side the int path can never run, so skip checking for it
+        bool doubles = static_type() == ValueType::DOUBLE;
+        switch (operation) {
+        case '+': chunk.emit(doubles ? OP_ADD_DOUBLE : OP_ADD); break;
+        case '-': chunk.emit(doubles ? OP_SUBTRACT_DOUBLE : OP_SUBTRACT); break;
+        case '*': chunk.emit(doubles ? OP_MULTIPLY_DOUBLE : OP_MULTIPLY); break;
+        case '/': chunk.emit(doubles ? OP_DIVIDE_DOUBLE : OP_DIVIDE); break;
+        case '^': chunk.emit(OP_POWER); break;
+        default: throw std::invalid_argument("Unsupported operation");
+        }
+    }
+
+    ValueType static_type() const override {
+        return arith::arithmetic_type(left->static_type(), right->static_type());
+    }
+};
+
+class IntegerPowerNode : public Node {
+    Node* base;
+    int32_t exponent;
+
+public:
+    IntegerPowerNode(Node* base, int32_t exponent) : base(base), exponent(exponent) {}
+
+    Node* get_base() const { return base; }
+    int32_t get_exponent() const { return exponent; }
+
+    Value evaluate() const override {
+        return arith::power(base->evaluate(), exponent);
+    }
+
+    void compile(Chunk& chunk) const override {
+        base->compile(chunk);
+        chunk.emit(OP_POWI, static_cast<uint32_t>(exponent));
+    }
+
+    ValueType static_type() const override {
+        return arith::unary_type(base->static_type());
+    }
+};
+
+/* `[a, b, c]`, the elements can be any expressions as long as they give numbers */
+class VectorNode : public Node {
+    std::vector<Node*> elements;
+
+public:
+    explicit VectorNode(std::vector<Node*> elements) : elements(std::move(elements)) {}
+
+    const std::vector<Node*>& get_elements() const { return elements; }
+
+    Value evaluate() const override {
+        std::vector<Value> values;
+        values.reserve(elements.size());
+        for (const Node* element : elements) {
+            values.push_back(element->evaluate());
+        }
+        return vectors::make(values.data(), values.size());
+    }
+
+    void compile(Chunk& chunk) const override {
+        for (const Node* element : elements) {
+            element->compile(chunk);
+        }
+        chunk.emit(OP_VECTOR, static_cast<uint32_t>(elements.size()));
+        chunk.adjust_depth(-static_cast<int>(elements.size()));
+    }
+
+    ValueType static_type() const override { return ValueType::VECTOR; }
+};
+
+/* `sum(v)`, `min(v)` and `max(v)`, a vector goes down to one number and a number stays as it is */
+class ReduceNode : public Node {
+    Node* operand;
+    char operation; // '+' for sum, '<' for min, '>' for max
+
+public:
+    ReduceNode(Node* operand, char operation) : operand(operand), operation(operation) {}
+
+    Node* get_operand() const { return operand; }
+    char get_operation() const { return operation; }
+
+    Value evaluate() const override {
+        switch (operation) {
+        case '+': return vectors::sum(operand->evaluate());
+        case '<': return vectors::min(operand->evaluate());
+        case '>': return vectors::max(operand->evaluate());
+        default: throw std::invalid_argument("Unsupported reduction");
+        }
+    }
+
+    void compile(Chunk& chunk) const override {
+        operand->compile(chunk);
+        switch (operation) {
+        case '+': chunk.emit(OP_SUM); break;
+        case '<': chunk.emit(OP_MIN); break;
+        case '>': chunk.emit(OP_MAX); break;
+        default: throw std::invalid_argument("Unsupported reduction");
+        }
+    }
+
+    ValueType static_type() const override {
+        ValueType type = operand->static_type();
+        return type == ValueType::VECTOR ? ValueType::DOUBLE : type;
+    }
+};
+
+/* `fn name(a, b) ...` as a statement. The body goes into the function's own chunk, the statement's value is 0 */
+class FunctionNode : public Node {
+    Function* function;
+
+public:
+    explicit FunctionNode(Function* function) : function(function) {}
+
+    Function* get_function() const { return function; }
+
+    Value evaluate() const override {
+        return 0;
+    }
+
+    void compile(Chunk& chunk) const override {
+        if (function->chunk.code.empty()) {
+            function->body->compile(function->chunk);
+            function->chunk.emit(OP_RETURN);
+        }
+        chunk.emit_constant(0);
+    }
+
+    ValueType static_type() const override { return ValueType::INT; }
+};
+
+/* `let y := expression` as a statement. The expression goes into the variable's own chunk, the statement's value is 0 */
+class ReactiveLetNode : public Node {
+    Reactive* reactive;
+
+public:
+    explicit ReactiveLetNode(Reactive* reactive) : reactive(reactive) {}
+
+    Reactive* get_reactive() const { return reactive; }
+
+    // The graph already has it from when it was parsed, running the definition doesn't change anything
+    Value evaluate() const override {
+        return 0;
+    }
+
+    void compile(Chunk& chunk) const override {
+        if (reactive->chunk.code.empty()) {
+            reactive->expression->compile(reactive->chunk);
+            reactive->chunk.emit(OP_RETURN);
+        }
+        chunk.emit_constant(0);
+    }
+
+    ValueType static_type() const override { return ValueType::INT; }
+};
+
+/* `name(a, b)` on a user function. The builtins are ReduceNodes. */
+class CallNode : public Node {
+    Function* function;
+    std::vector<Node*> arguments;
 
-    ~BinaryOperationNode() {
-        delete left;
-        delete right;
+    // Swaps in a call's frame for the tree evaluator and puts the caller's back, exceptions included
+    class Frame {
+    public:
+        Frame(const Function& function, Value* values) : caller(current_frame()) {
+            size_t& depth = call_depth();
+            if (depth >= Function::max_call_depth) {
+                throw std::runtime_error("Call stack overflow in " + function.name);
+            }
+            depth++;
+            current_frame() = values;
+        }
+
+        ~Frame() {
+            call_depth()--;
+            current_frame() = caller;
+        }
+
+    private:
+        static size_t& call_depth() {
+            thread_local size_t depth = 0;
+            return depth;
+        }
+
+        Value* caller;
+    };
+
+public:
+    CallNode(Function* function, std::vector<Node*> arguments) : function(function), arguments(std::move(arguments)) {}
+
+    Function* get_function() const { return function; }
+    const std::vector<Node*>& get_arguments() const { return arguments; }
+
+    Value evaluate() const override {
+        std::vector<Value> values(function->locals);
+        for (size_t i = 0; i < arguments.size(); i++) {
+            values[i] = arguments[i]->evaluate();
+        }
+        Frame frame(*function, values.data());
+        return function->body->evaluate();
+    }
+
+    void compile(Chunk& chunk) const override {
+        for (const Node* argument : arguments) {
+            argument->compile(chunk);
+        }
+        // A function's calls to itself don't keep it alive, that would be a cycle
+        std::shared_ptr<const Function> owner = &chunk == &function->chunk ? nullptr : function->shared_from_this();
+        chunk.emit(OP_CALL, chunk.add_call(function, std::move(owner)));
+        chunk.adjust_depth(-static_cast<int>(arguments.size()));
     }
 };
@@ -0,0 +1,419 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+#include "Node.h"
+#include "Arena.h"
+
+/*
+    Tree-to-tree pass that runs between Parser::parse() and compilation.
+    - folds operators whose operands are all literals, using the evaluator's own semantics
+    - drops identities that hold for every value (x * 1, x / 1, x - 0, x ^ 1, ...), an identity written
+      with a double literal only when x is sure to be a double too, since 3 * 1.0 is the double 3
+    - turns x ^ 2 into x * x and x ^ -1 into 1 / x instead of calls to std::pow, the only powers where that
+      gives exactly the same answer
+    - optimizes function bodies and reactive expressions where they're defined, and pastes small
+      functions into their calls
+    Rewritten nodes come from the same arena as the parse, so they die with it.
+*/
+class Optimizer {
+public:
+    explicit Optimizer(Arena& arena) : arena(arena) {}
+
+    Node* optimize(Node* node) {
+        if (auto* block = dynamic_cast<BlockNode*>(node)) {
+            std::vector<Node*> statements;
+            statements.reserve(block->get_statements().size());
+            for (Node* statement : block->get_statements()) {
+                statements.push_back(optimize(statement));
+            }
+            return arena.make<BlockNode>(std::move(statements));
+        }
+        if (auto* let = dynamic_cast<LetNode*>(node)) {
+            return arena.make<LetNode>(let->get_env(), let->get_slot(), optimize(let->get_value()));
+        }
+        if (auto* local = dynamic_cast<LocalLetNode*>(node)) {
+            return arena.make<LocalLetNode>(local->get_index(), optimize(local->get_value()));
+        }
+        if (auto* definition = dynamic_cast<FunctionNode*>(node)) {
+            define(definition->get_function());
+            return node;
+        }
+        if (auto* binding = dynamic_cast<ReactiveLetNode*>(node)) {
+            Reactive* reactive = binding->get_reactive();
+            Optimizer expression(reactive->nodes);
+            reactive->expression = expression.optimize(reactive->expression);
+            rewrites += expression.get_rewrites();
+            return node;
+        }
+        if (auto* call = dynamic_cast<CallNode*>(node)) {
+            std::vector<Node*> arguments;
+            arguments.reserve(call->get_arguments().size());
+            for (Node* argument : call->get_arguments()) {
+                arguments.push_back(optimize(argument));
+            }
+            if (Node* inlined = inline_call(*call->get_function(), arguments)) {
+                return rewrite(inlined);
+            }
+            return arena.make<CallNode>(call->get_function(), std::move(arguments));
+        }
+        if (auto* branch = dynamic_cast<IfNode*>(node)) {
+            Node* condition = optimize(branch->get_condition());
+            Node* then_branch = optimize(branch->get_then());
+            Node* else_branch = branch->get_else() ? optimize(branch->get_else()) : nullptr;
+            if (is_number(condition)) {
+                // Decided at compile time, only the branch that runs is kept
+                if (condition->evaluate().is_true()) {
+                    return rewrite(then_branch);
+                }
+                return rewrite(else_branch ? else_branch : arena.make<NumberNode>(0));
+            }
+            return arena.make<IfNode>(condition, then_branch, else_branch);
+        }
+        if (auto* loop = dynamic_cast<WhileNode*>(node)) {
+            Node* condition = optimize(loop->get_condition());
+            if (is_number(condition) && !condition->evaluate().is_true()) {
+                return rewrite(arena.make<NumberNode>(0));
+            }
+            return arena.make<WhileNode>(condition, optimize(loop->get_body()));
+        }
+        if (auto* marker = dynamic_cast<LineNode*>(node)) {
+            return arena.make<LineNode>(marker->get_line(), optimize(marker->get_statement()));
+        }
+        if (auto* print = dynamic_cast<PrintNode*>(node)) {
+            return arena.make<PrintNode>(optimize(print->get_expression()));
+        }
+        if (auto* unary = dynamic_cast<UnaryOperationNode*>(node)) {
+            Node* operand = optimize(unary->get_operand());
+            if (is_number(operand)) {
+                return fold(UnaryOperationNode(operand, unary->get_operation()));
+            }
+            return arena.make<UnaryOperationNode>(operand, unary->get_operation());
+        }
+        if (auto* power = dynamic_cast<IntegerPowerNode*>(node)) {
+            return arena.make<IntegerPowerNode>(optimize(power->get_base()), power->get_exponent());
+        }
+        if (auto* binary = dynamic_cast<BinaryOperationNode*>(node)) {
+            return optimize_binary(optimize(binary->get_left()), optimize(binary->get_right()), binary->get_operation());
+        }
+        if (auto* relational = dynamic_cast<RelationalOperationNode*>(node)) {
+            return optimize_relational(optimize(relational->get_left()), optimize(relational->get_right()), relational->get_operation());
+        }
+        if (auto* vector = dynamic_cast<VectorNode*>(node)) {
+            std::vector<Node*> elements;
+            elements.reserve(vector->get_elements().size());
+            for (Node* element : vector->get_elements()) {
+                elements.push_back(optimize(element));
+            }
+            return arena.make<VectorNode>(std::move(elements));
+        }
+        if (auto* reduce = dynamic_cast<ReduceNode*>(node)) {
+            Node* operand = optimize(reduce->get_operand());
+            if (is_number(operand)) {
+                return rewrite(operand); // A number reduces to itself
+            }
+            return arena.make<ReduceNode>(operand, reduce->get_operation());
+        }
+        return node;
+    }
+
+    /* How many nodes were folded or rewritten so far */
+    size_t get_rewrites() const {
+        return rewrites;
+    }
+
+private:
+    static bool is_number(const Node* node) {
+        return dynamic_cast<const NumberNode*>(node) != nullptr;
+    }
+
+    static bool is_scalar(const Node* node) {
+        ValueType type = node->static_type();
+        return type == ValueType::INT || type == ValueType::DOUBLE;
+    }
+
+    // Compares the type and the exact bits so that 0, 0.0 and -0.0 are all told apart
+    static bool is_exactly(const Node* node, Value value) {
+        auto* number = dynamic_cast<const NumberNode*>(node);
+        return number && number->get_value().identical(value);
+    }
+
+    // `constant` leaves `other` alone: the int form always, the double form only next to something that is a double anyway
+    static bool is_identity(const Node* constant, const Node* other, int64_t value) {
+        return is_exactly(constant, value)
+            || (is_exactly(constant, static_cast<double>(value)) && other->static_type() == ValueType::DOUBLE);
+    }
+
+    static bool is_leaf(const Node* node) {
+        return is_number(node) || dynamic_cast<const VariableNode*>(node) != nullptr || dynamic_cast<const LocalVariableNode*>(node) != nullptr
+            || dynamic_cast<const ReactiveVariableNode*>(node) != nullptr;
+    }
+
+    Node* fold(const Node& node) {
+        rewrites++;
+        return arena.make<NumberNode>(node.evaluate());
+    }
+
+    Node* rewrite(Node* node) {
+        rewrites++;
+        return node;
+    }
+
+    Node* optimize_binary(Node* left, Node* right, char operation) {
+        if (is_number(left) && is_number(right)) {
+            return fold(BinaryOperationNode(left, right, operation));
+        }
+
+        switch (operation) {
+        case '*':
+            if (is_identity(right, left, 1)) return rewrite(left);
+            if (is_identity(left, right, 1)) return rewrite(right);
+            break;
+        case '/':
+            if (is_identity(right, left, 1)) return rewrite(left);
+            break;
+        case '-':
+            // x - 0 is x even for x = -0, x + 0 is not (-0 + 0 = 0), so only the subtraction goes
+            if (is_identity(right, left, 0)) return rewrite(left);
+            break;
+        case '+':
+            if (is_exactly(right, -0.0) && left->static_type() == ValueType::DOUBLE) return rewrite(left);
+            if (is_exactly(left, -0.0) && right->static_type() == ValueType::DOUBLE) return rewrite(right);
+            break;
+        case '^':
+            if (Node* power = optimize_power(left, right)) {
+                return rewrite(power);
+            }
+            break;
+        }
+        return arena.make<BinaryOperationNode>(left, right, operation);
+    }
+
+    Node* optimize_power(Node* base, Node* exponent) {
+        auto* number = dynamic_cast<const NumberNode*>(exponent);
+        if (!number) {
+            return nullptr;
+        }
+
+        // int ^ 2.0 is a double while int ^ 2 stays an int, so a double exponent needs a double base
+        Value value = number->get_value();
+        if (!value.is_int() && base->static_type() != ValueType::DOUBLE) {
+            return nullptr;
+        }
+        double exponent_value = value.to_double();
+        if (!is_reduced_power(exponent_value)) {
+            return nullptr;
+        }
+
+        int32_t n = static_cast<int32_t>(exponent_value);
+        if (n == 0) {
+            // pow(x, 0) is 1 for every x, NaN included, an int 1 for int x
+            switch (base->static_type()) {
+            case ValueType::INT: return arena.make<NumberNode>(1);
+            case ValueType::DOUBLE: return arena.make<NumberNode>(1.0);
+            default: return arena.make<IntegerPowerNode>(base, 0);
+            }
+        }
+        if (n == 1) {
+            return base;
+        }
+        if (n == 2 && is_leaf(base)) {
+            return arena.make<BinaryOperationNode>(base, base, '*');
+        }
+        return arena.make<IntegerPowerNode>(base, n);
+    }
+
+    Node* optimize_relational(Node* left, Node* right, char operation) {
+        if (is_number(left) && is_number(right)) {
+            return fold(RelationalOperationNode(left, right, operation));
+        }
+
+        // Expressions have no side effects, so a decided && / || can drop the other operand, unless that
+        // could be a vector, which would make the answer a whole vector of 0s or 1s
+        if (operation == '&' && ((is_number(left) && !left->evaluate().is_true() && is_scalar(right))
+            || (is_number(right) && !right->evaluate().is_true() && is_scalar(left)))) {
+            return rewrite(arena.make<NumberNode>(0));
+        }
+        if (operation == '|' && ((is_number(left) && left->evaluate().is_true() && is_scalar(right))
+            || (is_number(right) && right->evaluate().is_true() && is_scalar(left)))) {
+            return rewrite(arena.make<NumberNode>(1));
+        }
+        return arena.make<RelationalOperationNode>(left, right, operation);
+    }
+
+    // The body is optimized in the function's own arena, then checked for what its calls can get away with
+    void define(Function* function) {
+        Optimizer body(function->nodes);
+        function->body = body.optimize(function->body);
+        rewrites += body.get_rewrites();
+        function->pure = is_pure(function->body, function);
+        function->inlinable = function->pure && !function->recursive && expression_size(function->body) <= max_inline_nodes;
+    }
+
+    /*
+        The callee's body with the arguments in place of its parameters. Only pure bodies are inlined, so
+        nothing can change between the arguments being worked out and being used. An argument that isn't
+        a number or variable has to be pure and used exactly once, so nothing gets dropped or done twice.
+    */
+    Node* inline_call(const Function& function, const std::vector<Node*>& arguments) {
+        if (!function.inlinable) {
+            return nullptr;
+        }
+        for (size_t i = 0; i < arguments.size(); i++) {
+            if (!is_leaf(arguments[i]) && (uses(function.body, static_cast<uint32_t>(i)) != 1 || !is_pure(arguments[i], nullptr))) {
+                return nullptr;
+            }
+        }
+        return optimize(substitute(function.body, arguments));
+    }
+
+    // No prints and no stores to globals, and calls only to functions that are the same (or to `self`)
+    static bool is_pure(const Node* node, const Function* self) {
+        if (is_leaf(node)) {
+            return true;
+        }
+        if (auto* local = dynamic_cast<const LocalLetNode*>(node)) {
+            return is_pure(local->get_value(), self);
+        }
+        if (auto* block = dynamic_cast<const BlockNode*>(node)) {
+            return std::all_of(block->get_statements().begin(), block->get_statements().end(), [&](const Node* statement) { return is_pure(statement, self); });
+        }
+        if (auto* branch = dynamic_cast<const IfNode*>(node)) {
+            return is_pure(branch->get_condition(), self) && is_pure(branch->get_then(), self)
+                && (branch->get_else() == nullptr || is_pure(branch->get_else(), self));
+        }
+        if (auto* loop = dynamic_cast<const WhileNode*>(node)) {
+            return is_pure(loop->get_condition(), self) && is_pure(loop->get_body(), self);
+        }
+        if (auto* marker = dynamic_cast<const LineNode*>(node)) {
+            return is_pure(marker->get_statement(), self);
+        }
+        if (auto* call = dynamic_cast<const CallNode*>(node)) {
+            const Function* function = call->get_function();
+            return (function == self || function->pure)
+                && std::all_of(call->get_arguments().begin(), call->get_arguments().end(), [&](const Node* argument) { return is_pure(argument, self); });
+        }
+        std::vector<const Node*> operands;
+        return expression_operands(node, operands)
+            && std::all_of(operands.begin(), operands.end(), [&](const Node* operand) { return is_pure(operand, self); });
+    }
+
+    // The operands of an operator, vector or reduction. False for anything else.
+    static bool expression_operands(const Node* node, std::vector<const Node*>& operands) {
+        if (auto* unary = dynamic_cast<const UnaryOperationNode*>(node)) {
+            operands = { unary->get_operand() };
+        }
+        else if (auto* power = dynamic_cast<const IntegerPowerNode*>(node)) {
+            operands = { power->get_base() };
+        }
+        else if (auto* binary = dynamic_cast<const BinaryOperationNode*>(node)) {
+            operands = { binary->get_left(), binary->get_right() };
+        }
+        else if (auto* relational = dynamic_cast<const RelationalOperationNode*>(node)) {
+            operands = { relational->get_left(), relational->get_right() };
+        }
+        else if (auto* vector = dynamic_cast<const VectorNode*>(node)) {
+            operands.assign(vector->get_elements().begin(), vector->get_elements().end());
+        }
+        else if (auto* reduce = dynamic_cast<const ReduceNode*>(node)) {
+            operands = { reduce->get_operand() };
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    // Nodes in a body made only of expressions and calls, past max_inline_nodes as soon as there's a statement
+    static size_t expression_size(const Node* node) {
+        if (is_leaf(node)) {
+            return 1;
+        }
+        std::vector<const Node*> operands;
+        if (auto* call = dynamic_cast<const CallNode*>(node)) {
+            operands.assign(call->get_arguments().begin(), call->get_arguments().end());
+        }
+        else if (!expression_operands(node, operands)) {
+            return max_inline_nodes + 1;
+        }
+        size_t size = 1;
+        for (const Node* operand : operands) {
+            size += expression_size(operand);
+        }
+        return size;
+    }
+
+    // How often an inlinable body reads parameter `index`
+    static size_t uses(const Node* node, uint32_t index) {
+        if (auto* local = dynamic_cast<const LocalVariableNode*>(node)) {
+            return local->get_index() == index ? 1 : 0;
+        }
+        std::vector<const Node*> operands;
+        if (auto* call = dynamic_cast<const CallNode*>(node)) {
+            operands.assign(call->get_arguments().begin(), call->get_arguments().end());
+        }
+        else {
+            expression_operands(node, operands);
+        }
+        size_t count = 0;
+        for (const Node* operand : operands) {
+            count += uses(operand, index);
+        }
+        return count;
+    }
+
+    // A copy of an inlinable body in this arena with the parameters replaced. The copy shares nothing with the body.
+    Node* substitute(const Node* node, const std::vector<Node*>& arguments) {
+        if (auto* local = dynamic_cast<const LocalVariableNode*>(node)) {
+            return arguments[local->get_index()];
+        }
+        if (auto* number = dynamic_cast<const NumberNode*>(node)) {
+            return arena.make<NumberNode>(number->get_value());
+        }
+        if (auto* variable = dynamic_cast<const VariableNode*>(node)) {
+            return arena.make<VariableNode>(variable->get_env(), variable->get_slot());
+        }
+        if (auto* reactive = dynamic_cast<const ReactiveVariableNode*>(node)) {
+            return arena.make<ReactiveVariableNode>(reactive->get_env(), reactive->get_slot());
+        }
+        if (auto* unary = dynamic_cast<const UnaryOperationNode*>(node)) {
+            return arena.make<UnaryOperationNode>(substitute(unary->get_operand(), arguments), unary->get_operation());
+        }
+        if (auto* power = dynamic_cast<const IntegerPowerNode*>(node)) {
+            return arena.make<IntegerPowerNode>(substitute(power->get_base(), arguments), power->get_exponent());
+        }
+        if (auto* binary = dynamic_cast<const BinaryOperationNode*>(node)) {
+            return arena.make<BinaryOperationNode>(substitute(binary->get_left(), arguments), substitute(binary->get_right(), arguments), binary->get_operation());
+        }
+        if (auto* relational = dynamic_cast<const RelationalOperationNode*>(node)) {
+            return arena.make<RelationalOperationNode>(substitute(relational->get_left(), arguments), substitute(relational->get_right(), arguments), relational->get_operation());
+        }
+        if (auto* reduce = dynamic_cast<const ReduceNode*>(node)) {
+            return arena.make<ReduceNode>(substitute(reduce->get_operand(), arguments), reduce->get_operation());
+        }
+        std::vector<Node*> operands;
+        if (auto* vector = dynamic_cast<const VectorNode*>(node)) {
+            for (const Node* element : vector->get_elements()) {
+                operands.push_back(substitute(element, arguments));
+            }
+            return arena.make<VectorNode>(std::move(operands));
+        }
+        auto* call = dynamic_cast<const CallNode*>(node);
+        if (call == nullptr) {
+            throw std::logic_error("Only expressions get inlined");
+        }
+        for (const Node* argument : call->get_arguments()) {
+            operands.push_back(substitute(argument, arguments));
+        }
+        return arena.make<CallNode>(call->get_function(), std::move(operands));
+    }
+
+    static constexpr size_t max_inline_nodes = 24;
+
+    Arena& arena;
+    size_t rewrites = 0;
+};
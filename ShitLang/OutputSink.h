@@ -0,0 +1,190 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <charconv>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "Value.h"
+#include "MemoryStats.h"
+
+/*
+    Where `print` writes to.
+    Output collects in one big buffer and goes out in a single fwrite when the buffer fills up, when flush()
+    is called or when the sink is destroyed (the standard sink is destroyed at exit). Line-buffered mode
+    flushes after every line instead, for interactive use. Numbers are formatted with std::to_chars, which
+    gives the shortest text that reads back as the exact same double, and every digit of an int.
+    A sink can also collect into a string instead of a file, which is how the script runner keeps the
+    output of scripts running side by side from mixing.
+*/
+class OutputSink {
+public:
+    enum class Mode {
+        Buffered,
+        LineBuffered,
+    };
+
+    static constexpr size_t default_capacity = 64 * 1024;
+
+    explicit OutputSink(std::FILE* file, size_t capacity = default_capacity, Mode mode = Mode::Buffered)
+        : file(file), mode(mode) {
+        set_capacity(capacity);
+    }
+
+    /* Appends everything to `target` instead of writing it out, `target` has to outlive the sink */
+    explicit OutputSink(std::string* target, size_t capacity = default_capacity)
+        : target(target), mode(Mode::Buffered) {
+        set_capacity(capacity);
+    }
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    ~OutputSink() {
+        flush();
+    }
+
+    void write_number(double value) {
+        reserve(max_number_length + 1);
+        std::to_chars_result result = std::to_chars(buffer.get() + size, buffer.get() + capacity, value);
+        size = result.ptr - buffer.get();
+        buffer[size++] = '\n';
+        end_line();
+    }
+
+    void write_value(const Value& value) {
+        if (value.is_vector()) {
+            write_vector(*value.vector);
+            return;
+        }
+        if (!value.is_int()) {
+            write_number(value.number);
+            return;
+        }
+        reserve(max_number_length + 1);
+        std::to_chars_result result = std::to_chars(buffer.get() + size, buffer.get() + capacity, value.integer);
+        size = result.ptr - buffer.get();
+        buffer[size++] = '\n';
+        end_line();
+    }
+
+    /* `[1, 2.5, 3]`, every element the same way write_number would print it */
+    void write_vector(const Vector& vector) {
+        reserve(2);
+        buffer[size++] = '[';
+        for (size_t i = 0; i < vector.size(); i++) {
+            reserve(max_number_length + 3);
+            if (i > 0) {
+                buffer[size++] = ',';
+                buffer[size++] = ' ';
+            }
+            std::to_chars_result result = std::to_chars(buffer.get() + size, buffer.get() + capacity, vector.data()[i]);
+            size = result.ptr - buffer.get();
+        }
+        reserve(2);
+        buffer[size++] = ']';
+        buffer[size++] = '\n';
+        end_line();
+    }
+
+    void write(std::string_view text) {
+        if (text.size() > capacity) {
+            // Bigger than the whole buffer, no point copying it
+            flush_buffer();
+            emit(text.data(), text.size());
+        }
+        else {
+            reserve(text.size());
+            std::memcpy(buffer.get() + size, text.data(), text.size());
+            size += text.size();
+        }
+        if (text.find('\n') != std::string_view::npos) {
+            end_line();
+        }
+    }
+
+    void flush() {
+        flush_buffer();
+        if (file) {
+            std::fflush(file);
+        }
+    }
+
+    void set_mode(Mode new_mode) {
+        mode = new_mode;
+        if (mode == Mode::LineBuffered) {
+            flush();
+        }
+    }
+
+    void set_capacity(size_t new_capacity) {
+        flush_buffer();
+        capacity = new_capacity < min_capacity ? min_capacity : new_capacity;
+        MemoryStats::CategoryScope memory(MemoryStats::OUTPUT);
+        buffer = std::make_unique<char[]>(capacity);
+    }
+
+    /* Process-wide sink for stdout, flushed when the program exits */
+    static OutputSink& standard() {
+        static OutputSink sink(stdout);
+        return sink;
+    }
+
+    /* The sink `print` uses on this thread, the standard one unless set_current() swapped it */
+    static OutputSink& current() {
+        OutputSink* sink = current_slot();
+        return sink ? *sink : standard();
+    }
+
+    static void set_current(OutputSink* sink) {
+        current_slot() = sink;
+    }
+
+private:
+    // Longest thing to_chars can produce for a double, "-1.7976931348623157e+308" and friends
+    static constexpr size_t max_number_length = 32;
+    static constexpr size_t min_capacity = 256;
+
+    static OutputSink*& current_slot() {
+        thread_local OutputSink* sink = nullptr;
+        return sink;
+    }
+
+    void reserve(size_t bytes) {
+        if (size + bytes > capacity) {
+            flush_buffer();
+        }
+    }
+
+    void end_line() {
+        if (mode == Mode::LineBuffered) {
+            flush();
+        }
+    }
+
+    void flush_buffer() {
+        if (size > 0) {
+            emit(buffer.get(), size);
+            size = 0;
+        }
+    }
+
+    void emit(const char* data, size_t length) {
+        if (target) {
+            MemoryStats::CategoryScope memory(MemoryStats::OUTPUT);
+            target->append(data, length);
+        }
+        else {
+            std::fwrite(data, 1, length, file);
+        }
+    }
+
+    std::FILE* file = nullptr;
+    std::string* target = nullptr;
+    std::unique_ptr<char[]> buffer;
+    size_t capacity = 0;
+    size_t size = 0;
+    Mode mode;
+};
@@ -1,6 +1,6 @@
 #include "Parser.h"
 
-void Parser::set_variables(std::map<std::string, double>* var_map)
+void Parser::set_variables(Environment* var_env)
 {
-	variables = var_map;
+	variables = var_env;
 }
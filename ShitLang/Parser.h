@@ -2,30 +2,85 @@
 
 #include "Token.h"
 #include "Node.h"
+#include "Arena.h"
+#include "Environment.h"
 #include <vector>
-
-#include <map>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <algorithm>
+#include <charconv>
 
 class Parser {
-    std::vector<Token> tokens;
+    const std::vector<Token>& tokens; // Read in place, the caller keeps them (and their source text) alive
     size_t position = 0;
+    size_t statement_start = 0;
 
 public:
-    explicit Parser(const std::vector<Token>& tokens, std::map<std::string, double>* var_map) : tokens(tokens), variables(var_map) {}
+    // Every node is allocated from `arena`, so the returned tree lives until the arena is reset
+    // Variable names are resolved to slots in `var_env` while parsing, nothing is looked up by name at runtime
+    explicit Parser(const std::vector<Token>& tokens, Environment* var_env, Arena& arena) : tokens(tokens), arena(&arena), variables(var_env) {}
 
     Node* parse() {
-        Node* result = nullptr;
-        while (position < tokens.size()) {
-            result = parseStatement();
+        std::vector<Node*> statements;
+        while (Node* statement = parse_next()) {
+            statements.push_back(statement);
+        }
+        if (statements.empty()) {
+            return nullptr;
+        }
+        if (statements.size() == 1) {
+            return statements.front(); // Owned by the arena, never delete it
+        }
+        return arena->make<BlockNode>(std::move(statements));
+    }
+
+
+    /* One statement at a time, nullptr once the tokens run out. What parse() is made of. */
+    Node* parse_next() {
+        if (position >= tokens.size()) {
+            return nullptr;
         }
-        return result; // Be cautious with memory management here
+        statement_start = position;
+        return parseStatement();
     }
 
+    void set_variables(Environment* var_env);
 
-    void set_variables(std::map<std::string, double>* var_map);
+    /*
+        Wraps every statement in a LineNode with its line in `source` (numbered from `first_line`),
+        for the --profile per-line report. Off unless asked for, so normal runs carry no markers.
+    */
+    void track_lines(std::string_view source, uint32_t first_line) {
+        line_source = source;
+        line_offset = 0;
+        current_line = first_line;
+        tracking_lines = true;
+    }
+
+    /*
+        Names that are used without a `let` become inputs instead of errors, declared on first use.
+        This is what prepared expressions are parsed with, their inputs get bound at every evaluation.
+    */
+    void allow_free_variables() {
+        free_variables = true;
+    }
+
+    /* Slots of the names allow_free_variables() let through, in the order they first showed up */
+    const std::vector<uint32_t>& get_free_variables() const {
+        return free_slots;
+    }
+
+    /* Index of the first token of the statement being parsed, useful for pointing at errors */
+    size_t get_statement_position() const {
+        return statement_start;
+    }
 
 private:
-    Token& currentToken() {
+    const Token& currentToken() const {
+        if (position >= tokens.size()) {
+            throw std::runtime_error("Unexpected end of input");
+        }
         return tokens[position];
     }
 
@@ -39,13 +94,47 @@ private:
     }
 
     Node* parseStatement() {
+        if (tracking_lines) {
+            uint32_t line = lineOf(currentToken());
+            Node* statement = parseBareStatement();
+            return arena->make<LineNode>(line, statement);
+        }
+        return parseBareStatement();
+    }
+
+    // Statements come in source order, so the newline count only ever moves forward
+    uint32_t lineOf(const Token& token) {
+        size_t offset = token.get_offset(line_source);
+        if (offset > line_offset) {
+            current_line += static_cast<uint32_t>(std::count(line_source.begin() + line_offset, line_source.begin() + offset, '\n'));
+            line_offset = offset;
+        }
+        return current_line;
+    }
+
+    Node* parseBareStatement() {
         if (currentToken().get_type() == LET) {
             return parseVariableDeclaration();
         }
         else if (currentToken().get_type() == PRINT) {
             eatToken(PRINT);
             Node* expr = parseExpression();
-            return new PrintNode(expr);
+            return arena->make<PrintNode>(expr);
+        }
+        else if (currentToken().get_type() == IF) {
+            return parseIf();
+        }
+        else if (currentToken().get_type() == FN) {
+            return parseFunction();
+        }
+        else if (currentToken().get_type() == WHILE) {
+            eatToken(WHILE);
+            Node* condition = parseExpression();
+            Node* body = parseBlock();
+            return arena->make<WhileNode>(condition, body);
+        }
+        else if (currentToken().get_type() == VARIABLE && position + 1 < tokens.size() && tokens[position + 1].get_type() == ASSIGN) {
+            return parseAssignment();
         }
         else {
             return parseExpression(); // For cases that are not variable declarations
@@ -54,35 +143,166 @@ private:
 
     Node* parseVariableDeclaration() {
         eatToken(LET); // Consume the 'LET' token
-        std::string varName = std::any_cast<std::string>(currentToken().get_value());
+        std::string_view varName = currentToken().get_text();
         eatToken(VARIABLE); // Consume the variable name token
+        if (currentToken().get_type() == BIND) {
+            return parseReactive(varName);
+        }
 
         eatToken(ASSIGN); // Consume the '=' token
 
         // Now expect an expression for the variable value
         Node* value = parseExpression();
 
-        // Assuming you have a method to update your variables map
-        if (variables->find(varName) == variables->end()) {
-            (*variables)[varName] = value->evaluate(); // Evaluate the expression and store the result
+        // Declared after the value is parsed, so `let x = x` is still an undefined variable
+        if (scope) {
+            if (scope->find(varName) != Environment::npos) {
+                throw std::runtime_error("Variable redeclaration: " + std::string(varName));
+            }
+            scope->locals.push_back(varName);
+            return arena->make<LocalLetNode>(static_cast<uint32_t>(scope->locals.size() - 1), value);
+        }
+        uint32_t slot = variables->declare(varName);
+        return arena->make<LetNode>(variables, slot, value);
+    }
+
+
+    // `let y := expression`, the expression is kept and worked out again when what it reads changes
+    Node* parseReactive(std::string_view name) {
+        eatToken(BIND);
+        if (scope) {
+            throw std::runtime_error("Reactive variables have to be globals: " + std::string(name));
+        }
+
+        std::shared_ptr<Reactive> reactive = std::make_shared<Reactive>(name);
+        Arena* outer = arena;
+        arena = &reactive->nodes;
+        reactive_inputs = &reactive->inputs;
+        try {
+            reactive->expression = parseExpression();
+        }
+        catch (...) {
+            arena = outer;
+            reactive_inputs = nullptr;
+            throw;
+        }
+        arena = outer;
+        reactive_inputs = nullptr;
+
+        // Declared after the expression is parsed, like any `let`, so it can't read itself
+        reactive->slot = variables->declare(name);
+        Reactive* bound = reactive.get();
+        variables->bind(std::move(reactive));
+        return arena->make<ReactiveLetNode>(bound);
+    }
+
+    Node* parseAssignment() {
+        uint32_t local = localSlot(currentToken().get_text());
+        if (local != Environment::npos) {
+            eatToken(VARIABLE);
+            eatToken(ASSIGN);
+            return arena->make<LocalLetNode>(local, parseExpression());
+        }
+        uint32_t slot = resolveVariable(currentToken().get_text()); // Only declared variables can be reassigned
+        if (variables->is_reactive(slot)) {
+            throw std::runtime_error("Can't assign to reactive variable: " + std::string(currentToken().get_text()));
+        }
+        eatToken(VARIABLE);
+        eatToken(ASSIGN);
+        Node* value = parseExpression();
+        return arena->make<LetNode>(variables, slot, value);
+    }
+
+    // `fn name(a, b) = expression` or `fn name(a, b) { ... }`
+    Node* parseFunction() {
+        eatToken(FN);
+        if (scope) {
+            throw std::runtime_error("Functions can't be defined inside functions");
         }
-        else {
-            throw std::runtime_error("Variable redeclaration: " + varName);
+        std::string_view name = currentToken().get_text();
+        eatToken(VARIABLE);
+        if (builtinOperation(name) != 0) {
+            throw std::runtime_error("Can't redefine builtin function: " + std::string(name));
+        }
+
+        FunctionScope function_scope;
+        eatToken(LPAREN);
+        while (currentToken().get_type() != RPAREN) {
+            std::string_view parameter = currentToken().get_text();
+            eatToken(VARIABLE);
+            if (function_scope.find(parameter) != Environment::npos) {
+                throw std::runtime_error("Duplicate parameter: " + std::string(parameter));
+            }
+            function_scope.locals.push_back(parameter);
+            if (currentToken().get_type() != COMMA) {
+                break;
+            }
+            eatToken(COMMA);
+        }
+        eatToken(RPAREN);
+
+        // Defined before the body is parsed, so the body can call it
+        std::shared_ptr<Function> defined = std::make_shared<Function>(name, static_cast<uint32_t>(function_scope.locals.size()));
+        Function* function = defined.get();
+        variables->define(std::move(defined));
+        function_scope.function = function;
+
+        Arena* outer = arena;
+        arena = &function->nodes;
+        scope = &function_scope;
+        try {
+            if (currentToken().get_type() == ASSIGN) {
+                eatToken(ASSIGN);
+                function->body = parseExpression();
+            }
+            else {
+                function->body = parseBlock();
+            }
         }
+        catch (...) {
+            arena = outer;
+            scope = nullptr;
+            throw;
+        }
+        arena = outer;
+        scope = nullptr;
 
-        delete value; // Clean up the expression node
-        return new NoOpNode(); // Or any other way you signify a non-evaluative result
+        function->locals = static_cast<uint32_t>(function_scope.locals.size());
+        return arena->make<FunctionNode>(function);
     }
 
+    Node* parseIf() {
+        eatToken(IF);
+        Node* condition = parseExpression();
+        Node* then_branch = parseBlock();
+        Node* else_branch = nullptr;
+
+        if (position < tokens.size() && currentToken().get_type() == ELSE) {
+            eatToken(ELSE);
+            // `else if` chains without needing another pair of braces
+            else_branch = currentToken().get_type() == IF ? parseIf() : parseBlock();
+        }
+        return arena->make<IfNode>(condition, then_branch, else_branch);
+    }
+
+    Node* parseBlock() {
+        eatToken(LBRACE);
+        std::vector<Node*> statements;
+        while (currentToken().get_type() != RBRACE) {
+            statements.push_back(parseStatement());
+        }
+        eatToken(RBRACE);
+        return arena->make<BlockNode>(std::move(statements));
+    }
 
     Node* parseExpression() {
         Node* node = parseTerm(); // Start with the highest precedence operations
 
         while (position < tokens.size() &&
                 (currentToken().get_type() == PLUS || currentToken().get_type() == MINUS ||
-                currentToken().get_type() == GREATER_THAN || currentToken().get_type() == LESS_THAN) || 
+                currentToken().get_type() == GREATER_THAN || currentToken().get_type() == LESS_THAN ||
                 currentToken().get_type() == GREATER_THAN_EQ || currentToken().get_type() == LESS_THAN_EQ ||
-                currentToken().get_type() == EQEQ || currentToken().get_type() == AND || currentToken().get_type() == OR) {
+                currentToken().get_type() == EQEQ || currentToken().get_type() == AND || currentToken().get_type() == OR)) {
             TokenType opType = currentToken().get_type();
             eatToken(opType);
 
@@ -92,7 +312,7 @@ private:
             // Now differentiate between arithmetic and relational operations
             if (opType == PLUS || opType == MINUS) {
                 char op = opType == PLUS ? '+' : '-';
-                node = new BinaryOperationNode(node, right, op); // Existing arithmetic node
+                node = arena->make<BinaryOperationNode>(node, right, op); // Existing arithmetic node
             }
             else if (opType == GREATER_THAN || opType == LESS_THAN || opType == GREATER_THAN_EQ || opType == LESS_THAN_EQ || opType == EQEQ || opType == AND || opType == OR) {
                 // char op = opType == GREATER_THAN ? '>' : '<';
@@ -106,7 +326,7 @@ private:
                 case AND:               op = '&'; break;
                 case OR:                op = '|'; break;
                 }
-                node = new RelationalOperationNode(node, right, op); // New relational node
+                node = arena->make<RelationalOperationNode>(node, right, op); // New relational node
             }
         }
 
@@ -121,33 +341,74 @@ private:
             eatToken(opType); // Now we consume the token correctly before creating the node
             Node* right = parseFactor(); // Parse the right-hand side of the operation
             if (opType == EXPONENT) {
-                node = new BinaryOperationNode(node, right, '^'); // Handle exponentiation
+                node = arena->make<BinaryOperationNode>(node, right, '^'); // Handle exponentiation
             }
             else {
                 char op = opType == MULT ? '*' : '/';
-                node = new BinaryOperationNode(node, right, op);
+                node = arena->make<BinaryOperationNode>(node, right, op);
             }
         }
         return node;
     }
 
 
+    // Frame slot of a parameter or local of the function being parsed, npos for a global
+    uint32_t localSlot(std::string_view name) const {
+        return scope ? scope->find(name) : Environment::npos;
+    }
+
+    uint32_t resolveVariable(std::string_view name) {
+        uint32_t slot;
+        if (free_variables && variables->find(name) == nullptr) {
+            slot = variables->declare(name);
+            free_slots.push_back(slot);
+        }
+        else {
+            slot = variables->resolve(name);
+        }
+        if (reactive_inputs && std::find(reactive_inputs->begin(), reactive_inputs->end(), slot) == reactive_inputs->end()) {
+            reactive_inputs->push_back(slot);
+        }
+        return slot;
+    }
+
+    // Integer literals are read again from the text so nothing past 2^53 is lost, ones too big for an int stay doubles
+    static Value literalValue(const Token& token) {
+        if (token.get_type() == INTEGER) {
+            std::string_view text = token.get_text();
+            int64_t integer;
+            std::from_chars_result result = std::from_chars(text.data(), text.data() + text.size(), integer);
+            if (result.ec == std::errc() && result.ptr == text.data() + text.size()) {
+                return integer;
+            }
+        }
+        return token.get_number();
+    }
+
     Node* parseFactor() {
         if (currentToken().get_type() == INTEGER || currentToken().get_type() == FLOAT) {
-            double value = std::any_cast<double>(currentToken().get_value());
+            Value value = literalValue(currentToken());
             eatToken(currentToken().get_type());
-            return new NumberNode(value);
+            return arena->make<NumberNode>(value);
+        }
+        else if (currentToken().get_type() == VARIABLE && position + 1 < tokens.size() && tokens[position + 1].get_type() == LPAREN) {
+            return parseCall();
+        }
+        else if (currentToken().get_type() == LBRACKET) {
+            return parseVector();
+        }
+        else if (currentToken().get_type() == VARIABLE && localSlot(currentToken().get_text()) != Environment::npos) {
+            uint32_t local = localSlot(currentToken().get_text());
+            eatToken(VARIABLE);
+            return arena->make<LocalVariableNode>(local);
         }
         else if (currentToken().get_type() == VARIABLE) {
-            std::string varName = std::any_cast<std::string>(currentToken().get_value());
-            if (variables && variables->find(varName) != variables->end()) {
-                double value = (*variables)[varName];
-                eatToken(VARIABLE);
-                return new NumberNode(value);
-            }
-            else {
-                throw std::runtime_error("Undefined variable: " + varName);
+            uint32_t slot = resolveVariable(currentToken().get_text()); // Throws for undefined variables
+            eatToken(VARIABLE);
+            if (variables->is_reactive(slot)) {
+                return arena->make<ReactiveVariableNode>(variables, slot);
             }
+            return arena->make<VariableNode>(variables, slot);
         }
         else if (currentToken().get_type() == LPAREN) {
             eatToken(LPAREN);
@@ -161,7 +422,108 @@ private:
         }
     }
 
+    // `[a, b, c]`, a trailing comma is fine
+    Node* parseVector() {
+        eatToken(LBRACKET);
+        std::vector<Node*> elements;
+        while (currentToken().get_type() != RBRACKET) {
+            elements.push_back(parseExpression());
+            if (currentToken().get_type() != COMMA) {
+                break;
+            }
+            eatToken(COMMA);
+        }
+        eatToken(RBRACKET);
+        return arena->make<VectorNode>(std::move(elements));
+    }
+
+    // The ReduceNode operation for a builtin, 0 for any other name
+    static char builtinOperation(std::string_view name) {
+        if (name == "sum") {
+            return '+';
+        }
+        if (name == "min") {
+            return '<';
+        }
+        if (name == "max") {
+            return '>';
+        }
+        return 0;
+    }
+
+    // Function names are only names when they're called, so `let sum = 0` still works
+    Node* parseCall() {
+        std::string_view name = currentToken().get_text();
+        char operation = builtinOperation(name);
+        if (operation != 0) {
+            eatToken(VARIABLE);
+            eatToken(LPAREN);
+            Node* operand = parseExpression();
+            eatToken(RPAREN);
+            return arena->make<ReduceNode>(operand, operation);
+        }
+
+        Function* function = variables->find_function(name);
+        if (function == nullptr) {
+            throw std::runtime_error("Unknown function: " + std::string(name));
+        }
+        if (reactive_inputs) {
+            // What a function reads isn't known from its call, so the graph couldn't tell when to recompute
+            throw std::runtime_error("Reactive variables can only use builtin functions, not " + std::string(name));
+        }
+        eatToken(VARIABLE);
+        eatToken(LPAREN);
+        std::vector<Node*> arguments;
+        while (currentToken().get_type() != RPAREN) {
+            arguments.push_back(parseExpression());
+            if (currentToken().get_type() != COMMA) {
+                break;
+            }
+            eatToken(COMMA);
+        }
+        eatToken(RPAREN);
+        if (arguments.size() != function->arity) {
+            throw std::runtime_error(std::string(name) + " takes " + std::to_string(function->arity) + (function->arity == 1 ? " argument, not " : " arguments, not ")
+                + std::to_string(arguments.size()));
+        }
+        if (scope && scope->function == function) {
+            function->recursive = true;
+        }
+        return arena->make<CallNode>(function, std::move(arguments));
+    }
+
+    Arena* arena; // The parse's arena, or the function's own while a body is parsed
+
     // variables
-    std::map<std::string, double>* variables = nullptr;
+    Environment* variables = nullptr;
+
+    // The function whose body is being parsed, its parameters and `let`s are found before any global
+    struct FunctionScope {
+        Function* function = nullptr;
+        std::vector<std::string_view> locals;
+
+        uint32_t find(std::string_view name) const {
+            for (size_t i = 0; i < locals.size(); i++) {
+                if (locals[i] == name) {
+                    return static_cast<uint32_t>(i);
+                }
+            }
+            return Environment::npos;
+        }
+    };
+    FunctionScope* scope = nullptr;
+
+    // The inputs of the `let :=` whose expression is being parsed, every global it reads goes in here
+    std::vector<uint32_t>* reactive_inputs = nullptr;
+
+    // prepared expression inputs
+    bool free_variables = false;
+    std::vector<uint32_t> free_slots;
+
+    // --profile line tracking
+    bool tracking_lines = false;
+    std::string_view line_source;
+    size_t line_offset = 0;
+    uint32_t current_line = 0;
 
 };
@@ -0,0 +1,90 @@
+#include "Prepared.h"
+
+#include <stdexcept>
+
+#include "Tokenizer.h"
+#include "Parser.h"
+#include "Optimizer.h"
+#include "Interpreter.h"
+
+std::shared_ptr<const PreparedExpression> PreparedExpression::compile(std::string_view source, bool optimize) {
+    std::shared_ptr<PreparedExpression> prepared(new PreparedExpression());
+
+    Environment variables;
+    Tokenizer toker(source, &variables);
+    std::vector<Token> tokens = toker.tokenize();
+
+    Arena arena;
+    Parser parser(tokens, &variables, arena);
+    parser.allow_free_variables();
+    Node* root = parser.parse();
+    if (root == nullptr) {
+        throw std::invalid_argument("Nothing to compile");
+    }
+    if (!variables.get_reactives().empty()) {
+        // Every evaluation starts from fresh slots, so there'd be nothing for them to react to
+        throw std::invalid_argument("Prepared expressions can't have reactive variables");
+    }
+    if (optimize) {
+        root = Optimizer(arena).optimize(root);
+    }
+
+    prepared->chunk = compile_program(root);
+    prepared->slot_count = static_cast<uint32_t>(variables.size());
+    prepared->input_slots = parser.get_free_variables();
+    for (uint32_t slot : prepared->input_slots) {
+        prepared->inputs.emplace_back(variables.name_of(slot));
+    }
+    return prepared;
+}
+
+int PreparedExpression::input_index(std::string_view name) const {
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if (inputs[i] == name) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+// Every call needs its own variables and stack, the thread_local ones just save the allocations
+template <typename T>
+static Value run_prepared(const Chunk& chunk, const std::vector<uint32_t>& input_slots, uint32_t slot_count,
+    const T* values, size_t count) {
+    if (count != input_slots.size()) {
+        throw std::invalid_argument("Expected " + std::to_string(input_slots.size()) + " inputs, got " + std::to_string(count));
+    }
+
+    thread_local VM vm;
+    thread_local std::vector<Value> slots;
+    slots.assign(slot_count, Value());
+    for (size_t i = 0; i < count; i++) {
+        slots[input_slots[i]] = values[i];
+    }
+    return vm.run(chunk, slots.data());
+}
+
+double PreparedExpression::evaluate(const double* values, size_t count) const {
+    Value result = run_prepared(chunk, input_slots, slot_count, values, count);
+    if (result.is_vector()) {
+        throw std::invalid_argument("Expression gives a vector, not a number");
+    }
+    return result.to_double();
+}
+
+Value PreparedExpression::evaluate(const Value* values, size_t count) const {
+    return run_prepared(chunk, input_slots, slot_count, values, count);
+}
+
+double PreparedExpression::evaluate(const std::unordered_map<std::string, double>& bindings) const {
+    thread_local std::vector<double> values;
+    values.resize(inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+        auto found = bindings.find(inputs[i]);
+        if (found == bindings.end()) {
+            throw std::invalid_argument("Unbound variable: " + inputs[i]);
+        }
+        values[i] = found->second;
+    }
+    return evaluate(values.data(), values.size());
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <initializer_list>
+
+#include "Chunk.h"
+#include "Value.h"
+
+/*
+    A formula compiled once and evaluated as many times as you like, for embedding ShitLang in a host program.
+    Any name the source uses without a `let` is an input, e.g. `a * x ^ 2 + b` has inputs a, x and b.
+    After compile() nothing about it ever changes, so one PreparedExpression can be evaluated from any
+    number of threads at once: every call gets its own variables and its own VM stack.
+
+        auto area = PreparedExpression::compile("w * h");
+        double a = area->evaluate({ 3, 4 });                          // inputs in get_inputs() order
+        double b = area->evaluate({ { "w", 3 }, { "h", 4 } });        // or by name
+
+    Inputs given as doubles are doubles. Pass Values to get the exact integer arithmetic scripts get.
+*/
+class PreparedExpression {
+public:
+    /* Throws std::runtime_error / std::invalid_argument for anything that doesn't parse */
+    static std::shared_ptr<const PreparedExpression> compile(std::string_view source, bool optimize = true);
+
+    /* Input names, in the order evaluate() takes their values */
+    const std::vector<std::string>& get_inputs() const {
+        return inputs;
+    }
+
+    /* Index of `name` in get_inputs(), or -1 */
+    int input_index(std::string_view name) const;
+
+    /* `values` holds one value per input, in get_inputs() order */
+    double evaluate(const double* values, size_t count) const;
+
+    Value evaluate(const Value* values, size_t count) const;
+
+    double evaluate(std::initializer_list<double> values) const {
+        return evaluate(values.begin(), values.size());
+    }
+
+    double evaluate(const std::vector<double>& values) const {
+        return evaluate(values.data(), values.size());
+    }
+
+    /* Binds inputs by name, throws if one of them is missing */
+    double evaluate(const std::unordered_map<std::string, double>& bindings) const;
+
+    const Chunk& get_chunk() const {
+        return chunk;
+    }
+
+private:
+    PreparedExpression() = default;
+
+    Chunk chunk;
+    std::vector<std::string> inputs;
+    std::vector<uint32_t> input_slots;
+    uint32_t slot_count = 0;
+};
@@ -0,0 +1,137 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+
+const char* Profiler::phase_name(Phase phase) {
+    switch (phase) {
+    case TOKENIZE: return "tokenize";
+    case PARSE:    return "parse";
+    case OPTIMIZE: return "optimize";
+    case COMPILE:  return "compile";
+    case EXECUTE:  return "execute";
+    default:       return "unknown";
+    }
+}
+
+uint32_t Profiler::add_source(std::string_view source) {
+    // Only a prefix of each line is kept, enough to recognise it in the report
+    const size_t max_text = 60;
+
+    uint32_t first = static_cast<uint32_t>(lines.size());
+    size_t start = 0;
+    while (start <= source.size()) {
+        size_t end = source.find('\n', start);
+        if (end == std::string_view::npos) {
+            end = source.size();
+        }
+
+        std::string_view line = source.substr(start, end - start);
+        size_t indent = line.find_first_not_of(" \t\r");
+        line = indent == std::string_view::npos ? std::string_view() : line.substr(indent);
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+            line.remove_suffix(1);
+        }
+
+        LineStats stats;
+        stats.text = std::string(line.substr(0, max_text));
+        lines.push_back(std::move(stats));
+
+        // A trailing newline doesn't start another line, so REPL entries number on from each other
+        if (end + 1 >= source.size()) {
+            break;
+        }
+        start = end + 1;
+    }
+    return first;
+}
+
+uint64_t Profiler::statements_executed() const {
+    uint64_t total = 0;
+    for (const LineStats& line : lines) {
+        total += line.count;
+    }
+    return total;
+}
+
+void Profiler::report(std::ostream& out, size_t max_lines) const {
+    char row[160];
+
+    out << "\n=== profile ===\n";
+    std::snprintf(row, sizeof(row), "%-10s %12s %14s %8s\n", "phase", "time (ms)", "items", "runs");
+    out << row;
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        const PhaseStats& stats = phases[phase];
+        std::snprintf(row, sizeof(row), "%-10s %12.3f %14llu %8llu\n", phase_name(static_cast<Phase>(phase)),
+            stats.seconds * 1e3, static_cast<unsigned long long>(stats.count), static_cast<unsigned long long>(stats.runs));
+        out << row;
+    }
+
+    std::vector<uint32_t> hot;
+    for (uint32_t line = 1; line < lines.size(); line++) {
+        if (lines[line].count > 0) {
+            hot.push_back(line);
+        }
+    }
+    if (hot.empty()) {
+        return;
+    }
+
+    std::sort(hot.begin(), hot.end(), [&](uint32_t a, uint32_t b) {
+        return lines[a].seconds != lines[b].seconds ? lines[a].seconds > lines[b].seconds : a < b;
+    });
+
+    out << "\nhottest lines:\n";
+    std::snprintf(row, sizeof(row), "%6s %12s %12s  %s\n", "line", "count", "time (ms)", "source");
+    out << row;
+    for (size_t i = 0; i < hot.size() && i < max_lines; i++) {
+        const LineStats& stats = lines[hot[i]];
+        std::snprintf(row, sizeof(row), "%6u %12llu %12.3f  ", hot[i], static_cast<unsigned long long>(stats.count), stats.seconds * 1e3);
+        out << row << stats.text << "\n";
+    }
+}
+
+static void write_json_string(std::ostream& out, const std::string& text) {
+    out << '"';
+    for (char c : text) {
+        switch (c) {
+        case '"':  out << "\\\""; break;
+        case '\\': out << "\\\\"; break;
+        case '\t': out << "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out << escaped;
+            }
+            else {
+                out << c;
+            }
+        }
+    }
+    out << '"';
+}
+
+void Profiler::write_json(std::ostream& out) const {
+    out << "{\n  \"phases\": [";
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        const PhaseStats& stats = phases[phase];
+        out << (phase ? ",\n" : "\n") << "    { \"name\": \"" << phase_name(static_cast<Phase>(phase))
+            << "\", \"seconds\": " << stats.seconds << ", \"count\": " << stats.count << ", \"runs\": " << stats.runs << " }";
+    }
+    out << "\n  ],\n  \"lines\": [";
+
+    bool first = true;
+    for (uint32_t line = 1; line < lines.size(); line++) {
+        const LineStats& stats = lines[line];
+        if (stats.count == 0) {
+            continue;
+        }
+        out << (first ? "\n" : ",\n") << "    { \"line\": " << line << ", \"count\": " << stats.count
+            << ", \"seconds\": " << stats.seconds << ", \"source\": ";
+        write_json_string(out, stats.text);
+        out << " }";
+        first = false;
+    }
+    out << "\n  ]\n}\n";
+}
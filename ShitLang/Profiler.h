@@ -0,0 +1,117 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+
+#include "MemoryStats.h"
+
+/*
+    Collects what --profile reports: wall time and item counts for each phase of the interpreter,
+    plus how often each source line ran and how long was spent on it.
+    Line data only exists when the parser was asked to track lines, which wraps statements in
+    LineNodes that compile to OP_LINE; without --profile none of that is emitted.
+*/
+class Profiler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum Phase {
+        TOKENIZE,
+        PARSE,
+        OPTIMIZE,
+        COMPILE,
+        EXECUTE,
+        PHASE_COUNT
+    };
+
+    struct PhaseStats {
+        double seconds = 0;
+        uint64_t count = 0; // tokens, nodes, bytecode bytes or statements depending on the phase
+        uint64_t runs = 0;
+    };
+
+    struct LineStats {
+        uint64_t count = 0;
+        double seconds = 0;
+        std::string text;
+    };
+
+    static const char* phase_name(Phase phase);
+
+    void add_phase(Phase phase, double seconds, uint64_t count) {
+        phases[phase].seconds += seconds;
+        phases[phase].count += count;
+        phases[phase].runs++;
+    }
+
+    const PhaseStats& get_phase(Phase phase) const {
+        return phases[phase];
+    }
+
+    /* Registers a piece of source, returns the number its first line gets */
+    uint32_t add_source(std::string_view source);
+
+    /* Called by the VM whenever a statement from a new line starts */
+    void enter_line(uint32_t line) {
+        Clock::time_point now = Clock::now();
+        if (current_line != 0) {
+            lines[current_line].seconds += std::chrono::duration<double>(now - line_started).count();
+        }
+        if (line >= lines.size()) {
+            lines.resize(line + 1);
+        }
+        lines[line].count++;
+        current_line = line;
+        line_started = now;
+    }
+
+    /* Charges the time since the last statement started to its line */
+    void leave_line() {
+        if (current_line != 0) {
+            lines[current_line].seconds += std::chrono::duration<double>(Clock::now() - line_started).count();
+            current_line = 0;
+        }
+    }
+
+    uint64_t statements_executed() const;
+
+    /* Human readable report, hottest lines first */
+    void report(std::ostream& out, size_t max_lines = 20) const;
+    void write_json(std::ostream& out) const;
+
+private:
+    PhaseStats phases[PHASE_COUNT];
+    std::vector<LineStats> lines = std::vector<LineStats>(1); // Line numbers start at 1
+    uint32_t current_line = 0;
+    Clock::time_point line_started;
+};
+
+static_assert(static_cast<int>(Profiler::PHASE_COUNT) == static_cast<int>(MemoryStats::OTHER), "--mem-stats uses the same phases");
+
+/* Times one phase, does nothing but mark the phase for --mem-stats when there is no profiler */
+class PhaseTimer {
+public:
+    PhaseTimer(Profiler* profiler, Profiler::Phase phase) : profiler(profiler), phase(phase), memory(static_cast<MemoryStats::Phase>(phase)) {
+        if (profiler) {
+            start = Profiler::Clock::now();
+        }
+    }
+
+    void stop(uint64_t count) {
+        memory.end();
+        if (profiler) {
+            profiler->add_phase(phase, std::chrono::duration<double>(Profiler::Clock::now() - start).count(), count);
+            profiler = nullptr;
+        }
+    }
+
+private:
+    Profiler* profiler;
+    Profiler::Phase phase;
+    Profiler::Clock::time_point start;
+    MemoryStats::PhaseScope memory;
+};
@@ -0,0 +1,97 @@
+#include "Reactive.h"
+
+#include <algorithm>
+
+#include "Interpreter.h"
+
+ReactiveGraph::ReactiveGraph() = default;
+ReactiveGraph::~ReactiveGraph() = default;
+
+void ReactiveGraph::add(std::shared_ptr<Reactive> reactive) {
+    uint32_t position = static_cast<uint32_t>(reactives.size());
+    for (uint32_t input : reactive->inputs) {
+        if (input >= dependents.size()) {
+            dependents.resize(input + 1);
+        }
+        dependents[input].push_back(position);
+    }
+    if (reactive->slot >= positions.size()) {
+        positions.resize(reactive->slot + 1, none);
+    }
+    positions[reactive->slot] = position;
+    dirty.push_back(1);
+    reactives.push_back(std::move(reactive));
+}
+
+void ReactiveGraph::truncate(size_t count) {
+    while (reactives.size() > count) {
+        const Reactive& reactive = *reactives.back();
+        uint32_t position = static_cast<uint32_t>(reactives.size() - 1);
+        // The newest definition is always last in its inputs' lists
+        for (uint32_t input : reactive.inputs) {
+            std::vector<uint32_t>& readers = dependents[input];
+            if (!readers.empty() && readers.back() == position) {
+                readers.pop_back();
+            }
+        }
+        positions[reactive.slot] = none;
+        dirty.pop_back();
+        reactives.pop_back();
+    }
+}
+
+void ReactiveGraph::invalidate(uint32_t slot) {
+    work.assign(dependents[slot].begin(), dependents[slot].end());
+    while (!work.empty()) {
+        uint32_t position = work.back();
+        work.pop_back();
+        if (dirty[position]) {
+            continue; // Everything downstream of it is out of date already
+        }
+        dirty[position] = 1;
+        uint32_t reactive_slot = reactives[position]->slot;
+        if (reactive_slot < dependents.size()) {
+            work.insert(work.end(), dependents[reactive_slot].begin(), dependents[reactive_slot].end());
+        }
+    }
+}
+
+void ReactiveGraph::recompute(uint32_t position, Value* slots) {
+    // Everything out of date that this one depends on, directly or not
+    order.clear();
+    work.assign(1, position);
+    dirty[position] = 2;
+    while (!work.empty()) {
+        uint32_t next = work.back();
+        work.pop_back();
+        order.push_back(next);
+        for (uint32_t input : reactives[next]->inputs) {
+            if (is_reactive(input) && dirty[positions[input]] == 1) {
+                dirty[positions[input]] = 2;
+                work.push_back(positions[input]);
+            }
+        }
+    }
+
+    // Inputs are always defined before what reads them, so in definition order each one's inputs are
+    // up to date by the time it runs and its own reads never come back in here
+    std::sort(order.begin(), order.end());
+    if (!vm) {
+        vm = std::make_unique<VM>();
+    }
+    try {
+        for (uint32_t next : order) {
+            const Reactive& reactive = *reactives[next];
+            slots[reactive.slot] = vm->run(reactive.chunk, slots, this);
+            dirty[next] = 0;
+        }
+    }
+    catch (...) {
+        for (uint32_t next : order) {
+            if (dirty[next] == 2) {
+                dirty[next] = 1;
+            }
+        }
+        throw;
+    }
+}
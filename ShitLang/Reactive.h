@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#include "Chunk.h"
+#include "Arena.h"
+
+class Node;
+class VM;
+
+/*
+    A variable from `let y := expression`. Instead of holding the value the expression had when the line
+    ran, it's worked out again whenever something it reads has changed since, the next time it's read.
+    The expression can only read variables declared before it, so the definitions can never form a cycle.
+
+    Like Function, it has its own arena and chunk, so a --stream batch can hand it to the executor after
+    the parser has moved on.
+*/
+struct Reactive {
+    explicit Reactive(std::string_view name) : name(name) {}
+
+    Reactive(const Reactive&) = delete;
+    Reactive& operator=(const Reactive&) = delete;
+
+    std::string name;
+    uint32_t slot = 0;            // Where the current value is kept, a normal variable slot
+    std::vector<uint32_t> inputs; // Slots the expression reads, each one once, reactive ones included
+    Node* expression = nullptr;   // In `nodes`
+    Chunk chunk;                  // The compiled expression ending in OP_RETURN, empty until the definition is compiled
+    Arena nodes{ 256 };           // Formulas are small, and a model can have thousands of them
+};
+
+/*
+    The dependency graph between reactive variables and what they read, and which of them are out of date.
+    It goes with one slot array: the Environment has one for its own values, --stream's executor another.
+
+    A store to a variable that something reads marks everything downstream of it out of date, which stops
+    at anything already marked since what's past that is marked too. Nothing is worked out until a reactive
+    variable is read, then only the out of date ones it depends on get recomputed, in definition order,
+    which is a topological order. Changing one input of a big model only costs what actually depends on it.
+*/
+class ReactiveGraph {
+public:
+    ReactiveGraph();
+    ~ReactiveGraph();
+
+    ReactiveGraph(const ReactiveGraph&) = delete;
+    ReactiveGraph& operator=(const ReactiveGraph&) = delete;
+
+    /* A new definition, out of date until its first read. Its inputs have to be defined already. */
+    void add(std::shared_ptr<Reactive> reactive);
+
+    /* Drops every definition after the first `count`, for a REPL line that failed */
+    void truncate(size_t count);
+
+    bool empty() const {
+        return reactives.empty();
+    }
+
+    /* Every definition, in the order they were added */
+    const std::vector<std::shared_ptr<Reactive>>& get_reactives() const {
+        return reactives;
+    }
+
+    bool is_reactive(uint32_t slot) const {
+        return slot < positions.size() && positions[slot] != none;
+    }
+
+    /* After a store to `slot` */
+    void changed(uint32_t slot) {
+        if (slot < dependents.size() && !dependents[slot].empty()) {
+            invalidate(slot);
+        }
+    }
+
+    /* Before a read of reactive `slot` out of `slots`, recomputes it if it's out of date */
+    void refresh(uint32_t slot, Value* slots) {
+        uint32_t position = positions[slot];
+        if (dirty[position]) {
+            recompute(position, slots);
+        }
+    }
+
+private:
+    static constexpr uint32_t none = UINT32_MAX;
+
+    // Kept out of line, a store to an input isn't the common case
+    void invalidate(uint32_t slot);
+    void recompute(uint32_t position, Value* slots);
+
+    std::vector<std::shared_ptr<Reactive>> reactives;
+    std::vector<uint32_t> positions;               // Slot to index in `reactives`, none for plain variables
+    std::vector<std::vector<uint32_t>> dependents; // Slot to the reactives that read it directly
+    std::vector<uint8_t> dirty;                    // Per reactive: 1 out of date, 2 queued to be recomputed
+    std::vector<uint32_t> work;                    // Scratch for the walks, so long chains don't recurse
+    std::vector<uint32_t> order;
+    std::unique_ptr<VM> vm;                        // Runs the expressions, made on the first recompute
+};
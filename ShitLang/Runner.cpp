@@ -0,0 +1,101 @@
+#include "Runner.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+
+#include "ThreadPool.h"
+
+std::vector<std::string> collect_scripts(const std::string& directory_or_list) {
+    std::vector<std::string> paths;
+
+    if (std::filesystem::is_directory(directory_or_list)) {
+        for (const auto& entry : std::filesystem::directory_iterator(directory_or_list)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".sl") {
+                paths.push_back(entry.path().string());
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+        return paths;
+    }
+
+    std::ifstream list(directory_or_list);
+    if (!list) {
+        throw std::runtime_error("Failed to open script list: " + directory_or_list);
+    }
+    std::string line;
+    while (std::getline(list, line)) {
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            paths.push_back(line);
+        }
+    }
+    return paths;
+}
+
+// One whole script on whatever worker picked it up, with nothing shared with any other script
+static void run_script(ScriptResult& result, const InterpreterOptions& options) {
+    Environment variables;
+    Arena arena;
+    OutputSink sink(&result.output);
+    std::ostringstream errors;
+
+    InterpreterOptions script_options = options;
+    script_options.profiler = nullptr; // The profiler isn't thread safe
+    script_options.errors = &errors;
+
+    OutputSink::set_current(&sink);
+    try {
+        result.status = run_file(result.path, variables, arena, script_options);
+    }
+    catch (const std::exception& e) {
+        errors << e.what() << "\n";
+        result.status = 1;
+    }
+    sink.flush();
+    OutputSink::set_current(nullptr);
+
+    result.errors = errors.str();
+}
+
+size_t run_scripts(const std::vector<std::string>& paths, size_t threads, const InterpreterOptions& options,
+    const std::function<void(const ScriptResult&)>& done) {
+    std::vector<ScriptResult> results(paths.size());
+    std::vector<char> finished(paths.size(), false);
+    std::mutex mutex;
+    std::condition_variable progress;
+
+    ThreadPool pool(threads == 0 ? std::thread::hardware_concurrency() : threads);
+    for (size_t i = 0; i < paths.size(); i++) {
+        results[i].path = paths[i];
+        pool.submit([&, i] {
+            run_script(results[i], options);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished[i] = true;
+            }
+            progress.notify_one();
+        });
+    }
+
+    // Hand results out in order while later scripts are still running
+    size_t failed = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            progress.wait(lock, [&] { return finished[i] != 0; });
+        }
+        done(results[i]);
+        if (results[i].status != 0) {
+            failed++;
+        }
+        results[i] = ScriptResult(); // Done with its output, don't hold on to it
+    }
+    return failed;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "Interpreter.h"
+
+/*
+    Runs lots of independent scripts in one process, spread over a thread pool.
+    Every script gets its own Environment, Arena and output, so nothing leaks from one script into the
+    next and nothing they print interleaves. Results are handed back in the order the scripts were given,
+    each one as soon as it and everything before it has finished.
+*/
+struct ScriptResult {
+    std::string path;
+    std::string output;
+    std::string errors;
+    int status = 0;
+};
+
+/* Scripts to run for --run-all: every .sl file in a directory (sorted by name), or one path per line of a list file */
+std::vector<std::string> collect_scripts(const std::string& directory_or_list);
+
+/* Runs every script on `threads` workers (0 means one per core), calls `done` for each in order, returns how many failed */
+size_t run_scripts(const std::vector<std::string>& paths, size_t threads, const InterpreterOptions& options,
+    const std::function<void(const ScriptResult&)>& done);
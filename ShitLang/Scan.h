@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SHITLANG_SCAN_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SHITLANG_SCAN_SSE2 1
+#endif
+
+/*
+    Character classification for the tokenizer.
+    Single characters go through a 256 entry table instead of <cctype> (no locale lookups, no int
+    promotion games with negative chars). The two runs that make up most of a script, whitespace and
+    identifier/digit characters, are skipped 32 (AVX2) or 16 (SSE2) bytes at a time, with the table
+    finishing off whatever is left at the end of the text.
+*/
+namespace scan {
+
+enum CharClass : uint8_t {
+    SPACE = 1,  // ' ' and \t \n \v \f \r, same set as isspace in the C locale
+    ALPHA = 2,
+    DIGIT = 4,
+};
+
+struct ClassTable {
+    uint8_t classes[256] = {};
+
+    constexpr ClassTable() {
+        classes[static_cast<uint8_t>(' ')] = SPACE;
+        for (int c = '\t'; c <= '\r'; c++) {
+            classes[c] = SPACE;
+        }
+        for (int c = 'a'; c <= 'z'; c++) {
+            classes[c] = ALPHA;
+            classes[c - 'a' + 'A'] = ALPHA;
+        }
+        for (int c = '0'; c <= '9'; c++) {
+            classes[c] = DIGIT;
+        }
+    }
+};
+
+inline constexpr ClassTable table{};
+
+inline bool is(char c, uint8_t classes) {
+    return (table.classes[static_cast<uint8_t>(c)] & classes) != 0;
+}
+
+inline bool is_space(char c) { return is(c, SPACE); }
+inline bool is_alpha(char c) { return is(c, ALPHA); }
+inline bool is_digit(char c) { return is(c, DIGIT); }
+inline bool is_alnum(char c) { return is(c, ALPHA | DIGIT); }
+
+inline unsigned count_trailing_zeros(uint32_t bits) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return index;
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+
+#if SHITLANG_SCAN_AVX2
+using Block = __m256i;
+constexpr size_t block_size = 32;
+
+inline Block load(const char* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+inline Block splat(char c) { return _mm256_set1_epi8(c); }
+inline Block either(Block a, Block b) { return _mm256_or_si256(a, b); }
+inline Block both(Block a, Block b) { return _mm256_and_si256(a, b); }
+inline Block equal(Block a, Block b) { return _mm256_cmpeq_epi8(a, b); }
+inline Block greater(Block a, Block b) { return _mm256_cmpgt_epi8(a, b); }
+inline uint32_t bits(Block a) { return static_cast<uint32_t>(_mm256_movemask_epi8(a)); }
+#elif SHITLANG_SCAN_SSE2
+using Block = __m128i;
+constexpr size_t block_size = 16;
+
+inline Block load(const char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+inline Block splat(char c) { return _mm_set1_epi8(c); }
+inline Block either(Block a, Block b) { return _mm_or_si128(a, b); }
+inline Block both(Block a, Block b) { return _mm_and_si128(a, b); }
+inline Block equal(Block a, Block b) { return _mm_cmpeq_epi8(a, b); }
+inline Block greater(Block a, Block b) { return _mm_cmpgt_epi8(a, b); }
+inline uint32_t bits(Block a) { return static_cast<uint32_t>(_mm_movemask_epi8(a)); }
+#endif
+
+#if SHITLANG_SCAN_AVX2 || SHITLANG_SCAN_SSE2
+constexpr uint32_t full_block = block_size == 32 ? 0xFFFFFFFFu : 0xFFFFu;
+
+// lo <= c <= hi for every byte. The compares are signed, bytes >= 0x80 come out negative and never match
+inline Block in_range(Block c, char lo, char hi) {
+    return both(greater(c, splat(lo - 1)), greater(splat(hi + 1), c));
+}
+
+inline uint32_t space_bits(Block c) {
+    return bits(either(equal(c, splat(' ')), in_range(c, '\t', '\r')));
+}
+
+inline uint32_t alnum_bits(Block c) {
+    Block lower = either(c, splat(0x20)); // Folds A-Z onto a-z, nothing else lands in that range
+    return bits(either(in_range(lower, 'a', 'z'), in_range(c, '0', '9')));
+}
+#endif
+
+/* First character at or after `p` that isn't whitespace */
+inline const char* skip_spaces(const char* p, const char* end) {
+#if SHITLANG_SCAN_AVX2 || SHITLANG_SCAN_SSE2
+    // Most gaps are a single space, don't bother loading a block for those
+    if (p < end && !is_space(*p)) {
+        return p;
+    }
+    while (end - p >= static_cast<ptrdiff_t>(block_size)) {
+        uint32_t other = ~space_bits(load(p)) & full_block;
+        if (other) {
+            return p + count_trailing_zeros(other);
+        }
+        p += block_size;
+    }
+#endif
+    while (p < end && is_space(*p)) {
+        p++;
+    }
+    return p;
+}
+
+/* First character at or after `p` that can't be part of a word */
+inline const char* skip_alnum(const char* p, const char* end) {
+#if SHITLANG_SCAN_AVX2 || SHITLANG_SCAN_SSE2
+    while (end - p >= static_cast<ptrdiff_t>(block_size)) {
+        uint32_t other = ~alnum_bits(load(p)) & full_block;
+        if (other) {
+            return p + count_trailing_zeros(other);
+        }
+        p += block_size;
+    }
+#endif
+    while (p < end && is_alnum(*p)) {
+        p++;
+    }
+    return p;
+}
+
+} // namespace scan
@@ -0,0 +1,495 @@
+#include "Server.h"
+
+#include <iostream>
+
+#ifdef _WIN32
+
+int run_server(const std::string&, const InterpreterOptions&, const ServerOptions&) {
+    std::cerr << "--serve needs Unix domain sockets, it isn't available on Windows" << std::endl;
+    return 1;
+}
+
+#else
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "ThreadPool.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum class Request : uint8_t {
+    RUN = 'r',
+    STATS = 's',
+    CLOSE = 'c',
+    QUIT = 'q',
+};
+
+constexpr size_t request_header = 9; // id, op, session
+
+uint32_t read_u32(const char* bytes) {
+    const uint8_t* b = reinterpret_cast<const uint8_t*>(bytes);
+    return b[0] | (b[1] << 8) | (b[2] << 16) | (static_cast<uint32_t>(b[3]) << 24);
+}
+
+void append_u32(std::string& out, uint32_t value) {
+    char bytes[4] = { char(value), char(value >> 8), char(value >> 16), char(value >> 24) };
+    out.append(bytes, sizeof(bytes));
+}
+
+// False at end of file or on an error, either way the connection is done
+bool read_exact(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t got = ::read(fd, data, size);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        data += got;
+        size -= got;
+    }
+    return true;
+}
+
+bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t wrote = ::write(fd, data, size);
+        if (wrote < 0 && errno == EINTR) {
+            continue;
+        }
+        if (wrote <= 0) {
+            return false;
+        }
+        data += wrote;
+        size -= wrote;
+    }
+    return true;
+}
+
+std::runtime_error socket_error(const std::string& what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+/*
+    How long requests take, from having read the whole frame to having written the response. Only the
+    latest `capacity` are kept, so a server that has been up for weeks reports how it's doing now.
+*/
+class LatencyStats {
+public:
+    void record(Clock::duration latency, bool failed) {
+        double micros = std::chrono::duration<double, std::micro>(latency).count();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (samples.size() < capacity) {
+            samples.push_back(micros);
+        }
+        else {
+            samples[total % capacity] = micros;
+        }
+        total++;
+        failures += failed;
+    }
+
+    std::string report() const {
+        std::vector<double> sorted;
+        uint64_t count, failed;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            sorted = samples;
+            count = total;
+            failed = failures;
+        }
+        std::sort(sorted.begin(), sorted.end());
+
+        std::string text = std::to_string(count) + " requests, " + std::to_string(failed) + " failed\n";
+        if (sorted.empty()) {
+            return text;
+        }
+        // Nearest rank: the smallest sample with at least p of them at or below it
+        auto percentile = [&](double p) {
+            size_t rank = static_cast<size_t>(p * sorted.size() + 0.999999);
+            return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+        };
+        char line[160];
+        std::snprintf(line, sizeof(line), "latency over the last %zu: p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+            sorted.size(), percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), sorted.back());
+        return text + line;
+    }
+
+private:
+    static constexpr size_t capacity = 64 * 1024;
+
+    mutable std::mutex mutex;
+    std::vector<double> samples;
+    uint64_t total = 0;
+    uint64_t failures = 0;
+};
+
+// One client. Responses are written whole under the lock, so two workers answering it never interleave.
+struct Connection {
+    explicit Connection(int fd) : fd(fd) {}
+
+    ~Connection() {
+        ::close(fd);
+    }
+
+    void send(const std::string& frame) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        write_all(fd, frame.data(), frame.size()); // A client that went away just doesn't get its answer
+    }
+
+    int fd;
+    std::mutex write_mutex;
+};
+
+struct Job {
+    std::shared_ptr<Connection> connection;
+    uint32_t id = 0;
+    Request op = Request::RUN;
+    std::string text;
+    Clock::time_point received;
+};
+
+/*
+    Everything a session keeps between requests. `jobs` and `running` make it a strand: requests queue up
+    here and only one worker at a time goes through them, so the session itself needs no locking.
+*/
+struct Session {
+    explicit Session(size_t cache_size) : cache(cache_size), sink(&output) {}
+
+    Environment variables;
+    Arena arena;
+    StatementCache cache;
+    std::string output;
+    OutputSink sink;
+
+    std::mutex mutex;
+    std::deque<Job> jobs;
+    bool running = false;
+};
+
+class Server {
+public:
+    Server(const InterpreterOptions& options, const ServerOptions& settings)
+        : options(options), settings(settings),
+          pool(settings.threads == 0 ? std::thread::hardware_concurrency() : settings.threads) {
+        this->options.profiler = nullptr; // Not thread safe
+        this->options.cache = nullptr;    // Every session brings its own
+    }
+
+    ~Server() {
+        if (listener >= 0) {
+            ::close(listener);
+            ::unlink(path.c_str());
+        }
+        for (int fd : wakeup) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+    }
+
+    void listen(const std::string& socket_path) {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("Socket path is too long: " + socket_path);
+        }
+        std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+        // A socket left behind by a server that died can go, one that still answers belongs to a live server
+        struct stat info;
+        if (::lstat(socket_path.c_str(), &info) == 0) {
+            if (!S_ISSOCK(info.st_mode)) {
+                throw std::runtime_error(socket_path + " already exists and isn't a socket");
+            }
+            int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            bool alive = probe >= 0 && ::connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+            if (probe >= 0) {
+                ::close(probe);
+            }
+            if (alive) {
+                throw std::runtime_error("Another server is already listening on " + socket_path);
+            }
+            ::unlink(socket_path.c_str());
+        }
+
+        listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0) {
+            throw socket_error("Failed to create a socket");
+        }
+        if (::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            int error = errno;
+            ::close(listener);
+            listener = -1;
+            errno = error;
+            throw socket_error("Failed to bind " + socket_path);
+        }
+        path = socket_path;
+        if (::listen(listener, SOMAXCONN) != 0) {
+            throw socket_error("Failed to listen on " + socket_path);
+        }
+        if (::pipe(wakeup) != 0) {
+            throw socket_error("Failed to create a pipe");
+        }
+    }
+
+    /* Accepts connections until a 'q' request, then lets everything already queued finish */
+    void serve() {
+        pollfd waiting[2] = { { listener, POLLIN, 0 }, { wakeup[0], POLLIN, 0 } };
+        while (!stopping) {
+            if (::poll(waiting, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            if (waiting[1].revents != 0) {
+                break; // stop() wrote to the pipe
+            }
+            if (waiting[0].revents == 0) {
+                continue;
+            }
+            int fd = ::accept(listener, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                break;
+            }
+            std::shared_ptr<Connection> connection = std::make_shared<Connection>(fd);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                connections.erase(std::remove_if(connections.begin(), connections.end(),
+                    [](const std::weak_ptr<Connection>& open) { return open.expired(); }), connections.end());
+                connections.push_back(connection);
+                readers++;
+            }
+            std::thread(&Server::read_requests, this, std::move(connection)).detach();
+        }
+
+        // Wake every reader still blocked on its client, answers can still go out
+        std::unique_lock<std::mutex> lock(mutex);
+        for (const std::weak_ptr<Connection>& open : connections) {
+            if (std::shared_ptr<Connection> connection = open.lock()) {
+                ::shutdown(connection->fd, SHUT_RD);
+            }
+        }
+        readers_done.wait(lock, [this] { return readers == 0; });
+        lock.unlock();
+        pool.wait();
+    }
+
+    std::string report() const {
+        return stats.report();
+    }
+
+private:
+    void read_requests(std::shared_ptr<Connection> connection) {
+        std::string frame;
+        while (true) {
+            char length_bytes[4];
+            if (!read_exact(connection->fd, length_bytes, sizeof(length_bytes))) {
+                break;
+            }
+            uint32_t length = read_u32(length_bytes);
+            if (length < request_header || length > settings.max_frame) {
+                std::cerr << "Dropping a connection that sent a " << length << " byte frame" << std::endl;
+                break;
+            }
+            frame.resize(length);
+            if (!read_exact(connection->fd, &frame[0], length)) {
+                break;
+            }
+
+            Job job;
+            job.connection = connection;
+            job.id = read_u32(frame.data());
+            job.op = static_cast<Request>(frame[4]);
+            job.text.assign(frame, request_header, std::string::npos);
+            job.received = Clock::now();
+            dispatch(read_u32(frame.data() + 5), std::move(job));
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        readers--;
+        readers_done.notify_all();
+    }
+
+    void dispatch(uint32_t session_id, Job job) {
+        switch (job.op) {
+        case Request::RUN:
+            enqueue(find_session(session_id), std::move(job));
+            return;
+        case Request::CLOSE: {
+            // Out of the table now, so requests after this one get a fresh session. The old one finishes
+            // whatever it was sent first, then goes away with its last job.
+            std::shared_ptr<Session> session;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto found = sessions.find(session_id);
+                if (found != sessions.end()) {
+                    session = std::move(found->second);
+                    sessions.erase(found);
+                }
+            }
+            if (session) {
+                enqueue(std::move(session), std::move(job));
+            }
+            else {
+                respond(job, 0, "", "");
+            }
+            return;
+        }
+        case Request::STATS:
+            respond(job, 0, stats.report(), "");
+            return;
+        case Request::QUIT:
+            respond(job, 0, "", "");
+            stop();
+            return;
+        }
+        respond(job, 1, "", std::string("Unknown request: ") + static_cast<char>(job.op) + "\n");
+    }
+
+    std::shared_ptr<Session> find_session(uint32_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<Session>& session = sessions[id];
+        if (!session) {
+            session = std::make_shared<Session>(settings.cache_size);
+        }
+        return session;
+    }
+
+    void enqueue(std::shared_ptr<Session> session, Job job) {
+        bool start;
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            session->jobs.push_back(std::move(job));
+            start = !session->running;
+            session->running = true;
+        }
+        if (start) {
+            pool.submit([this, session] { drain(*session); });
+        }
+    }
+
+    // Runs the session's requests until there are none left, new ones can keep arriving meanwhile
+    void drain(Session& session) {
+        while (true) {
+            Job job;
+            {
+                std::lock_guard<std::mutex> lock(session.mutex);
+                if (session.jobs.empty()) {
+                    session.running = false;
+                    return;
+                }
+                job = std::move(session.jobs.front());
+                session.jobs.pop_front();
+            }
+            if (job.op == Request::CLOSE) {
+                respond(job, 0, "", "");
+                continue;
+            }
+            run(session, job);
+        }
+    }
+
+    void run(Session& session, const Job& job) {
+        std::ostringstream errors;
+        InterpreterOptions run_options = options;
+        run_options.cache = &session.cache;
+        run_options.errors = &errors;
+
+        session.output.clear();
+        OutputSink::set_current(&session.sink);
+        interpret(job.text, session.variables, session.arena, run_options);
+        session.sink.flush();
+        OutputSink::set_current(nullptr);
+
+        std::string error_text = errors.str();
+        respond(job, error_text.empty() ? 0 : 1, session.output, error_text);
+    }
+
+    void respond(const Job& job, uint8_t status, const std::string& output, const std::string& error_text) {
+        std::string frame;
+        frame.reserve(4 + 9 + output.size() + error_text.size());
+        append_u32(frame, static_cast<uint32_t>(9 + output.size() + error_text.size()));
+        append_u32(frame, job.id);
+        frame += static_cast<char>(status);
+        append_u32(frame, static_cast<uint32_t>(output.size()));
+        frame += output;
+        frame += error_text;
+        job.connection->send(frame);
+        if (job.op == Request::RUN) {
+            stats.record(Clock::now() - job.received, status != 0);
+        }
+    }
+
+    void stop() {
+        stopping = true;
+        // Wakes the poll() in serve(), shutdown() on a listening socket only does that on Linux
+        char byte = 0;
+        while (::write(wakeup[1], &byte, 1) < 0 && errno == EINTR) {
+        }
+    }
+
+    InterpreterOptions options;
+    ServerOptions settings;
+    std::string path;
+    int listener = -1;
+    int wakeup[2] = { -1, -1 }; // Self-pipe, stop() writes to it
+    std::atomic<bool> stopping{ false };
+    LatencyStats stats;
+
+    std::mutex mutex; // Guards everything below
+    std::unordered_map<uint32_t, std::shared_ptr<Session>> sessions;
+    std::vector<std::weak_ptr<Connection>> connections;
+    size_t readers = 0;
+    std::condition_variable readers_done;
+
+    ThreadPool pool; // Last, so it finishes its tasks before anything they use goes away
+};
+
+}
+
+int run_server(const std::string& socket_path, const InterpreterOptions& options, const ServerOptions& settings) {
+    std::signal(SIGPIPE, SIG_IGN); // Writing to a client that hung up should fail, not kill the server
+    try {
+        Server server(options, settings);
+        server.listen(socket_path);
+        std::cerr << "Serving on " << socket_path << std::endl;
+        server.serve();
+        std::cerr << server.report() << std::flush;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+#include "Interpreter.h"
+#include "StatementCache.h"
+
+/*
+    --serve: a long running interpreter on a Unix domain socket, so callers skip process startup and
+    re-parsing. Every request names a session, and a session keeps its variables and its compiled
+    statements (a StatementCache, same as the REPL) between requests, from any connection, until it's
+    closed. Requests run on a thread pool. Two sessions run side by side, but one session's requests
+    run one at a time in the order they came in.
+
+    Frames both ways are a u32 length followed by that many bytes, all integers little endian.
+        request     u32 id, u8 op, u32 session, then the program text for 'r'
+        response    u32 id, u8 status (0 ok, 1 failed), u32 output length, the output, then the error text
+    Responses carry the id of their request and can come back out of order when requests for different
+    sessions are in flight on the same connection.
+    Ops:
+        'r'  run the text in the session, like one REPL entry (a failed entry rolls back its `let`s)
+        's'  latency percentiles and counters as text, in the output
+        'c'  drop the session once everything sent to it before has run
+        'q'  stop the server, after the requests already queued
+*/
+struct ServerOptions {
+    size_t threads = 0;                                  // Pool size, 0 means one per core
+    size_t cache_size = StatementCache::default_capacity; // Per session
+    size_t max_frame = 64 * 1024 * 1024;                // A bigger frame is an error and closes the connection
+};
+
+/* Listens on `socket_path` until a 'q' request, then prints the latency report to stderr. Returns the exit status. */
+int run_server(const std::string& socket_path, const InterpreterOptions& options, const ServerOptions& server = ServerOptions());
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cstddef>
+
+/*
+    Bounded single producer / single consumer queue, lock free.
+    One thread pushes and one thread pops, each owns one end of a ring buffer and the only thing they share
+    are the two indexes. A full queue makes the producer wait and an empty one makes the consumer wait, which
+    is what keeps a pipeline's memory flat however much input goes through it. Waiting spins for a bit,
+    then yields, then sleeps, so a stage that's starved for a while doesn't eat a core.
+*/
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : capacity(capacity + 1), slots(new T[capacity + 1]) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    /* Blocks while the queue is full, false if the consumer gave up (cancel()) */
+    bool push(T&& value) {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % capacity;
+        for (unsigned spins = 0; next == head.load(std::memory_order_acquire); spins++) {
+            if (cancelled.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            backoff(spins);
+        }
+        slots[tail] = std::move(value);
+        this->tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /* Blocks while the queue is empty, false once it's closed and drained, or cancelled */
+    bool pop(T& value) {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        for (unsigned spins = 0; head == tail.load(std::memory_order_acquire); spins++) {
+            if (cancelled.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            if (closed.load(std::memory_order_acquire)) {
+                // Anything pushed before close() is visible by now
+                if (head == tail.load(std::memory_order_acquire)) {
+                    return false;
+                }
+                break;
+            }
+            backoff(spins);
+        }
+        value = std::move(slots[head]);
+        slots[head] = T();
+        this->head.store((head + 1) % capacity, std::memory_order_release);
+        return true;
+    }
+
+    /* Producer side: nothing else is coming */
+    void close() {
+        closed.store(true, std::memory_order_release);
+    }
+
+    /* Either side: stop, the other end's push/pop return false from now on */
+    void cancel() {
+        cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    bool is_cancelled() const {
+        return cancelled.load(std::memory_order_relaxed);
+    }
+
+private:
+    static void backoff(unsigned spins) {
+        if (spins < 64) {
+            return;
+        }
+        if (spins < 256) {
+            std::this_thread::yield();
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(spins < 1024 ? 10 : 200));
+    }
+
+    const size_t capacity;
+    std::unique_ptr<T[]> slots;
+    alignas(64) std::atomic<size_t> head{ 0 }; // Only the consumer moves it
+    alignas(64) std::atomic<size_t> tail{ 0 }; // Only the producer moves it
+    std::atomic<bool> closed{ false };
+    std::atomic<bool> cancelled{ false };
+};
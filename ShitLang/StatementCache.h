@@ -0,0 +1,99 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+#include "Chunk.h"
+
+/*
+    Compiled statements for the REPL, keyed by their source text with the whitespace normalized.
+    A line that has been seen before skips the tokenizer, parser and compiler and runs its old chunk.
+    Chunks only hold slot numbers, and slots never change for the lifetime of an Environment, so a hit
+    reads whatever the variables hold right now. The one thing a chunk can't redo is `let`, so entries
+    remember which slots the line declared and the declarations (and their redeclaration errors) are
+    replayed on every hit. Entries belong to one Environment, don't share a cache between two.
+*/
+class StatementCache {
+public:
+    struct Entry {
+        Chunk chunk;
+        std::vector<uint32_t> declares;
+    };
+
+    static constexpr size_t default_capacity = 1024;
+
+    explicit StatementCache(size_t capacity = default_capacity) : capacity(capacity) {}
+
+    StatementCache(const StatementCache&) = delete;
+    StatementCache& operator=(const StatementCache&) = delete;
+
+    /* Whitespace runs become one space and the ends are trimmed, ShitLang has no strings so that's always safe */
+    static std::string normalize(std::string_view source) {
+        std::string key;
+        key.reserve(source.size());
+        bool space = false;
+        for (char c : source) {
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f') {
+                space = !key.empty();
+                continue;
+            }
+            if (space) {
+                key += ' ';
+                space = false;
+            }
+            key += c;
+        }
+        return key;
+    }
+
+    /* The entry for `key` (marked most recently used), or nullptr. Counts as a hit or a miss. */
+    const Entry* find(const std::string& key) {
+        auto found = index.find(key);
+        if (found == index.end()) {
+            misses++;
+            return nullptr;
+        }
+        hits++;
+        entries.splice(entries.begin(), entries, found->second);
+        return &found->second->second;
+    }
+
+    void insert(std::string key, Entry entry) {
+        if (capacity == 0) {
+            return;
+        }
+        auto found = index.find(key);
+        if (found != index.end()) {
+            found->second->second = std::move(entry);
+            entries.splice(entries.begin(), entries, found->second);
+            return;
+        }
+        if (entries.size() >= capacity) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+        entries.emplace_front(std::move(key), std::move(entry));
+        index.emplace(entries.front().first, entries.begin());
+    }
+
+    void clear() {
+        index.clear();
+        entries.clear();
+    }
+
+    uint64_t get_hits() const { return hits; }
+    uint64_t get_misses() const { return misses; }
+    size_t size() const { return entries.size(); }
+
+private:
+    // Most recently used at the front, the keys in `index` point into the list's strings
+    std::list<std::pair<std::string, Entry>> entries;
+    std::unordered_map<std::string_view, std::list<std::pair<std::string, Entry>>::iterator> index;
+    size_t capacity;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
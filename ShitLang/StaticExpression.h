@@ -0,0 +1,435 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+#include "Token.h"
+#include "Scan.h"
+#include "Value.h"
+
+/*
+    PreparedExpression's compile-time twin, for formulas that are string literals in the host program.
+    parse_static() is a constexpr copy of the tokenizer and the expression part of the parser, so when
+    it initializes a constexpr variable the formula is parsed by the C++ compiler and a syntax error is
+    a compile error. StaticExpression then turns the parsed nodes into one template instantiation per
+    node, which the compiler inlines into straight-line code with the constants folded in.
+
+        auto area = SHITLANG_STATIC_EXPRESSION("w * h");
+        double a = area({ 3, 4 });                       // inputs in get_inputs() order, checked at compile time
+
+    Results match PreparedExpression::compile() on the same source bit for bit, including the
+    optimizer's small integer powers. Only a single expression is allowed, no let, print, if or while.
+*/
+
+/* One node of a parsed static expression, children are indexes into the same program */
+struct StaticNode {
+    enum Kind : uint8_t {
+        NUMBER,
+        INPUT,
+        BINARY,     // + - * / ^ and the relational operators, with the same chars as the tree nodes
+        POWER,      // ^ with a small int literal exponent, what the optimizer makes an IntegerPowerNode
+    };
+
+    Kind kind = NUMBER;
+    char operation = 0;
+    uint16_t left = 0;
+    uint16_t right = 0;
+    uint16_t input = 0;
+    ValueType type = ValueType::INT; // NUMBER: which of integer / number holds the value
+    int64_t integer = 0;             // Also the exponent of a POWER
+    double number = 0;
+    ValueType result = ValueType::UNKNOWN; // What Node::static_type() would say
+    bool constant = true;                  // No inputs below it, the optimizer would have folded it
+};
+
+struct StaticProgram {
+    static constexpr size_t max_nodes = 256;
+    static constexpr size_t max_inputs = 32;
+
+    StaticNode nodes[max_nodes] = {};
+    uint16_t node_count = 0;
+    uint16_t root = 0;
+    std::string_view inputs[max_inputs] = {};
+    uint16_t input_count = 0;
+};
+
+class StaticParser {
+public:
+    constexpr explicit StaticParser(std::string_view source) : source(source) {}
+
+    constexpr StaticProgram parse() {
+        tokenize();
+        program.root = parseExpression();
+        if (position != token_count) {
+            throw std::invalid_argument("A static expression is one expression, found more after it");
+        }
+        return program;
+    }
+
+private:
+    struct StaticToken {
+        TokenType type = EoF;
+        std::string_view text;
+    };
+
+    static constexpr size_t max_tokens = 512;
+
+    static constexpr bool is(char c, uint8_t classes) {
+        return (scan::table.classes[static_cast<uint8_t>(c)] & classes) != 0;
+    }
+
+    constexpr char peek(size_t at) const {
+        return at < source.size() ? source[at] : '\0';
+    }
+
+    constexpr void addToken(TokenType type, size_t start, size_t length) {
+        if (token_count == max_tokens) {
+            throw std::invalid_argument("Static expression is too long");
+        }
+        tokens[token_count++] = StaticToken{ type, source.substr(start, length) };
+    }
+
+    // The same rules as Tokenizer::tokenize(), down to when a '-' starts a negative number
+    constexpr void tokenize() {
+        size_t at = 0;
+        while (at < source.size()) {
+            char c = source[at];
+            if (is(c, scan::SPACE)) {
+                at++;
+                continue;
+            }
+
+            size_t start = at;
+            if (is(c, scan::ALPHA)) {
+                while (at < source.size() && is(source[at], scan::ALPHA | scan::DIGIT)) {
+                    at++;
+                }
+                std::string_view word = source.substr(start, at - start);
+                if (word == "let" || word == "print" || word == "if" || word == "else" || word == "while") {
+                    throw std::invalid_argument("Static expressions can't use let, print, if, else or while");
+                }
+                addToken(VARIABLE, start, at - start);
+                continue;
+            }
+
+            TokenType previous = token_count == 0 ? EoF : tokens[token_count - 1].type;
+            bool negative_number = c == '-' && is(peek(at + 1), scan::DIGIT) && token_count != 0 && previous != LPAREN
+                && previous != PLUS && previous != MINUS && previous != MULT && previous != DIVIDE;
+            if (negative_number || is(c, scan::DIGIT)) {
+                at += negative_number ? 1 : 0;
+                bool floating = false;
+                while (at < source.size() && (is(source[at], scan::DIGIT) || source[at] == '.')) {
+                    if (source[at] == '.') {
+                        if (floating) {
+                            throw std::invalid_argument("Invalid number");
+                        }
+                        floating = true;
+                    }
+                    at++;
+                }
+                addToken(floating ? FLOAT : INTEGER, start, at - start);
+                continue;
+            }
+
+            char next = peek(at + 1);
+            switch (c) {
+            case '-': addToken(MINUS, at, 1); break;
+            case '^': addToken(EXPONENT, at, 1); break;
+            case '+': addToken(PLUS, at, 1); break;
+            case '/': addToken(DIVIDE, at, 1); break;
+            case '*': addToken(MULT, at, 1); break;
+            case '(': addToken(LPAREN, at, 1); break;
+            case ')': addToken(RPAREN, at, 1); break;
+            case '=':
+                if (next != '=') {
+                    throw std::invalid_argument("Static expressions can't assign");
+                }
+                addToken(EQEQ, at++, 2);
+                break;
+            case '&':
+            case '|':
+                if (next != c) {
+                    throw std::invalid_argument("Unknown Token");
+                }
+                addToken(c == '&' ? AND : OR, at++, 2);
+                break;
+            case '<':
+            case '>':
+                if (next == '=') {
+                    addToken(c == '<' ? LESS_THAN_EQ : GREATER_THAN_EQ, at++, 2);
+                }
+                else {
+                    addToken(c == '<' ? LESS_THAN : GREATER_THAN, at, 1);
+                }
+                break;
+            default:
+                throw std::invalid_argument("Unknown Token");
+            }
+            at++;
+        }
+    }
+
+    constexpr const StaticToken& currentToken() const {
+        if (position >= token_count) {
+            throw std::invalid_argument("Unexpected end of expression");
+        }
+        return tokens[position];
+    }
+
+    constexpr bool atToken(TokenType type) const {
+        return position < token_count && tokens[position].type == type;
+    }
+
+    constexpr uint16_t addNode(StaticNode node) {
+        if (program.node_count == StaticProgram::max_nodes) {
+            throw std::invalid_argument("Static expression is too long");
+        }
+        program.nodes[program.node_count] = node;
+        return program.node_count++;
+    }
+
+    constexpr uint16_t addBinary(uint16_t left, uint16_t right, char operation) {
+        StaticNode node;
+        node.kind = StaticNode::BINARY;
+        node.operation = operation;
+        node.left = left;
+        node.right = right;
+        const StaticNode& a = program.nodes[left];
+        const StaticNode& b = program.nodes[right];
+        bool relational = operation != '+' && operation != '-' && operation != '*' && operation != '/' && operation != '^';
+        node.result = relational ? arith::relational_type(a.result, b.result) : arith::arithmetic_type(a.result, b.result);
+        node.constant = a.constant && b.constant;
+        return addNode(node);
+    }
+
+    // Same grammar as Parser: + - and the relational operators share the lowest level, all left to right
+    constexpr uint16_t parseExpression() {
+        uint16_t node = parseTerm();
+        while (position < token_count) {
+            char op = 0;
+            switch (tokens[position].type) {
+            case PLUS:              op = '+'; break;
+            case MINUS:             op = '-'; break;
+            case GREATER_THAN:      op = '>'; break;
+            case LESS_THAN:         op = '<'; break;
+            case GREATER_THAN_EQ:   op = '.'; break;
+            case LESS_THAN_EQ:      op = ','; break;
+            case EQEQ:              op = '='; break;
+            case AND:               op = '&'; break;
+            case OR:                op = '|'; break;
+            default: return node;
+            }
+            position++;
+            node = addBinary(node, parseTerm(), op);
+        }
+        return node;
+    }
+
+    constexpr uint16_t parseTerm() {
+        uint16_t node = parseFactor();
+        while (atToken(MULT) || atToken(DIVIDE) || atToken(EXPONENT)) {
+            TokenType type = tokens[position++].type;
+            uint16_t right = parseFactor();
+            if (type == EXPONENT) {
+                node = parsePower(node, right);
+            }
+            else {
+                node = addBinary(node, right, type == MULT ? '*' : '/');
+            }
+        }
+        return node;
+    }
+
+    // x ^ 2 becomes x * x (and x ^ -1 1 / x) wherever Optimizer::optimize_power() would do the same
+    constexpr uint16_t parsePower(uint16_t base, uint16_t exponent) {
+        const StaticNode& power = program.nodes[exponent];
+        const StaticNode& operand = program.nodes[base];
+        bool whole = power.kind == StaticNode::NUMBER && (power.type == ValueType::INT
+            || (operand.result == ValueType::DOUBLE && power.number == static_cast<double>(static_cast<int64_t>(power.number))));
+        int64_t n = power.type == ValueType::INT ? power.integer : static_cast<int64_t>(power.number);
+        if (!operand.constant && whole && is_reduced_power(static_cast<double>(n))) {
+            StaticNode node;
+            node.kind = StaticNode::POWER;
+            node.left = base;
+            node.integer = n;
+            node.result = arith::unary_type(operand.result);
+            node.constant = false;
+            return addNode(node);
+        }
+        return addBinary(base, exponent, '^');
+    }
+
+    constexpr uint16_t parseFactor() {
+        const StaticToken& token = currentToken();
+        if (token.type == INTEGER || token.type == FLOAT) {
+            position++;
+            return addNode(parseNumber(token));
+        }
+        if (token.type == VARIABLE) {
+            position++;
+            StaticNode node;
+            node.kind = StaticNode::INPUT;
+            node.input = inputIndex(token.text);
+            node.constant = false;
+            return addNode(node);
+        }
+        if (token.type == LPAREN) {
+            position++;
+            uint16_t node = parseExpression();
+            if (!atToken(RPAREN)) {
+                throw std::invalid_argument("Expected )");
+            }
+            position++;
+            return node;
+        }
+        throw std::invalid_argument("Unexpected token in factor");
+    }
+
+    // Inputs are numbered in the order they first show up, like PreparedExpression::get_inputs()
+    constexpr uint16_t inputIndex(std::string_view name) {
+        for (uint16_t i = 0; i < program.input_count; i++) {
+            if (program.inputs[i] == name) {
+                return i;
+            }
+        }
+        if (program.input_count == StaticProgram::max_inputs) {
+            throw std::invalid_argument("Static expression has too many inputs");
+        }
+        program.inputs[program.input_count] = name;
+        return program.input_count++;
+    }
+
+    /*
+        from_chars can't run at compile time, so numbers are only taken when the answer is sure to be the
+        same: ints that fit in 64 bits, and doubles whose digits fit in 53 bits with at most 22 of them
+        after the point, where one division of two exact doubles is already correctly rounded.
+    */
+    static constexpr StaticNode parseNumber(const StaticToken& token) {
+        std::string_view text = token.text;
+        bool negative = text[0] == '-';
+        uint64_t digits = 0;
+        int decimals = 0;
+        bool after_point = false;
+        for (size_t i = negative ? 1 : 0; i < text.size(); i++) {
+            if (text[i] == '.') {
+                after_point = true;
+                continue;
+            }
+            uint64_t digit = static_cast<uint64_t>(text[i] - '0');
+            if (digits > (UINT64_MAX - digit) / 10) {
+                throw std::invalid_argument("Number literal is too long for a static expression");
+            }
+            digits = digits * 10 + digit;
+            decimals += after_point ? 1 : 0;
+        }
+
+        StaticNode node;
+        if (token.type == INTEGER) {
+            if (digits > (negative ? uint64_t(INT64_MAX) + 1 : uint64_t(INT64_MAX))) {
+                throw std::invalid_argument("Number literal is too long for a static expression");
+            }
+            node.type = ValueType::INT;
+            node.result = ValueType::INT;
+            node.integer = negative ? static_cast<int64_t>(0 - digits) : static_cast<int64_t>(digits);
+            return node;
+        }
+
+        if (digits > (uint64_t(1) << 53) || decimals > 22) {
+            throw std::invalid_argument("Number literal is too long for a static expression");
+        }
+        double scale = 1;
+        for (int i = 0; i < decimals; i++) {
+            scale *= 10;
+        }
+        double value = static_cast<double>(digits) / scale;
+        node.type = ValueType::DOUBLE;
+        node.result = ValueType::DOUBLE;
+        node.number = negative ? -value : value;
+        return node;
+    }
+
+    std::string_view source;
+    StaticToken tokens[max_tokens] = {};
+    size_t token_count = 0;
+    size_t position = 0;
+    StaticProgram program;
+};
+
+/* Parses `source` when it initializes a constexpr variable, throws std::invalid_argument at runtime */
+constexpr StaticProgram parse_static(std::string_view source) {
+    return StaticParser(source).parse();
+}
+
+template <const StaticProgram& Program>
+class StaticExpression {
+public:
+    static constexpr size_t input_count = Program.input_count;
+
+    /* Input names, in the order evaluate() takes their values */
+    static constexpr std::array<std::string_view, input_count> get_inputs() {
+        std::array<std::string_view, input_count> names{};
+        for (size_t i = 0; i < input_count; i++) {
+            names[i] = Program.inputs[i];
+        }
+        return names;
+    }
+
+    /* `values` holds one value per input, in get_inputs() order */
+    static Value evaluate(const Value* values) {
+        return node<Program.root>(values);
+    }
+
+    static double evaluate(const std::array<double, input_count>& values) {
+        return node<Program.root>(values.data()).to_double();
+    }
+
+    double operator()(const std::array<double, input_count>& values) const {
+        return evaluate(values);
+    }
+
+private:
+    // Reads doubles straight from the caller's array, so every tag is a constant and the type checks fold away
+    template <uint16_t Index, typename Input>
+    static Value node(const Input* values) {
+        constexpr StaticNode current = Program.nodes[Index];
+        if constexpr (current.kind == StaticNode::NUMBER) {
+            if constexpr (current.type == ValueType::INT) {
+                return current.integer;
+            }
+            else {
+                return current.number;
+            }
+        }
+        else if constexpr (current.kind == StaticNode::INPUT) {
+            return Value(values[current.input]);
+        }
+        else if constexpr (current.kind == StaticNode::POWER) {
+            return arith::power(node<current.left>(values), static_cast<int32_t>(current.integer));
+        }
+        else {
+            Value a = node<current.left>(values);
+            Value b = node<current.right>(values);
+            if constexpr (current.operation == '+') return arith::add(a, b);
+            else if constexpr (current.operation == '-') return arith::subtract(a, b);
+            else if constexpr (current.operation == '*') return arith::multiply(a, b);
+            else if constexpr (current.operation == '/') return arith::divide(a, b);
+            else if constexpr (current.operation == '^') return arith::power(a, b);
+            else if constexpr (current.operation == '<') return arith::less(a, b);
+            else if constexpr (current.operation == '>') return arith::greater(a, b);
+            else if constexpr (current.operation == ',') return arith::less_equal(a, b);
+            else if constexpr (current.operation == '.') return arith::greater_equal(a, b);
+            else if constexpr (current.operation == '=') return arith::equal(a, b);
+            else if constexpr (current.operation == '&') return arith::logical_and(a, b);
+            else return arith::logical_or(a, b);
+        }
+    }
+};
+
+/* A StaticExpression for a string literal, parsed while compiling: `auto f = SHITLANG_STATIC_EXPRESSION("a * b");` */
+#define SHITLANG_STATIC_EXPRESSION(source) \
+    ([] { \
+        static constexpr StaticProgram shitlang_program = parse_static(source); \
+        return StaticExpression<shitlang_program>(); \
+    }())
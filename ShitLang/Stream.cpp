@@ -0,0 +1,269 @@
+#include "Stream.h"
+
+#include <thread>
+#include <memory>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "SpscQueue.h"
+#include "Tokenizer.h"
+#include "Parser.h"
+#include "Jit.h"
+#include "MemoryStats.h"
+
+namespace {
+
+// The text lives on the heap so moving a batch around never moves the characters tokens point at
+struct TextBatch {
+    std::unique_ptr<std::string> text;
+    uint32_t first_line = 1;
+};
+
+struct TokenBatch {
+    std::unique_ptr<std::string> text;
+    std::vector<Token> tokens;
+    uint32_t first_line = 1;
+};
+
+struct ChunkBatch {
+    Chunk chunk;
+    std::vector<std::shared_ptr<Reactive>> reactives; // `let :=`s defined in this batch, the executor has its own graph
+    std::string error; // Set on the last batch when parsing failed, after its chunk runs the stream stops
+};
+
+#ifdef _WIN32
+
+// There's no poll() for pipes here, reads just block and nothing is known to be waiting after one
+bool wait_for_input(int, const SpscQueue<TextBatch>&) {
+    return true;
+}
+
+bool input_ready(int) {
+    return false;
+}
+
+long read_input(int fd, char* buffer, size_t size) {
+    return _read(fd, buffer, static_cast<unsigned>(std::min<size_t>(size, 1 << 30)));
+}
+
+#else
+
+// Waits for something to read (or EOF), giving up once the stream is cancelled so a quiet producer can't hold it up
+bool wait_for_input(int fd, const SpscQueue<TextBatch>& out) {
+    pollfd waiting = { fd, POLLIN, 0 };
+    while (!out.is_cancelled()) {
+        int ready = ::poll(&waiting, 1, 100);
+        if (ready > 0 || (ready < 0 && errno != EINTR)) {
+            return true; // read() reports the error, if it was one
+        }
+    }
+    return false;
+}
+
+bool input_ready(int fd) {
+    pollfd waiting = { fd, POLLIN, 0 };
+    return ::poll(&waiting, 1, 0) > 0;
+}
+
+long read_input(int fd, char* buffer, size_t size) {
+    return static_cast<long>(::read(fd, buffer, size));
+}
+
+#endif
+
+// Reads whatever `fd` has and hands out everything up to the last newline outside of braces, once there's a
+// batch worth of it or once the input has nothing more ready, so a slow pipe still runs line by line
+void read_stage(int fd, size_t batch_bytes, std::shared_ptr<SpscQueue<TextBatch>> queue) {
+    SpscQueue<TextBatch>& out = *queue;
+    std::string pending;
+    std::vector<char> block(std::max<size_t>(batch_bytes, 4096));
+    uint32_t line = 1;
+    int depth = 0;
+    size_t scanned = 0;  // How far into `pending` depth has been worked out
+    size_t boundary = 0; // End of the last complete statement in `pending`
+
+    auto send = [&](size_t length) {
+        TextBatch batch;
+        batch.text = std::make_unique<std::string>(pending, 0, length);
+        batch.first_line = line;
+        line += static_cast<uint32_t>(std::count(batch.text->begin(), batch.text->end(), '\n'));
+        pending.erase(0, length);
+        scanned -= length;
+        boundary -= length;
+        return out.push(std::move(batch));
+    };
+
+    while (true) {
+        if (!wait_for_input(fd, out)) {
+            return;
+        }
+        long read = read_input(fd, block.data(), block.size());
+        if (read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read <= 0) {
+            break;
+        }
+        pending.append(block.data(), static_cast<size_t>(read));
+        for (; scanned < pending.size(); scanned++) {
+            char c = pending[scanned];
+            if (c == '{') {
+                depth++;
+            }
+            else if (c == '}') {
+                depth--;
+            }
+            else if (c == '\n' && depth <= 0) {
+                boundary = scanned + 1;
+            }
+        }
+        if (boundary > 0 && (boundary >= batch_bytes || !input_ready(fd)) && !send(boundary)) {
+            return;
+        }
+    }
+    if (!pending.empty() && !send(pending.size())) {
+        return;
+    }
+    out.close();
+}
+
+void lex_stage(SpscQueue<TextBatch>& in, SpscQueue<TokenBatch>& out) {
+    MemoryStats::PhaseScope phase(MemoryStats::TOKENIZE);
+    Environment unused; // The tokenizer wants one, it never touches it
+    TextBatch text;
+    while (in.pop(text)) {
+        TokenBatch batch;
+        batch.tokens = Tokenizer(*text.text, &unused).tokenize();
+        batch.text = std::move(text.text);
+        batch.first_line = text.first_line;
+        if (!out.push(std::move(batch))) {
+            in.cancel();
+            return;
+        }
+    }
+    out.close();
+}
+
+// Parses statement by statement, so a bad one still lets everything before it run
+void parse_stage(SpscQueue<TokenBatch>& in, SpscQueue<ChunkBatch>& out, const InterpreterOptions& options) {
+    MemoryStats::PhaseScope phase(MemoryStats::PARSE); // Optimizing and compiling included, they run batch by batch in here
+    Environment symbols;
+    Arena arena;
+    size_t sent_reactives = 0;
+    TokenBatch tokens;
+    while (in.pop(tokens)) {
+        Parser parser(tokens.tokens, &symbols, arena);
+        std::vector<Node*> statements;
+        ChunkBatch batch;
+        try {
+            while (Node* statement = parser.parse_next()) {
+                statements.push_back(statement);
+            }
+        }
+        catch (const std::exception& e) {
+            std::string_view text = *tokens.text;
+            size_t offset = tokens.tokens[parser.get_statement_position()].get_offset(text);
+            size_t line = tokens.first_line + std::count(text.begin(), text.begin() + offset, '\n');
+            batch.error = "Error on line " + std::to_string(line) + ": " + e.what();
+        }
+
+        try {
+            if (!statements.empty()) {
+                Node* root = statements.size() == 1 ? statements.front() : arena.make<BlockNode>(std::move(statements));
+                root = prepare(root, options, arena);
+                if (options.jit) {
+                    root = Jit(arena, symbols).compile(root);
+                }
+                batch.chunk = compile_program(root);
+            }
+        }
+        catch (const std::exception& e) {
+            batch.error = std::string("Error: ") + e.what();
+        }
+        batch.chunk.slot_count = static_cast<uint32_t>(symbols.size());
+        const std::vector<std::shared_ptr<Reactive>>& reactives = symbols.get_reactives();
+        batch.reactives.assign(reactives.begin() + sent_reactives, reactives.end());
+        sent_reactives = reactives.size();
+        arena.reset(); // Chunks don't point into the tree, the batch is done with it
+
+        bool failed = !batch.error.empty();
+        if (!out.push(std::move(batch)) || failed) {
+            in.cancel();
+            break;
+        }
+    }
+    out.close();
+}
+
+}
+
+int run_stream(std::FILE* input, const InterpreterOptions& options, const StreamOptions& stream) {
+    // The reader shares its queue, on Windows it can be left behind in a read that never returns
+    std::shared_ptr<SpscQueue<TextBatch>> texts = std::make_shared<SpscQueue<TextBatch>>(stream.queue_depth);
+    SpscQueue<TokenBatch> token_batches(stream.queue_depth);
+    SpscQueue<ChunkBatch> chunks(stream.queue_depth);
+
+#ifdef _WIN32
+    int fd = _fileno(input);
+#else
+    int fd = fileno(input);
+#endif
+    std::thread reader(read_stage, fd, stream.batch_bytes, texts);
+    std::thread lexer(lex_stage, std::ref(*texts), std::ref(token_batches));
+    // The profiler isn't thread safe and --jit-verify needs trees that outlive their batch, neither applies here
+    InterpreterOptions parse_options = options;
+    parse_options.profiler = nullptr;
+    parse_options.jit_verify = false;
+    std::thread parser(parse_stage, std::ref(token_batches), std::ref(chunks), std::cref(parse_options));
+
+    // This thread is the executor, it owns the values
+    MemoryStats::PhaseScope phase(MemoryStats::EXECUTE);
+    std::vector<Value> values;
+    ReactiveGraph graph;
+    VM vm;
+    int status = 0;
+    ChunkBatch batch;
+    while (chunks.pop(batch)) {
+        values.resize(batch.chunk.slot_count);
+        for (std::shared_ptr<Reactive>& reactive : batch.reactives) {
+            graph.add(std::move(reactive));
+        }
+        try {
+            vm.run(batch.chunk, values.data(), graph.empty() ? nullptr : &graph);
+        }
+        catch (const std::exception& e) {
+            batch.error = std::string("Error: ") + e.what(); // A runtime error ends the stream like a parse error
+        }
+        if (!batch.error.empty()) {
+            OutputSink::current().flush();
+            (options.errors ? *options.errors : std::cerr) << batch.error << std::endl;
+            status = 1;
+            // Every stage stops, not just the parser, the input may stay open with nothing more coming for ages
+            chunks.cancel();
+            token_batches.cancel();
+            texts->cancel();
+            break;
+        }
+    }
+
+    parser.join();
+    lexer.join();
+#ifdef _WIN32
+    if (status != 0 && input == stdin) {
+        reader.detach(); // Stuck until the producer writes or closes, it goes away by itself then
+        return status;
+    }
+#endif
+    reader.join();
+    return status;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdio>
+
+#include "Interpreter.h"
+
+/*
+    --stream: runs a program as it arrives, for input too big to hold (or that never ends).
+    Four stages on their own threads, joined by bounded SPSC queues:
+        reader   cuts the input into batches of whole statements (never inside a `{ }` block)
+        lexer    tokenizes each batch
+        parser   parses and compiles it against the symbol table, names -> slots
+        executor runs the chunks in order against the variable values
+    Batches go through in order, so a statement always runs after everything it could depend on. The parser
+    owns the names and the executor owns the values, each chunk says how many slots it needs.
+    Memory stays flat: at most a few batches are in flight at any time.
+*/
+struct StreamOptions {
+    size_t batch_bytes = 64 * 1024; // Roughly how much text goes into one batch
+    size_t queue_depth = 4;         // Batches allowed to wait between two stages
+};
+
+/* Runs everything read from `input` until EOF or the first error, returns the exit status like run_program */
+int run_stream(std::FILE* input, const InterpreterOptions& options, const StreamOptions& stream = StreamOptions());
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+/*
+    Work-stealing thread pool.
+    Every worker has its own queue. Work submitted from outside is dealt out round robin, work submitted by
+    a task goes on its own worker's queue. A worker takes from the back of its own queue and, once that's
+    empty, steals from the front of the others, so one slow script doesn't hold up everything queued
+    behind it.
+*/
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(size_t thread_count = std::thread::hardware_concurrency()) {
+        if (thread_count == 0) {
+            thread_count = 1;
+        }
+        for (size_t i = 0; i < thread_count; i++) {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        for (size_t i = 0; i < thread_count; i++) {
+            threads.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /* Runs everything already submitted, then stops the workers */
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    void submit(Task task) {
+        size_t index = current_pool() == this ? current_worker() : next_queue++ % queues.size();
+        pending++;
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued++;
+        }
+        wake.notify_one();
+    }
+
+    /* Blocks until every submitted task has finished */
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return pending == 0; });
+    }
+
+    size_t size() const {
+        return threads.size();
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    static ThreadPool*& current_pool() {
+        thread_local ThreadPool* pool = nullptr;
+        return pool;
+    }
+
+    static size_t& current_worker() {
+        thread_local size_t worker = 0;
+        return worker;
+    }
+
+    bool take(size_t index, Task& task) {
+        {
+            Queue& own = *queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t offset = 1; offset < queues.size(); offset++) {
+            Queue& victim = *queues[(index + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(size_t index) {
+        current_pool() = this;
+        current_worker() = index;
+
+        Task task;
+        while (true) {
+            if (take(index, task)) {
+                queued--;
+                task();
+                task = nullptr;
+                if (--pending == 0) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    idle.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping && queued <= 0) {
+                return;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::atomic<long> queued{ 0 };   // Tasks sitting in a queue, only goes up under `mutex` so no wakeup is lost
+    std::atomic<size_t> pending{ 0 }; // Tasks submitted but not finished yet
+    std::atomic<size_t> next_queue{ 0 };
+    bool stopping = false;
+};
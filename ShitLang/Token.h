@@ -1,8 +1,9 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <sstream>
-#include <any>
+#include <cstdint>
 
 enum TokenType
 {
@@ -33,9 +34,22 @@ enum TokenType
 	LET,
 	VARIABLE,
 	ASSIGN,
+	BIND,	/* := for a reactive let */
 	UNARY_OP,
 	PRINT,
 	IF,
+	ELSE,
+	WHILE,
+	FN,
+
+	/* Blocks */
+	LBRACE,
+	RBRACE,
+
+	/* Vectors */
+	LBRACKET,
+	RBRACKET,
+	COMMA,
 
 	/* EoF */
 	EoF,
@@ -76,6 +90,8 @@ inline std::string type_to_str(TokenType type)
 		return "VARIABLE";
 	case ASSIGN:
 		return "ASSIGN";
+	case BIND:
+		return "BIND";
 	case UNARY_OP:
 		return "UNARY_OP";
 	case PRINT:
@@ -88,67 +104,78 @@ inline std::string type_to_str(TokenType type)
 		return "AND";
 	case OR:
 		return "OR";
+	case EQEQ:
+		return "EQEQ";
+	case IF:
+		return "IF";
+	case ELSE:
+		return "ELSE";
+	case WHILE:
+		return "WHILE";
+	case FN:
+		return "FN";
+	case LBRACE:
+		return "LBRACE";
+	case RBRACE:
+		return "RBRACE";
+	case LBRACKET:
+		return "LBRACKET";
+	case RBRACKET:
+		return "RBRACKET";
+	case COMMA:
+		return "COMMA";
 	default:
 		return "NONE";
 	}
 }
 
+/*
+	Plain-old-data token: a type tag, a view of the lexeme inside the tokenized source and,
+	for number literals, the already parsed value. Copying one never allocates, but the source
+	text has to outlive the tokens that point into it.
+*/
 class Token
 {
 public:
 
-	Token() {};
+	Token() = default;
 
-	Token(TokenType type, std::any value) : m_value(value), m_type(type) {};
-	std::any get_value() {
-		return m_value;
-	}
-	TokenType get_type() {
+	Token(TokenType type, const char* lexeme, uint32_t length, double number = 0)
+		: m_lexeme(lexeme), m_length(length), m_type(type), m_number(number) {};
+
+	TokenType get_type() const {
 		return m_type;
 	}
+	std::string_view get_text() const {
+		return std::string_view(m_lexeme, m_length);
+	}
+	double get_number() const {
+		return m_number;
+	}
+	/* Byte offset of the lexeme inside the source it was tokenized from */
+	size_t get_offset(std::string_view source) const {
+		return static_cast<size_t>(m_lexeme - source.data());
+	}
 
 	void set_type(TokenType type) {
 		m_type = type;
 	}
-	void set_value(std::any value) {
-		m_value = value;
-	}
 
-	std::string any_to_str(const std::any& a) const {
+	std::string to_str() const {
 		std::ostringstream os;
-		
-		if (a.type() == typeid(int)) {
-			os << std::any_cast<int>(a);
-		}
-		else if (a.type() == typeid(float)) {
-			os << std::any_cast<float>(a);
-		}
-		else if (a.type() == typeid(double)) {
-			os << std::any_cast<double>(a);
-		}
-		else if (a.type() == typeid(std::string)) {
-			os << std::any_cast<std::string>(a);
-		}
-		else if (!a.has_value()) {
-			os << "null";
-		}
-		else if (a.type() == typeid(char)) {
-			os << "char";
+		os << type_to_str(m_type) << " | ";
+		if (m_type == INTEGER || m_type == FLOAT) {
+			os << m_number;
 		}
 		else {
-			os << "Unsupported type";
+			os << get_text();
 		}
-
-		return os.str();
-	}
-
-	std::string to_str() const {
-		std::ostringstream os;
-		os << type_to_str(m_type) << " | " << any_to_str(m_value);
 		return os.str();
 	}
 private:
 
-	std::any m_value;
-	TokenType m_type;
+	const char* m_lexeme = nullptr;
+	uint32_t m_length = 0;
+	TokenType m_type = EoF;
+	double m_number = 0;
 };
\ No newline at end of file
@@ -1,13 +1,71 @@
 #include "Tokenizer.h"
 
-Tokenizer::Tokenizer(const std::string& text) {
+#include <charconv>
+
+#include "Scan.h"
+#include "MemoryStats.h"
+
+/*
+    Keywords are found with a perfect hash on the first and last letter and the length, so a word costs
+    one table probe and at most one compare. The static_assert below catches any new keyword that collides.
+*/
+namespace {
+
+struct Keyword {
+    std::string_view text;
+    TokenType type;
+};
+
+constexpr Keyword keywords[] = {
+    { "let", LET },
+    { "print", PRINT },
+    { "if", IF },
+    { "else", ELSE },
+    { "while", WHILE },
+    { "fn", FN },
+};
+
+constexpr size_t keyword_slots = 16;
+
+constexpr size_t keyword_hash(std::string_view word) {
+    return (static_cast<uint8_t>(word.front()) * 3u + static_cast<uint8_t>(word.back()) + word.size()) & (keyword_slots - 1);
+}
+
+struct KeywordTable {
+    Keyword slots[keyword_slots] = {};
+    bool perfect = true;
+
+    constexpr KeywordTable() {
+        for (const Keyword& keyword : keywords) {
+            Keyword& slot = slots[keyword_hash(keyword.text)];
+            if (!slot.text.empty()) {
+                perfect = false;
+            }
+            slot = keyword;
+        }
+    }
+};
+
+constexpr KeywordTable keyword_table{};
+static_assert(keyword_table.perfect, "Keyword hash collision, change keyword_hash");
+
+// The keyword `word` spells, or EoF when it's just a name
+inline TokenType find_keyword(std::string_view word) {
+    const Keyword& slot = keyword_table.slots[keyword_hash(word)];
+    return slot.text == word ? slot.type : EoF;
+}
+
+}
+
+Tokenizer::Tokenizer(std::string_view text) {
     this->text = text;
-    variables = new std::map<std::string, double>;
+    owned_variables = std::make_unique<Environment>();
+    variables = owned_variables.get();
 }
 
-Tokenizer::Tokenizer(const std::string& text, std::map<std::string, double>* map) {
+Tokenizer::Tokenizer(std::string_view text, Environment* env) {
     this->text = text;
-    variables = map;
+    variables = env;
 }
 
 std::vector<Token> Tokenizer::tokenize() {
@@ -15,87 +73,108 @@ std::vector<Token> Tokenizer::tokenize() {
         error("No tokens in program");
     }
 
+    MemoryStats::CategoryScope memory(MemoryStats::TOKENS);
+    tokens.reserve(text.size() / 4 + 1); // Roughly one token per few characters, saves most of the regrowth
+
     while (position < text.size()) {
         skip_spaces();
+        if (position >= text.size()) {
+            break;
+        }
         current_char = text[position];
 
-        if (isalpha(current_char)) { // Handle words
-            std::string word = get_word();
+        if (scan::is_alpha(current_char)) { // Handle words
+            std::string_view word = get_word();
             handle_word(word);
             position--;
         }
-        else if (current_char == '-' && (tokens.empty() || !isdigit(text[position + 1]) || tokens.back().get_type() == LPAREN || tokens.back().get_type() == PLUS || tokens.back().get_type() == MINUS || tokens.back().get_type() == MULT || tokens.back().get_type() == DIVIDE)) {
+        else if (current_char == '-' && (tokens.empty() || !scan::is_digit(peek()) || tokens.back().get_type() == LPAREN || tokens.back().get_type() == PLUS || tokens.back().get_type() == MINUS || tokens.back().get_type() == MULT || tokens.back().get_type() == DIVIDE)) {
             // Treat as subtraction operator if the '-' is not at the start or not followed by a digit
-            tokens.push_back(Token(MINUS, '-'));
+            add_token(MINUS, position, 1);
         }
-        else if (current_char == '-' && isdigit(text[position + 1])) {
+        else if (current_char == '-' && scan::is_digit(peek())) {
             // Treat as a negative number
+            size_t start = position;
             position++; // Advance position to correctly parse the negative number
-            auto variant = get_number(true);
-            double new_val = std::visit([](auto&& value) -> double {
-                return static_cast<double>(value);
-                }, variant);
-            tokens.push_back(Token(is_whole_number(new_val) ? INTEGER : FLOAT, new_val));
-        }
-        else if (isdigit(current_char)) { // Handle numbers
-            auto variant = get_number(false);
-            double new_val = std::visit([](auto&& value) -> double {
-                return static_cast<double>(value);
-                }, variant);
-            tokens.push_back(Token(is_whole_number(new_val) ? INTEGER : FLOAT, new_val));
+            double new_val = get_number(true);
+            add_token(number_type(start), start, position + 1 - start, new_val);
+        }
+        else if (scan::is_digit(current_char)) { // Handle numbers
+            size_t start = position;
+            double new_val = get_number(false);
+            add_token(number_type(start), start, position + 1 - start, new_val);
         }
         else if (current_char == '\'') {
             /* handle for a char */
         }
         else if (current_char == '^') {
-            tokens.push_back(Token(EXPONENT, '^'));
+            add_token(EXPONENT, position, 1);
         }
         else if (current_char == '+') {
-            tokens.push_back(Token(PLUS, '+'));
+            add_token(PLUS, position, 1);
         }
         else if (current_char == '/') {
-            tokens.push_back(Token(DIVIDE, '/'));
+            add_token(DIVIDE, position, 1);
         }
         else if (current_char == '*') {
-            tokens.push_back(Token(MULT, '*'));
+            add_token(MULT, position, 1);
         }
         else if (current_char == '(') {
-            tokens.push_back(Token(LPAREN, '('));
+            add_token(LPAREN, position, 1);
         }
         else if (current_char == ')') {
-            tokens.push_back(Token(RPAREN, ')'));
+            add_token(RPAREN, position, 1);
+        }
+        else if (current_char == '{') {
+            add_token(LBRACE, position, 1);
+        }
+        else if (current_char == '}') {
+            add_token(RBRACE, position, 1);
+        }
+        else if (current_char == '[') {
+            add_token(LBRACKET, position, 1);
+        }
+        else if (current_char == ']') {
+            add_token(RBRACKET, position, 1);
+        }
+        else if (current_char == ',') {
+            add_token(COMMA, position, 1);
         }
         else if (current_char == '=') {
-            if (text[position + 1] == '=') {
-                tokens.push_back(Token(EQEQ, '='));
+            if (peek() == '=') {
+                add_token(EQEQ, position, 2);
+                position++;
+            }
+            else {
+                add_token(ASSIGN, position, 1); // Reassigning an existing variable
             }
         }
-        else if (current_char == '&' && text[position + 1] == '&') {
+        else if (current_char == '&' && peek() == '&') {
             /* Add && token */
-            tokens.push_back(Token(AND, '&'));
+            add_token(AND, position, 2);
             position++;
         }
-        else if (current_char == '|' && text[position + 1] == '|') {
+        else if (current_char == '|' && peek() == '|') {
             /* Add || token */
-            tokens.push_back(Token(OR, '|'));
+            add_token(OR, position, 2);
             position++;
         }
         else if (current_char == '<') {
-            if (text[position + 1] == '=') {
-                tokens.push_back(Token(LESS_THAN_EQ, ','));
+            if (peek() == '=') {
+                add_token(LESS_THAN_EQ, position, 2);
                 position++;
             }
             else {
-                tokens.push_back(Token(LESS_THAN, '<'));
+                add_token(LESS_THAN, position, 1);
             }
         }
         else if (current_char == '>') {
-            if (text[position + 1] == '=') {
-                tokens.push_back(Token(GREATER_THAN_EQ, '.'));
+            if (peek() == '=') {
+                add_token(GREATER_THAN_EQ, position, 2);
                 position++;
             }
             else {
-                tokens.push_back(Token(GREATER_THAN, '>'));
+                add_token(GREATER_THAN, position, 1);
             }
         }
         else if (current_char != ' ') {
@@ -106,7 +185,11 @@ std::vector<Token> Tokenizer::tokenize() {
         position++;
     }
 
-    return tokens;
+    return std::move(tokens);
+}
+
+void Tokenizer::add_token(TokenType type, size_t start, size_t length, double number) {
+    tokens.push_back(Token(type, text.data() + start, static_cast<uint32_t>(length), number));
 }
 
 // I want a better error message function, having it print something like this:
@@ -122,78 +205,70 @@ void Tokenizer::error(const std::string& message) {
     std::cerr << "Error occurred at position " << position << "\n";
 }
 
-std::variant<int, double> Tokenizer::get_number(bool is_neg) {
+// Scans the literal in place and hands the digits straight to from_chars, nothing gets copied
+double Tokenizer::get_number(bool is_neg) {
     bool is_floating = false;
-    std::string num;
+    size_t digits = position;
 
     while (position < text.size()) {
-        if (isdigit(text[position])) {
-            num += text[position];
-        }
-        else if (text[position] == '.') {
-            if (!is_floating) {
-                num += text[position];
-                is_floating = true;
-            }
-            else {
+        if (text[position] == '.') {
+            if (is_floating) {
                 error("Invalid number");
+                break;
             }
+            is_floating = true;
         }
-        else {
+        else if (!scan::is_digit(text[position])) {
             break;
         }
 
         position++;
     }
 
+    double value = 0;
+    std::from_chars(text.data() + digits, text.data() + position, value);
+
     position--; // Adjust position to not skip non-numeric characters
 
-    if (is_floating) {
-        return stod(num) * (is_neg ? -1 : 1);
-    }
-    else {
-        return stoi(num) * (is_neg ? -1 : 1);
-    }
+    return value * (is_neg ? -1 : 1);
 }
 
-std::string Tokenizer::get_word() {
-    std::string output;
-    while (position < text.size() && isalnum(text[position])) {
-        output += text[position++];
-    }
-    return output;
+std::string_view Tokenizer::get_word() {
+    size_t start = position;
+    position = scan::skip_alnum(text.data() + position, text.data() + text.size()) - text.data();
+    return text.substr(start, position - start);
 }
 
 void Tokenizer::skip_spaces() {
-    while (position < text.size() && isspace(text[position])) {
-        position++;
-    }
+    position = scan::skip_spaces(text.data() + position, text.data() + text.size()) - text.data();
 }
 
-void Tokenizer::handle_word(const std::string& word) {
-    if (word == "let") {
-        tokens.push_back(Token(LET, "LET"));
+void Tokenizer::handle_word(std::string_view word) {
+    TokenType keyword = word.empty() ? EoF : find_keyword(word);
+    if (keyword == LET) {
+        add_token(LET, word.data() - text.data(), word.size());
         skip_spaces();
 
-        std::string var_name = get_word(); // Expect a variable name
-        tokens.push_back(Token(VARIABLE, var_name));
+        std::string_view var_name = get_word(); // Expect a variable name
+        add_token(VARIABLE, var_name.data() - text.data(), var_name.size());
         skip_spaces();
         if (position < text.size() && text[position] == '=') {
+            add_token(ASSIGN, position, 1);
             position++; // Move past '='
-            tokens.push_back(Token(ASSIGN, '='));
+        }
+        else if (position + 1 < text.size() && text[position] == ':' && text[position + 1] == '=') {
+            add_token(BIND, position, 2);
+            position += 2; // `let y := ...`, a reactive variable
         }
         else {
             error("Expected '=' after variable name");
         }
     }
-    else if (word == "print") {
-        tokens.push_back(Token(PRINT, "print"));
-    }
-    else if (word == "if") {
-        /* Handle if statements */
+    else if (keyword != EoF) {
+        add_token(keyword, word.data() - text.data(), word.size());
     }
     else {
-        tokens.push_back(Token(VARIABLE, word)); // Handle it as a variable usage
+        add_token(VARIABLE, word.data() - text.data(), word.size()); // Handle it as a variable usage
     }
 }
 
@@ -202,6 +277,6 @@ void Tokenizer::create_variable() {
     // Implement variable creation logic
 }
 
-void Tokenizer::run(std::vector<Token> tokens) {
+void Tokenizer::run(const std::vector<Token>& tokens) {
     // Implement token execution logic
 }
@@ -2,21 +2,24 @@
 
 #include <vector>
 #include <iostream>
-#include <variant>
 #include <cmath>
-#include <map>
+#include <memory>
+#include <string_view>
 
 #include "Token.h"
+#include "Environment.h"
 
 class Tokenizer
 {
 public:
-	Tokenizer(const std::string& text);
-	Tokenizer(const std::string& text, std::map<std::string, double>* map);
+	// Tokens point into `text`, so it has to stay alive for as long as they are used
+	Tokenizer(std::string_view text);
+	Tokenizer(std::string_view text, Environment* env);
 
 	std::vector<Token> tokenize();
-	void run(std::vector<Token> tokens);
-	std::map<std::string, double>* get_variables() {
+	void run(const std::vector<Token>& tokens);
+	/* The environment scripts run against; Environment::to_map() gives a name -> value snapshot */
+	Environment* get_variables() {
 		return variables;
 	}
 	
@@ -24,25 +27,31 @@ private:
 
 	void error(const std::string& message);
 
-	bool is_whole_number(double number, double epsilon = 1e-8) {
-		return floor(number) == number;
-		/*return std::fabs(number - std::round(number)) < epsilon;*/
+	/* A literal is a FLOAT if it is written with a '.', so `3.0` is a double and `3` an int */
+	TokenType number_type(size_t start) const {
+		return text.substr(start, position + 1 - start).find('.') == std::string_view::npos ? INTEGER : FLOAT;
 	}
 
 	// void tokenize_operators();
 	
-	std::variant<int, double> get_number(bool is_neg);
+	double get_number(bool is_neg);
+	void add_token(TokenType type, size_t start, size_t length, double number = 0);
 
-	std::string get_word();
-	void handle_word(const std::string& word);
+	std::string_view get_word();
+	void handle_word(std::string_view word);
 	void create_variable();
 	void skip_spaces();
 
-	std::map<std::string, double>* variables;
+	/* Character after the current one, or '\0' past the end of the text */
+	char peek() const {
+		return position + 1 < text.size() ? text[position + 1] : '\0';
+	}
+
+	Environment* variables;
+	std::unique_ptr<Environment> owned_variables; // Only set when no environment was passed in
 	std::vector<Token> tokens;
-	std::string text = "";
+	std::string_view text;
 
 	size_t position = 0;
 	char current_char;
-	Token current_token;
 };
\ No newline at end of file
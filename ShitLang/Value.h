@@ -0,0 +1,438 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
+
+#include "MemoryStats.h"
+
+enum class ValueType : uint8_t {
+    INT,
+    DOUBLE,
+    VECTOR, // The only real type with this bit set, Value tests for it in one go
+    UNKNOWN, // Only ever the answer of Node::static_type(), a real value is always one of the three above
+};
+
+/*
+    The elements of a vector value: doubles in one block right after this header, 32-byte aligned so the
+    SIMD kernels can stream through them. Reference counted by the Values pointing at it, so `let w = v`
+    copies a pointer. Elements only ever get overwritten while a single Value holds the vector (see
+    Vector.cpp), so sharing one is safe. Not thread safe, a vector belongs to the program that made it.
+*/
+class alignas(32) Vector {
+public:
+    /* A new vector with uninitialized elements and one reference, the caller's */
+    static Vector* create(size_t size) {
+        MemoryStats::CategoryScope category(MemoryStats::VECTORS);
+        void* memory = ::operator new(sizeof(Vector) + size * sizeof(double), std::align_val_t(alignof(Vector)));
+        return new (memory) Vector(size);
+    }
+
+    void retain() {
+        references++;
+    }
+
+    // Out of line in Vector.cpp (and noexcept), so ~Value is a test and a call that GCC inlines everywhere
+    void release() noexcept;
+
+    /* Nothing but the one Value holding it can see it, so its elements can be written over */
+    bool unique() const {
+        return references == 1;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    double* data() {
+        return reinterpret_cast<double*>(this + 1);
+    }
+
+    const double* data() const {
+        return reinterpret_cast<const double*>(this + 1);
+    }
+
+private:
+    explicit Vector(size_t size) : count(size) {}
+
+    size_t count;
+    uint32_t references = 1;
+};
+
+struct Value;
+
+/* The vector half of every operator, out of line in Vector.cpp since it's never the hot path */
+namespace vectors {
+Value make(const Value* elements, size_t count);
+Value add(const Value& a, const Value& b);
+Value subtract(const Value& a, const Value& b);
+Value multiply(const Value& a, const Value& b);
+Value divide(const Value& a, const Value& b);
+Value power(const Value& a, const Value& b);
+Value power(const Value& base, int32_t exponent);
+Value negate(const Value& a);
+Value less(const Value& a, const Value& b);
+Value greater(const Value& a, const Value& b);
+Value less_equal(const Value& a, const Value& b);
+Value greater_equal(const Value& a, const Value& b);
+Value equal(const Value& a, const Value& b);
+Value logical_and(const Value& a, const Value& b);
+Value logical_or(const Value& a, const Value& b);
+Value sum(const Value& a);
+Value min(const Value& a);
+Value max(const Value& a);
+[[noreturn]] void not_a_condition();
+}
+
+/*
+    Every value a program works with: a 64-bit integer, a double or a vector of doubles, with a tag saying which.
+    Integer literals (no '.') are ints, and ints stay ints through + - * ^ and exact division, so counters
+    and IDs keep every bit past 2^53 and use the integer ALU. An int that would overflow turns into a double
+    instead of wrapping, and anything mixed with a double is done in doubles, the way it always was.
+    Relational operators give the ints 1 and 0. Copying a vector value shares its elements.
+*/
+struct Value {
+    union {
+        int64_t integer;
+        double number;
+        Vector* vector;
+    };
+    ValueType type;
+
+    Value() : integer(0), type(ValueType::INT) {}
+    Value(int value) : integer(value), type(ValueType::INT) {}
+    Value(int64_t value) : integer(value), type(ValueType::INT) {}
+    Value(double value) : number(value), type(ValueType::DOUBLE) {}
+    explicit Value(Vector* elements) : vector(elements), type(ValueType::VECTOR) {} // Takes over the caller's reference
+
+    // All 16 bytes in one go, and the type read from `other`: this is every push in the VM
+    Value(const Value& other) {
+        if (other.is_vector()) {
+            other.vector->retain();
+        }
+        std::memcpy(static_cast<void*>(this), &other, sizeof(Value));
+    }
+
+    Value(Value&& other) noexcept : type(other.type) {
+        std::memcpy(&integer, &other.integer, sizeof(integer));
+        other.type = ValueType::INT;
+    }
+
+    Value& operator=(const Value& other) {
+        if (either_vector(*this, other)) {
+            if (other.is_vector()) {
+                other.vector->retain(); // First, in case it's the vector this already holds
+            }
+            if (is_vector()) {
+                vector->release();
+            }
+        }
+        std::memcpy(&integer, &other.integer, sizeof(integer));
+        type = other.type;
+        return *this;
+    }
+
+    Value& operator=(Value&& other) noexcept {
+        if (this != &other) {
+            if (is_vector()) {
+                vector->release();
+            }
+            std::memcpy(&integer, &other.integer, sizeof(integer));
+            type = other.type;
+            other.type = ValueType::INT;
+        }
+        return *this;
+    }
+
+    ~Value() {
+        if (is_vector()) {
+            vector->release();
+        }
+    }
+
+    bool is_int() const {
+        return type == ValueType::INT;
+    }
+
+    bool is_vector() const {
+        return type == ValueType::VECTOR;
+    }
+
+    /* One test for both, on the path every number takes */
+    static bool either_vector(const Value& a, const Value& b) {
+        return (static_cast<uint8_t>(a.type) | static_cast<uint8_t>(b.type)) & static_cast<uint8_t>(ValueType::VECTOR);
+    }
+
+    /* Only for numbers, a vector has no single double */
+    double to_double() const {
+        return is_int() ? static_cast<double>(integer) : number;
+    }
+
+    /* What if/while go by, any number that isn't 0 (NaN included). A vector throws, it has no one answer. */
+    bool is_true() const {
+        if (is_int()) {
+            return integer != 0;
+        }
+        if (is_vector()) {
+            vectors::not_a_condition();
+        }
+        return number != 0;
+    }
+
+    /* Same type and same bits, so 0 and -0.0 or two different NaNs are told apart. Vectors compare every element. */
+    bool identical(const Value& other) const {
+        if (type != other.type) {
+            return false;
+        }
+        if (is_vector()) {
+            return vector->size() == other.vector->size()
+                && std::memcmp(vector->data(), other.vector->data(), vector->size() * sizeof(double)) == 0;
+        }
+        return std::memcmp(&integer, &other.integer, sizeof(integer)) == 0;
+    }
+
+    /* The raw 64 bits, what constant pools and --jit-verify key on */
+    uint64_t bits() const {
+        uint64_t result;
+        std::memcpy(&result, &integer, sizeof(result));
+        return result;
+    }
+};
+
+/*
+    The exponents the optimizer turns ^ into something cheaper for. x * x and 1 / x round exactly like
+    std::pow(x, 2) and std::pow(x, -1), a longer chain of multiplies wouldn't, so nothing bigger is in here.
+*/
+constexpr bool is_reduced_power(double exponent) {
+    return exponent == -1 || exponent == 0 || exponent == 1 || exponent == 2;
+}
+
+/* base ^ exponent, bit for bit what std::pow gives */
+inline double integer_power(double base, int32_t exponent) {
+    switch (exponent) {
+    case 0: return 1;
+    case 1: return base;
+    case 2: return base * base;
+    case -1: return 1 / base;
+    default: return std::pow(base, static_cast<double>(exponent)); // Only from a .slc written before the limit
+    }
+}
+
+/*
+    The arithmetic every evaluator shares (tree, VM, optimizer folding), so they can't disagree.
+    Anything with a vector in it goes to vectors::, numbers to arith::numbers, which has the int/int fast
+    path first and falls back to doubles. A vector operand that no other Value shares may get the result
+    written over its elements, so only pass vectors that are done with.
+*/
+namespace arith {
+
+// Overflow checks, false and the result in `out` when it fits
+inline bool add(int64_t a, int64_t b, int64_t& out) {
+#if defined(__GNUC__) || defined(__clang__)
+    return !__builtin_add_overflow(a, b, &out);
+#else
+    if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b)) {
+        return false;
+    }
+    out = a + b;
+    return true;
+#endif
+}
+
+inline bool subtract(int64_t a, int64_t b, int64_t& out) {
+#if defined(__GNUC__) || defined(__clang__)
+    return !__builtin_sub_overflow(a, b, &out);
+#else
+    if ((b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b)) {
+        return false;
+    }
+    out = a - b;
+    return true;
+#endif
+}
+
+inline bool multiply(int64_t a, int64_t b, int64_t& out) {
+#if defined(__GNUC__) || defined(__clang__)
+    return !__builtin_mul_overflow(a, b, &out);
+#else
+    if (a != 0 && b != 0) {
+        bool fits = a > 0 ? (b > 0 ? a <= INT64_MAX / b : b >= INT64_MIN / a)
+                          : (b > 0 ? a >= INT64_MIN / b : a >= INT64_MAX / b);
+        if (!fits) {
+            return false;
+        }
+    }
+    out = a * b;
+    return true;
+#endif
+}
+
+/* base ^ exponent for exponent >= 0, squaring in ints until something overflows */
+inline Value integer_power(int64_t base, int64_t exponent) {
+    int64_t result = 1;
+    int64_t square = base;
+    uint64_t n = static_cast<uint64_t>(exponent);
+    while (n) {
+        if ((n & 1) && !multiply(result, square, result)) {
+            break;
+        }
+        n >>= 1;
+        if (n && !multiply(square, square, square)) {
+            break;
+        }
+    }
+    if (n == 0) {
+        return result;
+    }
+    // Too big for an int, same answer the doubles always gave
+    return std::pow(static_cast<double>(base), static_cast<double>(exponent));
+}
+
+/* Numbers only: the int/int fast path, then doubles. What the VM runs once it has ruled out vectors. */
+namespace numbers {
+
+inline Value add(const Value& a, const Value& b) {
+    int64_t result;
+    if (a.is_int() && b.is_int() && arith::add(a.integer, b.integer, result)) {
+        return result;
+    }
+    return a.to_double() + b.to_double();
+}
+
+inline Value subtract(const Value& a, const Value& b) {
+    int64_t result;
+    if (a.is_int() && b.is_int() && arith::subtract(a.integer, b.integer, result)) {
+        return result;
+    }
+    return a.to_double() - b.to_double();
+}
+
+inline Value multiply(const Value& a, const Value& b) {
+    int64_t result;
+    if (a.is_int() && b.is_int() && arith::multiply(a.integer, b.integer, result)) {
+        return result;
+    }
+    return a.to_double() * b.to_double();
+}
+
+/* Ints stay ints when the division is exact, 7 / 2 is still 3.5 */
+inline Value divide(const Value& a, const Value& b) {
+    if (a.is_int() && b.is_int() && b.integer != 0 && !(b.integer == -1 && a.integer == INT64_MIN)
+        && a.integer % b.integer == 0) {
+        return a.integer / b.integer;
+    }
+    return a.to_double() / b.to_double();
+}
+
+inline Value power(const Value& a, const Value& b) {
+    if (a.is_int() && b.is_int() && b.integer >= 0) {
+        return integer_power(a.integer, b.integer);
+    }
+    return std::pow(a.to_double(), b.to_double());
+}
+
+/* What OP_POWI and IntegerPowerNode do, the exponent is a literal the optimizer already checked */
+inline Value power(const Value& base, int32_t exponent) {
+    if (base.is_int() && exponent >= 0) {
+        return integer_power(base.integer, exponent);
+    }
+    return ::integer_power(base.to_double(), exponent);
+}
+
+inline Value negate(const Value& a) {
+    if (a.is_int() && a.integer != INT64_MIN) {
+        return -a.integer;
+    }
+    return -a.to_double();
+}
+
+// Ints compare as ints, anything mixed compares as doubles
+inline Value less(const Value& a, const Value& b) {
+    return a.is_int() && b.is_int() ? a.integer < b.integer : a.to_double() < b.to_double();
+}
+
+inline Value greater(const Value& a, const Value& b) {
+    return a.is_int() && b.is_int() ? a.integer > b.integer : a.to_double() > b.to_double();
+}
+
+inline Value less_equal(const Value& a, const Value& b) {
+    return a.is_int() && b.is_int() ? a.integer <= b.integer : a.to_double() <= b.to_double();
+}
+
+inline Value greater_equal(const Value& a, const Value& b) {
+    return a.is_int() && b.is_int() ? a.integer >= b.integer : a.to_double() >= b.to_double();
+}
+
+inline Value equal(const Value& a, const Value& b) {
+    return a.is_int() && b.is_int() ? a.integer == b.integer : a.to_double() == b.to_double();
+}
+
+inline Value logical_and(const Value& a, const Value& b) {
+    return a.is_true() && b.is_true();
+}
+
+inline Value logical_or(const Value& a, const Value& b) {
+    return a.is_true() || b.is_true();
+}
+
+}
+
+#define SHITLANG_ARITH_BINARY(name) \
+    inline Value name(const Value& a, const Value& b) { \
+        return Value::either_vector(a, b) ? vectors::name(a, b) : numbers::name(a, b); \
+    }
+
+SHITLANG_ARITH_BINARY(add)
+SHITLANG_ARITH_BINARY(subtract)
+SHITLANG_ARITH_BINARY(multiply)
+SHITLANG_ARITH_BINARY(divide)
+SHITLANG_ARITH_BINARY(power)
+SHITLANG_ARITH_BINARY(less)
+SHITLANG_ARITH_BINARY(greater)
+SHITLANG_ARITH_BINARY(less_equal)
+SHITLANG_ARITH_BINARY(greater_equal)
+SHITLANG_ARITH_BINARY(equal)
+SHITLANG_ARITH_BINARY(logical_and)
+SHITLANG_ARITH_BINARY(logical_or)
+
+#undef SHITLANG_ARITH_BINARY
+
+inline Value power(const Value& base, int32_t exponent) {
+    return base.is_vector() ? vectors::power(base, exponent) : numbers::power(base, exponent);
+}
+
+inline Value negate(const Value& a) {
+    return a.is_vector() ? vectors::negate(a) : numbers::negate(a);
+}
+
+/*
+    Static type of `a op b` for + - * / ^: anything with a vector in it is a vector, a double with a number
+    is a double, int op int depends on the values. A double with an UNKNOWN could still be a vector.
+*/
+constexpr ValueType arithmetic_type(ValueType a, ValueType b) {
+    if (a == ValueType::VECTOR || b == ValueType::VECTOR) {
+        return ValueType::VECTOR;
+    }
+    if (a == ValueType::UNKNOWN || b == ValueType::UNKNOWN) {
+        return ValueType::UNKNOWN;
+    }
+    return a == ValueType::DOUBLE || b == ValueType::DOUBLE ? ValueType::DOUBLE : ValueType::UNKNOWN;
+}
+
+/* Static type of a comparison, && or ||: the ints 1 and 0 for two numbers, a vector of them with a vector */
+constexpr ValueType relational_type(ValueType a, ValueType b) {
+    if (a == ValueType::VECTOR || b == ValueType::VECTOR) {
+        return ValueType::VECTOR;
+    }
+    return a == ValueType::UNKNOWN || b == ValueType::UNKNOWN ? ValueType::UNKNOWN : ValueType::INT;
+}
+
+/* Static type of -x and x ^ n: doubles and vectors stay what they are, an int could overflow into a double */
+constexpr ValueType unary_type(ValueType a) {
+    return a == ValueType::DOUBLE || a == ValueType::VECTOR ? a : ValueType::UNKNOWN;
+}
+
+}
@@ -0,0 +1,141 @@
+#include "Value.h"
+
+#include <stdexcept>
+#include <string>
+
+#include "Kernels.h"
+
+void Vector::release() noexcept {
+    if (--references == 0) {
+        this->~Vector();
+        ::operator delete(this, std::align_val_t(alignof(Vector)));
+    }
+}
+
+namespace vectors {
+
+namespace {
+
+// A number is a one element operand that gets broadcast, `scalar` keeps its double alive for the kernel
+kernels::Operand operand(const Value& value, double& scalar) {
+    if (value.is_vector()) {
+        return { value.vector->data(), value.vector->size() == 1 };
+    }
+    scalar = value.to_double();
+    return { &scalar, true };
+}
+
+size_t length(const Value& value) {
+    return value.is_vector() ? value.vector->size() : 1;
+}
+
+// Same length, or one side is a number or a single element and goes with every element of the other
+size_t result_length(const Value& a, const Value& b) {
+    size_t n = length(a);
+    size_t m = length(b);
+    if (n == m || m == 1) {
+        return n;
+    }
+    if (n == 1) {
+        return m;
+    }
+    throw std::runtime_error("Vector sizes don't match: " + std::to_string(n) + " and " + std::to_string(m));
+}
+
+// A vector nobody else holds is about to be thrown away by the caller, so the result can go into it
+bool reusable(const Value& value, size_t n) {
+    return value.is_vector() && value.vector->unique() && value.vector->size() == n;
+}
+
+Value output(const Value& a, const Value& b, size_t n) {
+    if (reusable(a, n)) {
+        return a;
+    }
+    if (reusable(b, n)) {
+        return b;
+    }
+    return Value(Vector::create(n));
+}
+
+Value elementwise(kernels::Op op, const Value& a, const Value& b) {
+    size_t n = result_length(a, b);
+    double scalar_a;
+    double scalar_b;
+    kernels::Operand x = operand(a, scalar_a);
+    kernels::Operand y = operand(b, scalar_b);
+    Value result = output(a, b, n);
+    kernels::binary(op, x, y, result.vector->data(), n);
+    return result;
+}
+
+}
+
+Value make(const Value* elements, size_t count) {
+    Value result(Vector::create(count));
+    double* data = result.vector->data();
+    for (size_t i = 0; i < count; i++) {
+        if (elements[i].is_vector()) {
+            throw std::runtime_error("A vector can only hold numbers");
+        }
+        data[i] = elements[i].to_double();
+    }
+    return result;
+}
+
+Value add(const Value& a, const Value& b) { return elementwise(kernels::Op::ADD, a, b); }
+Value subtract(const Value& a, const Value& b) { return elementwise(kernels::Op::SUBTRACT, a, b); }
+Value multiply(const Value& a, const Value& b) { return elementwise(kernels::Op::MULTIPLY, a, b); }
+Value divide(const Value& a, const Value& b) { return elementwise(kernels::Op::DIVIDE, a, b); }
+Value power(const Value& a, const Value& b) { return elementwise(kernels::Op::POWER, a, b); }
+Value less(const Value& a, const Value& b) { return elementwise(kernels::Op::LESS, a, b); }
+Value greater(const Value& a, const Value& b) { return elementwise(kernels::Op::GREATER, a, b); }
+Value less_equal(const Value& a, const Value& b) { return elementwise(kernels::Op::LESS_EQ, a, b); }
+Value greater_equal(const Value& a, const Value& b) { return elementwise(kernels::Op::GREATER_EQ, a, b); }
+Value equal(const Value& a, const Value& b) { return elementwise(kernels::Op::EQUAL, a, b); }
+Value logical_and(const Value& a, const Value& b) { return elementwise(kernels::Op::AND, a, b); }
+Value logical_or(const Value& a, const Value& b) { return elementwise(kernels::Op::OR, a, b); }
+
+Value power(const Value& base, int32_t exponent) {
+    size_t n = base.vector->size();
+    Value result = output(base, base, n);
+    kernels::integer_power({ base.vector->data(), false }, exponent, result.vector->data(), n);
+    return result;
+}
+
+Value negate(const Value& a) {
+    size_t n = a.vector->size();
+    Value result = output(a, a, n);
+    kernels::negate({ a.vector->data(), false }, result.vector->data(), n);
+    return result;
+}
+
+// A number on its own is a vector of one, so it reduces to itself
+Value sum(const Value& a) {
+    return a.is_vector() ? Value(kernels::sum(a.vector->data(), a.vector->size())) : a;
+}
+
+Value min(const Value& a) {
+    if (!a.is_vector()) {
+        return a;
+    }
+    if (a.vector->size() == 0) {
+        throw std::runtime_error("min of an empty vector");
+    }
+    return kernels::min(a.vector->data(), a.vector->size());
+}
+
+Value max(const Value& a) {
+    if (!a.is_vector()) {
+        return a;
+    }
+    if (a.vector->size() == 0) {
+        throw std::runtime_error("max of an empty vector");
+    }
+    return kernels::max(a.vector->data(), a.vector->size());
+}
+
+void not_a_condition() {
+    throw std::runtime_error("A vector can't be a condition, reduce it with sum, min or max first");
+}
+
+}
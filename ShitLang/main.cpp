@@ -1,77 +1,321 @@
 #include <iostream>
-#include <fstream>
 #include <string>
+#include <algorithm>
+#include <fstream>
 #include <vector>
-#include <map>
-
-#include "Tokenizer.h"
-#include "Parser.h"
-#include "Node.h"
+#include <memory>
+#include <charconv>
+#include <cstring>
 
-#define disp(msg) // std::cout << msg << std::endl;
+#include "Interpreter.h"
+#include "Arena.h"
+#include "Environment.h"
+#include "OutputSink.h"
+#include "Profiler.h"
+#include "Batch.h"
+#include "Runner.h"
+#include "Jit.h"
+#include "Stream.h"
+#include "Server.h"
+#include "MemoryStats.h"
 
-void interpret(const std::string& input, std::map<std::string, double>& variables) {
-    Tokenizer toker(input, &variables);
-    std::vector<Token> tokens = toker.tokenize();
-
-    for (Token t : tokens) {
-        disp(t.to_str());
+// The number after an option like --jobs, false unless the whole argument is one and it's at least `min`
+static bool parse_size(const char* text, size_t min, size_t& out) {
+    const char* end = text + std::strlen(text);
+    size_t value = 0;
+    std::from_chars_result result = std::from_chars(text, end, value);
+    if (result.ec != std::errc() || result.ptr != end || value < min) {
+        return false;
     }
+    out = value;
+    return true;
+}
 
-    if (tokens.empty()) {
-        // std::cout << "No expression to evaluate or syntax error." << std::endl;
-        return;
+static int invalid_value(const std::string& option) {
+    std::cerr << "Invalid value for " << option << std::endl;
+    return 1;
+}
+
+// "a,b,c" -> { "a", "b", "c" }
+static std::vector<std::string> split_names(const std::string& list) {
+    std::vector<std::string> names;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = std::min(list.find(',', start), list.size());
+        names.push_back(list.substr(start, comma - start));
+        start = comma + 1;
     }
+    return names;
+}
 
+// Batch mode, `expression` over every row of a CSV or binary column file
+static int run_batch(const std::string& expression, const std::string& csv, const std::string& binary, const std::string& columns, const InterpreterOptions& options) {
     try {
-        Parser parser(tokens, &variables);
-        Node* root = parser.parse();
-
-        if (root != nullptr) {
-            double result = root->evaluate();
+        std::unique_ptr<ColumnReader> reader;
+        if (!csv.empty()) {
+            reader = std::make_unique<CsvColumns>(csv);
+        }
+        else if (!binary.empty()) {
+            reader = std::make_unique<BinaryColumns>(binary, columns.empty() ? std::vector<std::string>() : split_names(columns));
         }
         else {
-            std::cout << "No expression to evaluate." << std::endl;
+            std::cerr << "--batch needs --csv <file> or --binary <file> --columns <names>" << std::endl;
+            return 1;
         }
 
-        delete root;
+        BatchExpression batch(expression, reader->get_names(), options.optimize);
+        batch.run(*reader, OutputSink::standard());
     }
     catch (const std::exception& e) {
+        OutputSink::standard().flush();
         std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
     }
+    return 0;
 }
 
+// --run-all, every script on the thread pool with its output printed in the order they were listed
+static int run_all(const std::string& scripts, size_t jobs, const InterpreterOptions& options) {
+    std::vector<std::string> paths;
+    try {
+        paths = collect_scripts(scripts);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    OutputSink& output = OutputSink::standard();
+    size_t failed = run_scripts(paths, jobs, options, [&](const ScriptResult& result) {
+        output.write(result.output);
+        if (!result.errors.empty()) {
+            output.flush();
+            std::cerr << result.path << ": " << result.errors << std::flush;
+        }
+    });
+    return failed == 0 ? 0 : 1;
+}
+
+// Prints the --profile report, or writes it as JSON when a path was given
+static void write_profile(const Profiler& profiler, const std::string& path) {
+    OutputSink::standard().flush(); // Program output first, report after it
+    if (path.empty()) {
+        profiler.report(std::cerr);
+        return;
+    }
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "Failed to write profile: " << path << std::endl;
+        return;
+    }
+    profiler.write_json(out);
+}
+
+// --mem-stats, prints the report as main returns, after the program's output
+struct MemoryReport {
+    bool enabled = false;
+
+    ~MemoryReport() {
+        if (enabled) {
+            OutputSink::standard().flush();
+            MemoryStats::report(std::cerr);
+        }
+    }
+};
+
 int main(int argc, char** argv) {
-    std::map<std::string, double> variables;
+    Environment variables;
+    Arena arena;
+    InterpreterOptions options;
+    std::string filename;
+    Profiler profiler;
+    bool profiling = false;
+    std::string profile_path;
+    std::string batch_expression, batch_csv, batch_binary, batch_columns;
+    std::string run_all_scripts;
+    size_t jobs = 0;
+    size_t cache_size = StatementCache::default_capacity;
+    bool cache_stats = false;
+    bool streaming = false;
+    StreamOptions stream_options;
+    std::string serve_path;
+    bool mem_stats = false;
 
-    if (argc > 1) {
-        // File mode
-        std::string filename = argv[1];
-        std::ifstream file(filename);
-        if (!file.is_open()) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--no-optimize" || arg == "-O0") {
+            options.optimize = false;
+        }
+        else if (arg == "--line-buffered") {
+            options.line_buffered = true;
+        }
+        else if (arg == "--output-buffer" && i + 1 < argc) {
+            if (!parse_size(argv[++i], 0, options.output_buffer)) {
+                return invalid_value(arg);
+            }
+        }
+        else if (arg == "--profile" || arg.rfind("--profile=", 0) == 0) {
+            profiling = true;
+            profile_path = arg.size() > 10 ? arg.substr(10) : "";
+        }
+        else if (arg == "--stream") {
+            streaming = true;
+        }
+        else if (arg == "--stream-batch" && i + 1 < argc) {
+            if (!parse_size(argv[++i], 1, stream_options.batch_bytes)) {
+                return invalid_value(arg);
+            }
+        }
+        else if (arg == "--jit") {
+            options.jit = true;
+        }
+        else if (arg == "--jit-verify") {
+            options.jit_verify = true;
+        }
+        else if (arg == "--cache-size" && i + 1 < argc) {
+            if (!parse_size(argv[++i], 0, cache_size)) {
+                return invalid_value(arg);
+            }
+        }
+        else if (arg == "--cache-stats") {
+            cache_stats = true;
+        }
+        else if (arg == "--bytecode-cache") {
+            options.bytecode_cache = true;
+        }
+        else if (arg == "--bytecode-cache-dir" && i + 1 < argc) {
+            options.bytecode_cache_dir = argv[++i];
+        }
+        else if (arg == "--batch" && i + 1 < argc) {
+            batch_expression = argv[++i];
+        }
+        else if (arg == "--csv" && i + 1 < argc) {
+            batch_csv = argv[++i];
+        }
+        else if (arg == "--binary" && i + 1 < argc) {
+            batch_binary = argv[++i];
+        }
+        else if (arg == "--columns" && i + 1 < argc) {
+            batch_columns = argv[++i];
+        }
+        else if (arg == "--run-all" && i + 1 < argc) {
+            run_all_scripts = argv[++i];
+        }
+        else if ((arg == "--jobs" || arg == "-j") && i + 1 < argc) {
+            if (!parse_size(argv[++i], 0, jobs)) {
+                return invalid_value(arg);
+            }
+        }
+        else if (arg == "--serve" && i + 1 < argc) {
+            serve_path = argv[++i];
+        }
+        else if (arg == "--mem-stats") {
+            mem_stats = true;
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+        else {
+            filename = arg;
+        }
+    }
+
+    if (profiling) {
+        options.profiler = &profiler;
+    }
+    MemoryReport memory_report;
+    if (mem_stats) {
+        MemoryStats::enable();
+        memory_report.enabled = true;
+    }
+    if ((options.jit || options.jit_verify) && !Jit::available()) {
+        std::cerr << "The JIT only works on x86-64, running everything in the interpreter" << std::endl;
+    }
+
+    // The REPL always flushes per line so prompts and results come out in order
+    OutputSink& output = OutputSink::standard();
+    output.set_capacity(options.output_buffer);
+    if (options.line_buffered || (filename.empty() && !streaming && batch_expression.empty() && run_all_scripts.empty() && serve_path.empty())) {
+        output.set_mode(OutputSink::Mode::LineBuffered);
+    }
+
+    if (!batch_expression.empty()) {
+        return run_batch(batch_expression, batch_csv, batch_binary, batch_columns, options);
+    }
+    if (!run_all_scripts.empty()) {
+        return run_all(run_all_scripts, jobs, options);
+    }
+    if (!serve_path.empty()) {
+        ServerOptions server_options;
+        server_options.threads = jobs;
+        server_options.cache_size = cache_size;
+        return run_server(serve_path, options, server_options);
+    }
+    if (streaming) {
+        // Reads the file if there is one, stdin otherwise
+        std::FILE* input = filename.empty() ? stdin : std::fopen(filename.c_str(), "rb");
+        if (input == nullptr) {
             std::cerr << "Failed to open file: " << filename << std::endl;
             return 1;
         }
+        int status = run_stream(input, options, stream_options);
+        if (input != stdin) {
+            std::fclose(input);
+        }
+        return status;
+    }
 
-        std::string line;
-        while (std::getline(file, line)) {
-            if (!line.empty()) {
-                interpret(line, variables);
+    if (!filename.empty()) {
+        // File mode
+        try {
+            int status = run_file(filename, variables, arena, options);
+            if (options.jit_verify) {
+                OutputSink::standard().flush();
+                std::cerr << "jit-verify: " << VM::native_checks() << " native results matched the interpreter" << std::endl;
+            }
+            if (profiling) {
+                write_profile(profiler, profile_path);
             }
+            return status;
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
         }
     }
     else {
-        // Interactive mode
+        // Interactive mode, repeated lines come out of the statement cache
+        StatementCache cache(cache_size);
+        options.cache = &cache;
         std::string data;
+        std::string line;
         while (true) {
-            std::cout << ">>> ";
-            std::getline(std::cin, data);
+            std::cout << (data.empty() ? ">>> " : "... ");
+            if (!std::getline(std::cin, line)) {
+                break;
+            }
 
-            if (data == "exit") {
+            if (data.empty() && line == "exit") {
                 break;
             }
 
-            interpret(data, variables);
+            // Keep reading until every `{` is closed, so blocks can span lines
+            data += line;
+            data += '\n';
+            if (std::count(data.begin(), data.end(), '{') > std::count(data.begin(), data.end(), '}')) {
+                continue;
+            }
+
+            interpret(data, variables, arena, options);
+            data.clear();
+        }
+
+        if (profiling) {
+            write_profile(profiler, profile_path);
+        }
+        if (cache_stats) {
+            std::cerr << "statement cache: " << cache.get_hits() << " hits, " << cache.get_misses() << " misses" << std::endl;
         }
     }
 
@@ -0,0 +1,260 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+
+#include "Tokenizer.h"
+#include "Parser.h"
+#include "Optimizer.h"
+#include "Interpreter.h"
+#include "Arena.h"
+#include "Environment.h"
+#include "OutputSink.h"
+#include "Prepared.h"
+#include "StaticExpression.h"
+
+/*
+    Throughput benchmark for each phase of the interpreter.
+    Every workload is generated from fixed parameters, so two runs (or two commits) see exactly the
+    same input. Each phase runs --repeat times and the fastest run is reported.
+
+    usage: shitlang_bench [--scale N] [--repeat N] [--filter name]
+*/
+
+#ifdef _WIN32
+static const char* null_device = "NUL";
+#else
+static const char* null_device = "/dev/null";
+#endif
+
+struct Workload {
+    std::string name;
+    std::string source;
+};
+
+// `let r = (((x + 1) * 2) - 3) / ...` nested `depth` levels deep, `count` times
+static Workload deep_expressions(int count, int depth) {
+    const char* operators[] = { " + ", " - ", " * ", " / " };
+    std::string source = "let x = 3\n";
+    for (int i = 0; i < count; i++) {
+        std::string expression = "x";
+        for (int d = 0; d < depth; d++) {
+            std::string operand = d % 5 == 0 ? "x" : std::to_string(d % 7 + 1);
+            expression = "(" + expression + operators[d % 4] + operand + ")";
+        }
+        source += "let r" + std::to_string(i) + " = " + expression + "\n";
+    }
+    return { "deep_expressions", source };
+}
+
+// Thousands of distinct names, each one reading two earlier ones
+static Workload many_variables(int count) {
+    std::string source = "let v0 = 1\n";
+    for (int i = 1; i < count; i++) {
+        source += "let v" + std::to_string(i) + " = v" + std::to_string(i - 1) + " + v" + std::to_string(i / 2) + " * 2\n";
+    }
+    return { "many_variables", source };
+}
+
+// A long straight-line script over a few variables, the shape our generators emit
+static Workload long_script(int lines) {
+    std::string source = "let a = 1\nlet b = 2\nlet c = 0\n";
+    for (int i = 0; i < lines; i++) {
+        switch (i % 4) {
+        case 0: source += "a = a + b * 2 - 1 / (b + 1)\n"; break;
+        case 1: source += "b = b * 1.0001 + (a > 100) - (a < 3)\n"; break;
+        case 2: source += "c = (a + b) ^ 2 / (c + 1)\n"; break;
+        case 3: source += "a = a - c / 3 + 7\n"; break;
+        }
+    }
+    return { "long_script", source };
+}
+
+// A loop over ints only: a counter, IDs past 2^53 and a running sum, which all stay on the int path
+static Workload integer_counters(int iterations) {
+    std::string source = "let i = 0\nlet id = 9007199254740993\nlet sum = 0\n";
+    source += "while i < " + std::to_string(iterations) + " {\n";
+    source += "    id = id + 2\n";
+    source += "    sum = sum + i * 3 - 1\n";
+    source += "    i = i + 1\n";
+    source += "}\nprint id\nprint sum\n";
+    return { "integer_counters", source };
+}
+
+static double best_of(int repeat, const std::function<void()>& run) {
+    double best = 1e300;
+    for (int i = 0; i < repeat; i++) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+static void report(const std::string& workload, const char* phase, size_t items, const char* unit, double seconds) {
+    std::printf("%-18s %-10s %12zu %-11s %10.3f ms %14.0f %s/s\n",
+        workload.c_str(), phase, items, unit, seconds * 1e3, items / seconds, unit);
+}
+
+static void run_workload(const Workload& workload, int repeat) {
+    // Tokenize
+    size_t token_count = 0;
+    double seconds = best_of(repeat, [&] {
+        Environment env;
+        Tokenizer toker(workload.source, &env);
+        token_count = toker.tokenize().size();
+    });
+    report(workload.name, "tokenize", token_count, "tokens", seconds);
+    report(workload.name, "tokenize", workload.source.size(), "bytes", seconds);
+
+    Environment env;
+    std::vector<Token> tokens = Tokenizer(workload.source, &env).tokenize();
+
+    // Parse (a fresh environment each time, every `let` declares again)
+    size_t node_count = 0;
+    Arena arena;
+    seconds = best_of(repeat, [&] {
+        Environment parse_env;
+        arena.reset();
+        Parser parser(tokens, &parse_env, arena);
+        parser.parse();
+        node_count = arena.object_count();
+    });
+    report(workload.name, "parse", node_count, "nodes", seconds);
+
+    arena.reset();
+    Node* root = Parser(tokens, &env, arena).parse();
+    size_t statement_count = 1;
+    if (auto* block = dynamic_cast<BlockNode*>(root)) {
+        statement_count = block->get_statements().size();
+    }
+
+    Node* optimized = root;
+    seconds = best_of(repeat, [&] {
+        optimized = Optimizer(arena).optimize(root);
+    });
+    report(workload.name, "optimize", node_count, "nodes", seconds);
+
+    Chunk chunk;
+    seconds = best_of(repeat, [&] {
+        chunk = Chunk();
+        optimized->compile(chunk);
+        chunk.emit(OP_RETURN);
+    });
+    report(workload.name, "compile", node_count, "nodes", seconds);
+
+    VM vm;
+    seconds = best_of(repeat, [&] {
+        vm.run(chunk, env.data());
+    });
+    report(workload.name, "vm", statement_count, "statements", seconds);
+
+    seconds = best_of(repeat, [&] {
+        optimized->evaluate();
+    });
+    report(workload.name, "tree", statement_count, "statements", seconds);
+}
+
+// One formula evaluated over and over with new inputs, compiled once vs parsed again every time
+static void run_prepared(int scale, int repeat) {
+    const std::string name = "prepared_formula";
+    const int evaluations = 200000 * scale;
+    auto formula = PreparedExpression::compile("a * (x ^ 2) + b * x + c");
+
+    double sink = 0;
+    double seconds = best_of(repeat, [&] {
+        for (int i = 0; i < evaluations; i++) {
+            sink += formula->evaluate({ 1.5, i * 0.001, 2, 3 });
+        }
+    });
+    report(name, "prepared", evaluations, "evals", seconds);
+
+    // The same formula parsed by the C++ compiler, nothing left to do at runtime but the math
+    auto inlined = SHITLANG_STATIC_EXPRESSION("a * (x ^ 2) + b * x + c");
+    seconds = best_of(repeat, [&] {
+        for (int i = 0; i < evaluations; i++) {
+            sink += inlined({ 1.5, i * 0.001, 2, 3 });
+        }
+    });
+    report(name, "static", evaluations, "evals", seconds);
+
+    // What embedding looked like before, a fresh tokenize + parse + compile for every call
+    const int reparses = evaluations / 10;
+    seconds = best_of(repeat, [&] {
+        for (int i = 0; i < reparses; i++) {
+            Environment env;
+            Arena arena;
+            env["a"] = 1.5;
+            env["x"] = i * 0.001;
+            env["b"] = 2;
+            env["c"] = 3;
+            std::string source = "a * (x ^ 2) + b * x + c";
+            std::vector<Token> tokens = Tokenizer(source, &env).tokenize();
+            sink += execute(Parser(tokens, &env, arena).parse(), env).to_double();
+        }
+    });
+    report(name, "reparse", reparses, "evals", seconds);
+
+    if (sink == 42) {
+        std::printf("\n"); // Keeps the loops from being optimized away
+    }
+}
+
+int main(int argc, char** argv) {
+    int scale = 1;
+    int repeat = 5;
+    std::string filter;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--scale" && i + 1 < argc) {
+            scale = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        }
+        else {
+            std::cerr << "usage: shitlang_bench [--scale N] [--repeat N] [--filter name]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Workload> workloads = {
+        deep_expressions(200 * scale, 64),
+        many_variables(20000 * scale),
+        long_script(100000 * scale),
+        integer_counters(200000 * scale),
+    };
+
+    // Anything the workloads print goes nowhere, we are measuring the interpreter, not the terminal
+    std::FILE* null_file = std::fopen(null_device, "w");
+    {
+        OutputSink null_sink(null_file ? null_file : stdout);
+        OutputSink::set_current(&null_sink);
+
+        std::printf("%-18s %-10s %12s %-11s %13s %14s\n", "workload", "phase", "items", "", "best", "throughput");
+        for (const Workload& workload : workloads) {
+            if (!filter.empty() && workload.name.find(filter) == std::string::npos) {
+                continue;
+            }
+            run_workload(workload, repeat);
+        }
+        if (filter.empty() || std::string("prepared_formula").find(filter) != std::string::npos) {
+            run_prepared(scale, repeat);
+        }
+
+        OutputSink::set_current(nullptr);
+    }
+    if (null_file) {
+        std::fclose(null_file);
+    }
+    return 0;
+}
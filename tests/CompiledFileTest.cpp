@@ -0,0 +1,239 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+
+#include "CompiledFile.h"
+#include "Interpreter.h"
+#include "Environment.h"
+#include "Arena.h"
+#include "OutputSink.h"
+
+/*
+    Checks for the .slc loader. The VM runs a loaded file's bytecode in place and without bounds checks,
+    so CompiledFile::open() has to turn away anything the compiler couldn't have written.
+    Every forged file starts from a real one, breaks one thing and then fixes the payload hash up, so the
+    check being tested is the only thing that can reject it. An untouched copy going through the same
+    steps has to load, or the other cases would pass for the wrong reason.
+
+    usage: shitlang_compiled_file_test <scratch folder>
+*/
+
+namespace fs = std::filesystem;
+
+static const char* script =
+    "fn fact(n) {\n"
+    "    if n < 2 { 1 } else { n * fact(n - 1) }\n"
+    "}\n"
+    "fn twice(n) {\n"
+    "    let a = fact(n)\n"
+    "    a + a\n"
+    "}\n"
+    "let total = 0\n"
+    "let i = 0\n"
+    "while i < 5 {\n"
+    "    i = i + 1\n"
+    "    total = total + twice(i)\n"
+    "}\n"
+    "print total\n"
+    "print fact(10) / 7\n"
+    "print 2.5 ^ 3\n";
+
+// Where the header keeps what the tests touch, see Header in CompiledFile.cpp
+constexpr size_t header_size = 64;
+constexpr size_t payload_hash_at = 32;
+constexpr size_t constant_count_at = 44;
+constexpr size_t code_size_at = 48;
+constexpr size_t symbols_size_at = 52;
+constexpr size_t max_stack_at = 56;
+constexpr size_t functions_size_at = 60;
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+static std::string read_file(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream bytes;
+    bytes << in.rdbuf();
+    return bytes.str();
+}
+
+static void write_file(const fs::path& path, const std::string& bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+static uint32_t get_u32(const std::string& bytes, size_t at) {
+    uint32_t value;
+    std::memcpy(&value, bytes.data() + at, sizeof(value));
+    return value;
+}
+
+static void set_u32(std::string& bytes, size_t at, uint32_t value) {
+    std::memcpy(&bytes[at], &value, sizeof(value));
+}
+
+// Runs the script with a fresh environment, the .slc cache on or off, and returns what it printed
+static std::string run(const fs::path& path, bool cache, int& status) {
+    std::string output;
+    {
+        OutputSink sink(&output);
+        OutputSink::set_current(&sink);
+        Environment variables;
+        Arena arena;
+        InterpreterOptions options;
+        options.bytecode_cache = cache;
+        status = run_file(path.string(), variables, arena, options);
+        OutputSink::set_current(nullptr);
+    }
+    return output;
+}
+
+// Whether `bytes`, with its payload hash made to match again, gets past CompiledFile::open()
+static bool loads(const fs::path& path, std::string bytes) {
+    if (bytes.size() >= header_size) {
+        // FNV-1a over everything after the header, the same as hash_bytes() in CompiledFile.cpp
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (size_t i = header_size; i < bytes.size(); i++) {
+            hash = (hash ^ static_cast<uint8_t>(bytes[i])) * 0x100000001b3ull;
+        }
+        std::memcpy(&bytes[payload_hash_at], &hash, sizeof(hash));
+    }
+    write_file(path, bytes);
+    return CompiledFile::open(path.string(), script, true) != nullptr;
+}
+
+static bool has_operand(uint8_t op) {
+    switch (op) {
+    case OP_CONSTANT: case OP_LOAD: case OP_STORE: case OP_LOAD_LOCAL: case OP_STORE_LOCAL: case OP_LOAD_REACTIVE:
+    case OP_CALL: case OP_POWI: case OP_JUMP: case OP_JUMP_IF_FALSE: case OP_LINE: case OP_CALL_NATIVE:
+    case OP_CALL_NATIVE_CHECKED: case OP_VECTOR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Offset of the first jump's operand in the main program's code, 0 if there isn't one
+static size_t find_jump(const std::string& bytes) {
+    size_t code = header_size + static_cast<size_t>(get_u32(bytes, constant_count_at)) * 16;
+    size_t end = code + get_u32(bytes, code_size_at);
+    for (size_t at = code; at < end; at += has_operand(static_cast<uint8_t>(bytes[at])) ? 5 : 1) {
+        uint8_t op = static_cast<uint8_t>(bytes[at]);
+        if (op == OP_JUMP || op == OP_JUMP_IF_FALSE) {
+            return at + 1;
+        }
+    }
+    return 0;
+}
+
+// Offset of the first entry in the first function's call table, 0 if it has none
+static size_t find_function_call(const std::string& bytes) {
+    size_t at = header_size + static_cast<size_t>(get_u32(bytes, constant_count_at)) * 16
+        + get_u32(bytes, code_size_at) + get_u32(bytes, symbols_size_at);
+    at += 4 + 4 * static_cast<size_t>(get_u32(bytes, at)); // The program's call table
+    if (get_u32(bytes, at) < 2) {
+        return 0; // A forward call needs a function after it
+    }
+    at += 4;
+    at += 4 + get_u32(bytes, at); // Name
+    at += 5 * 4;                  // Arity, locals, max stack, constant count, code size
+    return get_u32(bytes, at) == 0 ? 0 : at + 4;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: shitlang_compiled_file_test <scratch folder>" << std::endl;
+        return 1;
+    }
+    fs::path folder = argv[1];
+    fs::remove_all(folder);
+    fs::create_directories(folder);
+    fs::path source = folder / "test.sl";
+    fs::path compiled = folder / "test.slc";
+    write_file(source, script);
+
+    // Round trip: writing the .slc and running from it both print exactly what a plain run does
+    int status = 0;
+    std::string cold = run(source, false, status);
+    check(status == 0 && !cold.empty(), "the script runs");
+    check(!fs::exists(compiled), "a run without the cache writes no .slc");
+    std::string saving = run(source, true, status);
+    check(status == 0 && saving == cold, "the run that writes the .slc prints the same");
+    check(CompiledFile::open(compiled.string(), script, true) != nullptr, "the .slc it wrote loads");
+    std::string warm = run(source, true, status);
+    check(status == 0 && warm == cold, "a run from the .slc prints the same");
+    check(CompiledFile::open(compiled.string(), "print 1\n", true) == nullptr, "an edited script doesn't match");
+    check(CompiledFile::open(compiled.string(), script, false) == nullptr, "an unoptimized run doesn't take an optimized .slc");
+
+    std::string original = read_file(compiled);
+    if (original.size() <= header_size) {
+        std::cerr << "FAIL: the .slc is missing" << std::endl;
+        return 1;
+    }
+    fs::path forged = folder / "forged.slc";
+    check(loads(forged, original), "an untouched copy loads");
+
+    check(!loads(forged, original.substr(0, header_size)), "rejects a file cut off after the header");
+    check(!loads(forged, original.substr(0, original.size() - 1)), "rejects a file missing its last byte");
+    std::string cut = original.substr(0, original.size() - 1);
+    set_u32(cut, functions_size_at, get_u32(original, functions_size_at) - 1); // Sizes add up, the last function is short
+    check(!loads(forged, cut), "rejects a function cut off in the middle");
+    std::string longer = original + std::string(4, '\0');
+    check(!loads(forged, longer), "rejects a file with bytes left over");
+
+    uint32_t max_stack = get_u32(original, max_stack_at);
+    std::string shallow = original;
+    set_u32(shallow, max_stack_at, 0);
+    check(!loads(forged, shallow), "rejects a max stack of 0");
+    // The compiler's figure can be a bit over, what the loader works out is the least it takes
+    uint32_t needed = 0;
+    for (; needed <= max_stack; needed++) {
+        set_u32(shallow, max_stack_at, needed);
+        if (loads(forged, shallow)) {
+            break;
+        }
+    }
+    check(needed >= 2 && needed <= max_stack, "rejects every max stack too small for `total + twice(i)`");
+    set_u32(shallow, max_stack_at, max_stack + 8);
+    check(loads(forged, shallow), "takes a max stack with room to spare");
+
+    size_t jump = find_jump(original);
+    check(jump != 0, "the program has a jump to break");
+    if (jump != 0) {
+        uint32_t code_size = get_u32(original, code_size_at);
+        std::string broken = original;
+        set_u32(broken, jump, code_size);
+        check(!loads(forged, broken), "rejects a jump past the end of the code");
+        set_u32(broken, jump, static_cast<uint32_t>(jump - header_size - get_u32(original, constant_count_at) * 16));
+        check(!loads(forged, broken), "rejects a jump into the middle of an instruction");
+    }
+
+    size_t call = find_function_call(original);
+    check(call != 0, "the first function has a call to break");
+    if (call != 0) {
+        std::string forward = original;
+        set_u32(forward, call, 1);
+        check(!loads(forged, forward), "rejects a function calling one defined after it");
+        set_u32(forward, call, 1000);
+        check(!loads(forged, forward), "rejects a call to a function that doesn't exist");
+    }
+
+    fs::remove_all(folder);
+    if (failures != 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all .slc checks passed" << std::endl;
+    return 0;
+}